@@ -0,0 +1,1295 @@
+#include "matrixmarket.hpp"
+#include <cstdio>
+#include <cstdlib>
+#include <cstring>
+#include <cstdint>
+#include <string>
+#include <vector>
+#include <stdexcept>
+#include <algorithm>
+#include <random>
+#include <map>
+#include <chrono>
+#include <cstddef>
+#include <type_traits>
+#include <sys/stat.h>
+#include <unistd.h>
+#ifdef MATRIXMARKET_WITH_ZLIB
+#include <zlib.h>
+#endif
+
+// Times read_csr/read_csc/read_csr_csc in each load mode over a set of files
+// and reports min/median wall time, per-phase medians and throughput.
+//
+//   bench [--repeats N] [--warmup N] [--threads N] [--float | --no-values]
+//         [--configs name,name,...] [--csv FILE] [--json FILE]
+//         [--synthetic ROWSxNNZ]... [--verify] [file.mtx ...]
+//
+// With --verify it instead checks that every config (plus a load from
+// memory) gives byte-identical CSRMatrix/CSCMatrix arrays to the reference
+// LoadMode::STREAM reader, over a generated corpus and the given files, and
+// reports one load time per config. It also checks that every config rejects
+// a set of malformed files with the message of the reference, and that the
+// reference itself loads each valid file. The other engines (write_mtx,
+// read_bsr, read_sell, read_packed_csr, reordering, the block readers,
+// EntryReader, gzip input when built with zlib, the binary format and its
+// damaged files) are checked against the reference CSR, and read_dense on
+// generated array files. Exits with 1 on any mismatch.
+
+using namespace MatrixMarket;
+
+struct Config {
+    const char* name;
+    const char* reader;  // "csr", "csc" or "csr_csc"
+    LoadMode mode;
+    bool low_memory;
+    bool cache;
+    bool detect_sorted;
+    ValidationMode validation;
+};
+
+static const Config all_configs[] = {
+    { "csr-stream",       "csr",     LoadMode::STREAM,   false, false, true,  ValidationMode::STRICT   },
+    { "csr-mmap",         "csr",     LoadMode::MMAP,     false, false, true,  ValidationMode::STRICT   },
+    { "csr-parallel",     "csr",     LoadMode::PARALLEL, false, false, true,  ValidationMode::STRICT   },
+    { "csr-unsorted",     "csr",     LoadMode::PARALLEL, false, false, false, ValidationMode::STRICT   },
+    { "csr-deferred",     "csr",     LoadMode::PARALLEL, false, false, true,  ValidationMode::DEFERRED },
+    { "csr-lowmem",       "csr",     LoadMode::PARALLEL, true,  false, true,  ValidationMode::STRICT   },
+    { "csr-cached",       "csr",     LoadMode::PARALLEL, false, true,  true,  ValidationMode::STRICT   },
+    { "csc-mmap",         "csc",     LoadMode::MMAP,     false, false, true,  ValidationMode::STRICT   },
+    { "csc-parallel",     "csc",     LoadMode::PARALLEL, false, false, true,  ValidationMode::STRICT   },
+    { "csr-csc-parallel", "csr_csc", LoadMode::PARALLEL, false, false, true,  ValidationMode::STRICT   },
+};
+
+struct Result {
+    std::string file;
+    std::string config;
+    size_t bytes;
+    size_t nnz;
+    int repeats;
+    double min_seconds;
+    double median_seconds;
+    double header_seconds;
+    double parse_seconds;
+    double convert_seconds;
+    double assemble_seconds;
+    size_t peak_bytes;
+};
+
+static double median(std::vector<double> v) {
+    std::sort(v.begin(), v.end());
+    const size_t n = v.size();
+    return n % 2 == 1 ? v[n / 2] : 0.5 * (v[n / 2 - 1] + v[n / 2]);
+}
+
+static bool file_exists(const std::string& name) {
+    struct stat st;
+    return ::stat(name.c_str(), &st) == 0;
+}
+
+static size_t file_size(const std::string& name) {
+    struct stat st;
+    return ::stat(name.c_str(), &st) == 0 ? static_cast<size_t>(st.st_size) : 0;
+}
+
+static LoadOptions config_options(const Config& config, unsigned threads) {
+    LoadOptions options(config.mode, threads);
+    options.low_memory = config.low_memory;
+    options.cache = config.cache;
+    options.detect_sorted = config.detect_sorted;
+    options.validation = config.validation;
+    return options;
+}
+
+template<typename ValueType>
+static size_t load_once(const char* filename, const Config& config, const LoadOptions& options) {
+    if (std::strcmp(config.reader, "csc") == 0) {
+        return read_csc<uint32_t,ValueType>(filename, options).num_nonzeros;
+    } else if (std::strcmp(config.reader, "csr_csc") == 0) {
+        return read_csr_csc<uint32_t,ValueType>(filename, options).first.num_nonzeros;
+    }
+    return read_csr<uint32_t,ValueType>(filename, options).num_nonzeros;
+}
+
+template<typename ValueType>
+static Result run(const std::string& file, const Config& config, int repeats, int warmup, unsigned threads) {
+    LoadStats stats;
+    LoadOptions options = config_options(config, threads);
+    options.stats = &stats;
+
+    const std::string sidecar = cache_file_name<uint32_t,ValueType>(file.c_str(), options, BinaryLayout::CSR);
+    const bool had_sidecar = file_exists(sidecar);
+
+    Result result;
+    result.file = file;
+    result.config = config.name;
+    result.bytes = file_size(file);
+    result.repeats = repeats;
+    result.peak_bytes = 0;
+
+    for (int i = 0; i < warmup; i++) {
+        result.nnz = load_once<ValueType>(file.c_str(), config, options);
+    }
+
+    std::vector<double> total, header, parse, convert, assemble;
+    for (int i = 0; i < repeats; i++) {
+        result.nnz = load_once<ValueType>(file.c_str(), config, options);
+        total.push_back(stats.total_seconds);
+        header.push_back(stats.header_seconds);
+        parse.push_back(stats.parse_seconds);
+        convert.push_back(stats.convert_seconds);
+        assemble.push_back(stats.assemble_seconds);
+        result.peak_bytes = std::max(result.peak_bytes, stats.peak_bytes);
+    }
+
+    if (config.cache && !had_sidecar) {
+        std::remove(sidecar.c_str());
+    }
+
+    result.min_seconds = *std::min_element(total.begin(), total.end());
+    result.median_seconds = median(total);
+    result.header_seconds = median(header);
+    result.parse_seconds = median(parse);
+    result.convert_seconds = median(convert);
+    result.assemble_seconds = median(assemble);
+    return result;
+}
+
+// Writes a random general real matrix in file order (not sorted)
+static std::string write_synthetic(const char* spec) {
+    unsigned long long rows = 0, nnz = 0;
+    if (std::sscanf(spec, "%llux%llu", &rows, &nnz) != 2 || rows == 0) {
+        fprintf(stderr, "Bad --synthetic spec '%s', expected ROWSxNNZ\n", spec);
+        std::exit(1);
+    }
+    const char* tmpdir = std::getenv("TMPDIR");
+    const std::string name = std::string(tmpdir != nullptr ? tmpdir : "/tmp") +
+                             "/bench_synthetic_" + std::to_string(rows) + "x" + std::to_string(nnz) + ".mtx";
+    if (file_exists(name)) {
+        return name;
+    }
+    FILE* f = std::fopen(name.c_str(), "w");
+    if (f == nullptr) {
+        fprintf(stderr, "Could not write %s\n", name.c_str());
+        std::exit(1);
+    }
+    std::mt19937_64 rng(42);
+    std::uniform_int_distribution<unsigned long long> coord(1, rows);
+    std::uniform_real_distribution<double> value(-1.0, 1.0);
+    fprintf(f, "%%%%MatrixMarket matrix coordinate real general\n%llu %llu %llu\n", rows, rows, nnz);
+    for (unsigned long long i = 0; i < nnz; i++) {
+        fprintf(f, "%llu %llu %.17g\n", coord(rng), coord(rng), value(rng));
+    }
+    std::fclose(f);
+    return name;
+}
+
+static bool selected(const std::string& list, const char* name) {
+    if (list.empty()) {
+        return true;
+    }
+    const std::string padded = "," + list + ",";
+    return padded.find("," + std::string(name) + ",") != std::string::npos;
+}
+
+// A generated file of the verification corpus
+static void write_corpus_file(const std::string& name, const char* kind, unsigned long long rows,
+                              unsigned long long cols, const std::vector<std::pair<unsigned long long,
+                              unsigned long long>>& entries, int comments, bool crlf) {
+    FILE* f = std::fopen(name.c_str(), "wb");
+    if (f == nullptr) {
+        fprintf(stderr, "Could not write %s\n", name.c_str());
+        std::exit(1);
+    }
+    const char* eol = crlf ? "\r\n" : "\n";
+    const bool pattern = std::strstr(kind, "pattern") != nullptr;
+    const bool integer = std::strstr(kind, "integer") != nullptr;
+    fprintf(f, "%%%%MatrixMarket matrix coordinate %s%s", kind, eol);
+    for (int i = 0; i < comments; i++) {
+        fprintf(f, "%% comment %d%s%s", i, i % 7 == 0 ? " with a longer tail of text,,, 1 2 3" : "", eol);
+    }
+    fprintf(f, "%llu %llu %zu%s", rows, cols, entries.size(), eol);
+    std::mt19937_64 rng(7);
+    std::uniform_real_distribution<double> value(-1.0, 1.0);
+    for (const auto& e : entries) {
+        if (pattern) {
+            fprintf(f, "%llu %llu%s", e.first, e.second, eol);
+        } else if (integer) {
+            fprintf(f, "%llu %llu %d%s", e.first, e.second, static_cast<int>(rng() % 2001) - 1000, eol);
+        } else {
+            fprintf(f, "%llu %llu %.17g%s", e.first, e.second, value(rng), eol);
+        }
+    }
+    std::fclose(f);
+}
+
+// Writes the corpus: every value format and symmetry, duplicates, comments,
+// CRLF endings, empty rows, dimensions far beyond the entry count, input
+// already in row order and an empty matrix
+static std::string corpus_dir() {
+    const char* tmpdir = std::getenv("TMPDIR");
+    const std::string dir = std::string(tmpdir != nullptr ? tmpdir : "/tmp") + "/bench_corpus";
+    ::mkdir(dir.c_str(), 0755);
+    return dir;
+}
+
+static std::vector<std::string> write_corpus() {
+    const std::string dir = corpus_dir();
+
+    typedef std::vector<std::pair<unsigned long long, unsigned long long>> Entries;
+    std::mt19937_64 rng(42);
+    auto random_entries = [&](unsigned long long rows, unsigned long long cols, size_t nnz, bool lower) {
+        Entries entries;
+        for (size_t i = 0; i < nnz; i++) {
+            unsigned long long row = rng() % rows + 1;
+            unsigned long long col = rng() % cols + 1;
+            if (lower && col > row) {
+                std::swap(row, col);
+            }
+            entries.emplace_back(row, col);
+        }
+        return entries;
+    };
+
+    std::vector<std::string> files;
+    auto add = [&](const char* name, const char* kind, unsigned long long rows, unsigned long long cols,
+                   const Entries& entries, int comments, bool crlf) {
+        files.push_back(dir + "/" + name);
+        write_corpus_file(files.back(), kind, rows, cols, entries, comments, crlf);
+    };
+
+    add("real-general.mtx", "real general", 20000, 15000, random_entries(20000, 15000, 300000, false), 2, false);
+    add("integer-general.mtx", "integer general", 5000, 5000, random_entries(5000, 5000, 50000, false), 0, false);
+    add("pattern-general.mtx", "pattern general", 3000, 8000, random_entries(3000, 8000, 40000, false), 0, false);
+    add("real-symmetric.mtx", "real symmetric", 8000, 8000, random_entries(8000, 8000, 100000, true), 1, false);
+    add("integer-symmetric.mtx", "integer symmetric", 4000, 4000, random_entries(4000, 4000, 30000, true), 0,
+        false);
+    add("pattern-symmetric.mtx", "pattern symmetric", 4000, 4000, random_entries(4000, 4000, 30000, true), 0,
+        false);
+    add("real-skew.mtx", "real skew-symmetric", 3000, 3000, random_entries(3000, 3000, 20000, true), 0, false);
+
+    // Upper-triangle entries of a symmetric matrix are mirrored into place
+    Entries upper = random_entries(3000, 3000, 20000, true);
+    for (auto& e : upper) {
+        std::swap(e.first, e.second);
+    }
+    add("real-symmetric-upper.mtx", "real symmetric", 3000, 3000, upper, 0, false);
+
+    // Every coordinate three times, in scattered order
+    Entries duplicates = random_entries(2000, 2000, 20000, false);
+    duplicates.insert(duplicates.end(), duplicates.begin(), duplicates.end());
+    duplicates.insert(duplicates.end(), duplicates.begin(), duplicates.begin() + 20000);
+    std::shuffle(duplicates.begin(), duplicates.end(), rng);
+    add("duplicates.mtx", "integer general", 2000, 2000, duplicates, 0, false);
+
+    add("comments.mtx", "real general", 1000, 1000, random_entries(1000, 1000, 5000, false), 5000, false);
+    add("crlf.mtx", "real general", 4000, 4000, random_entries(4000, 4000, 60000, false), 3, true);
+    add("crlf-pattern-symmetric.mtx", "pattern symmetric", 2000, 2000, random_entries(2000, 2000, 20000, true),
+        1, true);
+
+    // Only every 97th row has entries, which includes neither the first nor
+    // the last one
+    Entries sparse_rows = random_entries(1000, 50000, 30000, false);
+    for (auto& e : sparse_rows) {
+        e.first = 2 + (e.first % 1000) * 97;
+    }
+    add("empty-rows.mtx", "real general", 100000, 50000, sparse_rows, 0, false);
+
+    Entries huge = random_entries(5000000, 5000000, 2000, false);
+    huge.emplace_back(5000000, 5000000);
+    huge.emplace_back(1, 5000000);
+    add("huge-dims.mtx", "real general", 5000000, 5000000, huge, 0, false);
+
+    // In row order and unique, for the sorted fast path
+    Entries sorted = random_entries(20000, 20000, 200000, false);
+    std::sort(sorted.begin(), sorted.end());
+    sorted.erase(std::unique(sorted.begin(), sorted.end()), sorted.end());
+    add("sorted.mtx", "real general", 20000, 20000, sorted, 0, false);
+
+    // In column order, for the fast path of the CSC readers
+    for (auto& e : sorted) {
+        std::swap(e.first, e.second);
+    }
+    std::sort(sorted.begin(), sorted.end());
+    for (auto& e : sorted) {
+        std::swap(e.first, e.second);
+    }
+    add("sorted-by-col.mtx", "pattern general", 20000, 20000, sorted, 0, false);
+
+    add("empty.mtx", "real general", 10, 10, Entries(), 1, false);
+    return files;
+}
+
+// A malformed file: 60000 valid entries of a 10000x10000 matrix of `kind`
+// with `bad_line` (if any) in the middle, so that the parallel readers meet
+// it away from a chunk boundary, and `extra` added to the declared count
+static std::string write_bad_corpus_file(const std::string& name, const char* bad_line, int extra,
+                                         const char* kind = "real general") {
+    const std::string file = corpus_dir() + "/" + name;
+    FILE* f = std::fopen(file.c_str(), "wb");
+    if (f == nullptr) {
+        fprintf(stderr, "Could not write %s\n", file.c_str());
+        std::exit(1);
+    }
+    const int good = 60000;
+    const bool integer = std::strstr(kind, "integer") != nullptr;
+    const int lines = good + (bad_line != nullptr ? 1 : 0);
+    fprintf(f, "%%%%MatrixMarket matrix coordinate %s\n10000 10000 %d\n", kind, lines + extra);
+    std::mt19937_64 rng(3);
+    for (int i = 0; i < good; i++) {
+        if (i == good / 2 && bad_line != nullptr) {
+            fprintf(f, "%s\n", bad_line);
+        }
+        fprintf(f, "%d %d %d%s\n", static_cast<int>(rng() % 10000) + 1, static_cast<int>(rng() % 10000) + 1,
+                static_cast<int>(rng() % 100), integer ? "" : ".5");
+    }
+    std::fclose(f);
+    return file;
+}
+
+// Files every reader has to reject
+static std::vector<std::string> write_bad_corpus() {
+    std::vector<std::string> files;
+    files.push_back(write_bad_corpus_file("bad-row-out-of-range.mtx", "10001 7 1.5", 0));
+    files.push_back(write_bad_corpus_file("bad-col-out-of-range.mtx", "7 10001 1.5", 0));
+    files.push_back(write_bad_corpus_file("bad-zero-index.mtx", "0 7 1.5", 0));
+    files.push_back(write_bad_corpus_file("bad-overflowing-index.mtx", "4294967297 7 1.5", 0));
+    files.push_back(write_bad_corpus_file("bad-short-line.mtx", "7", 0));
+    files.push_back(write_bad_corpus_file("bad-too-many-entries.mtx", nullptr, -1));
+    files.push_back(write_bad_corpus_file("bad-too-few-entries.mtx", nullptr, 1));
+    files.push_back(write_bad_corpus_file("bad-value-not-a-number.mtx", "7 7 abc", 0));
+    files.push_back(write_bad_corpus_file("bad-value-trailing-junk.mtx", "7 7 1.5x", 0));
+    files.push_back(write_bad_corpus_file("bad-value-hex-float.mtx", "7 7 0x1p3", 0));
+    files.push_back(write_bad_corpus_file("bad-integer-trailing-junk.mtx", "7 7 3x", 0, "integer general"));
+    files.push_back(write_bad_corpus_file("bad-coordinate-trailing-junk.mtx", "7x 7 1.5", 0));
+    return files;
+}
+
+template<typename Array>
+static bool same_bytes(const Array& a, const Array& b) {
+    return a.size() == b.size() &&
+           (a.size() == 0 || std::memcmp(a.data(), b.data(), a.size() * sizeof(a.data()[0])) == 0);
+}
+
+// Segment by segment, ignoring the order of entries with equal indices,
+// which LoadOptions::low_memory leaves unspecified
+template<typename Offsets, typename Indices, typename Values>
+static bool same_segments(const Offsets& offsets, const Indices& indices, const Values& values,
+                          const Indices& ref_indices, const Values& ref_values) {
+    if (indices.size() != ref_indices.size() || values.size() != ref_values.size()) {
+        return false;
+    }
+    const size_t value_bytes = values.size() != 0 ? sizeof(values.data()[0]) : 0;
+    auto entry = [&](const Indices& idx, const Values& vals, size_t k) {
+        std::string bytes(reinterpret_cast<const char*>(&idx[k]), sizeof(idx[k]));
+        if (value_bytes != 0) {
+            bytes.append(reinterpret_cast<const char*>(&vals[k]), value_bytes);
+        }
+        return bytes;
+    };
+    std::vector<std::string> mine, theirs;
+    for (size_t s = 0; s + 1 < offsets.size(); s++) {
+        mine.clear();
+        theirs.clear();
+        for (size_t k = static_cast<size_t>(offsets[s]); k < static_cast<size_t>(offsets[s + 1]); k++) {
+            mine.push_back(entry(indices, values, k));
+            theirs.push_back(entry(ref_indices, ref_values, k));
+        }
+        std::sort(mine.begin(), mine.end());
+        std::sort(theirs.begin(), theirs.end());
+        if (mine != theirs) {
+            return false;
+        }
+    }
+    return true;
+}
+
+template<typename Matrix>
+static bool same_shape(const Matrix& m, const Matrix& ref) {
+    return m.num_rows == ref.num_rows && m.num_cols == ref.num_cols && m.num_nonzeros == ref.num_nonzeros &&
+           m.symmetry == ref.symmetry && m.index_base == ref.index_base;
+}
+
+template<typename ValueType>
+static bool same_matrix(const CSRMatrix<uint32_t,ValueType>& m, const CSRMatrix<uint32_t,ValueType>& ref,
+                        bool any_order) {
+    return same_shape(m, ref) && same_bytes(m.row_offsets, ref.row_offsets) &&
+           ((same_bytes(m.col_indices, ref.col_indices) && same_bytes(m.values, ref.values)) ||
+            (any_order && same_segments(m.row_offsets, m.col_indices, m.values, ref.col_indices, ref.values)));
+}
+
+template<typename ValueType>
+static bool same_matrix(const CSCMatrix<uint32_t,ValueType>& m, const CSCMatrix<uint32_t,ValueType>& ref,
+                        bool any_order) {
+    return same_shape(m, ref) && same_bytes(m.col_offsets, ref.col_offsets) &&
+           ((same_bytes(m.row_indices, ref.row_indices) && same_bytes(m.values, ref.values)) ||
+            (any_order && same_segments(m.col_offsets, m.row_indices, m.values, ref.row_indices, ref.values)));
+}
+
+static void print_check(const std::string& file, const char* config, bool ok, double seconds, size_t bytes) {
+    printf("%-46s %-17s %-8s %10.4f %9.1f\n", file.c_str(), config, ok ? "ok" : "MISMATCH", seconds,
+           seconds > 0 ? bytes / 1e6 / seconds : 0.0);
+}
+
+static std::string read_file(const std::string& file) {
+    const size_t bytes = file_size(file);
+    std::string data(bytes, '\0');
+    FILE* f = std::fopen(file.c_str(), "rb");
+    const size_t got = f != nullptr ? std::fread(&data[0], 1, bytes, f) : 0;
+    if (f != nullptr) {
+        std::fclose(f);
+    }
+    if (got != bytes) {
+        throw std::runtime_error("could not read " + file);
+    }
+    return data;
+}
+
+// The message `load` throws, or an empty string if it returns
+template<typename Load>
+static std::string rejection(Load load) {
+    try {
+        load();
+    } catch (const std::exception& e) {
+        return e.what();
+    }
+    return std::string();
+}
+
+// Checks of the other readers and writers against the reference CSR. Each
+// returns whether the result matches and throws on a load error.
+
+// Runs `check` if `name` is selected and prints its line. Returns the number
+// of mismatches.
+template<typename Check>
+static int run_check(const std::string& file, const char* name, const std::string& configs, Check check) {
+    if (!selected(configs, name)) {
+        return 0;
+    }
+    const auto start = std::chrono::steady_clock::now();
+    bool ok;
+    try {
+        ok = check();
+    } catch (const std::exception& e) {
+        fprintf(stderr, "%s [%s]: %s\n", file.c_str(), name, e.what());
+        ok = false;
+    }
+    const double seconds = std::chrono::duration<double>(std::chrono::steady_clock::now() - start).count();
+    print_check(file, name, ok, seconds, file_size(file));
+    return ok ? 0 : 1;
+}
+
+// A scratch file in the corpus directory, named after `file`
+static std::string scratch_name(const std::string& file, const char* suffix) {
+    return corpus_dir() + "/scratch-" + file.substr(file.find_last_of('/') + 1) + suffix;
+}
+
+static void write_file(const std::string& file, const std::string& data) {
+    FILE* f = std::fopen(file.c_str(), "wb");
+    const size_t put = f != nullptr ? std::fwrite(data.data(), 1, data.size(), f) : 0;
+    if (f == nullptr || std::fclose(f) != 0 || put != data.size()) {
+        throw std::runtime_error("could not write " + file);
+    }
+}
+
+template<typename T>
+static bool same_value(const T& a, const T& b) {
+    return a == b;
+}
+
+static bool same_value(const NoValue&, const NoValue&) {
+    return true;
+}
+
+template<typename T>
+static void add_value(T& sum, const T& value) {
+    sum += value;
+}
+
+static void add_value(NoValue&, const NoValue&) {}
+
+// The entries of each row as (column, value) bytes, sorted, for comparing
+// matrices whose rows may hold equal indices in another order
+template<typename ValueType>
+struct RowSets {
+    std::vector<std::vector<std::string>> rows;
+
+    explicit RowSets(size_t num_rows) : rows(num_rows) {}
+
+    void add(size_t row, uint64_t col, const typename ValueTraits<ValueType>::value_type& value) {
+        std::string bytes(reinterpret_cast<const char*>(&col), sizeof(col));
+        bytes.append(reinterpret_cast<const char*>(&value), ValueTraits<ValueType>::bytes);
+        rows[row].push_back(bytes);
+    }
+
+};
+
+template<typename ValueType>
+static bool same_rows(RowSets<ValueType>& a, RowSets<ValueType>& b) {
+    for (auto* sets : { &a, &b }) {
+        for (auto& row : sets->rows) {
+            std::sort(row.begin(), row.end());
+        }
+    }
+    return a.rows == b.rows;
+}
+
+template<typename ValueType>
+static RowSets<ValueType> row_sets(const CSRMatrix<uint32_t,ValueType>& csr) {
+    RowSets<ValueType> sets(csr.num_rows);
+    for (size_t i = 0; i < csr.num_rows; i++) {
+        for (size_t k = csr.row_offsets[i]; k < csr.row_offsets[i + 1]; k++) {
+            sets.add(i, csr.col_indices[k], csr.values[k]);
+        }
+    }
+    return sets;
+}
+
+// write_mtx reads back to the same matrix
+template<typename ValueType>
+static bool check_write_mtx(const std::string& file, const CSRMatrix<uint32_t,ValueType>& ref) {
+    const std::string copy = scratch_name(file, ".mtx");
+    write_mtx(copy.c_str(), ref);
+    const auto back = read_csr<uint32_t,ValueType>(copy.c_str(), LoadOptions(LoadMode::STREAM));
+    std::remove(copy.c_str());
+    return same_shape(back, ref) && same_bytes(back.row_offsets, ref.row_offsets) &&
+           same_bytes(back.col_indices, ref.col_indices) && same_bytes(back.values, ref.values);
+}
+
+// Every stored block position holds the sum of the reference entries there
+// (or zero), and every reference entry falls in a stored block
+template<typename ValueType>
+static bool check_bsr(const std::string& file, const CSRMatrix<uint32_t,ValueType>& ref, unsigned threads) {
+    typedef typename ValueTraits<ValueType>::value_type Value;
+    const uint32_t R = 3, C = 2;
+    const auto bsr = read_bsr<uint32_t,ValueType>(file.c_str(), R, C, LoadOptions(LoadMode::PARALLEL, threads));
+    const size_t block_rows = (ref.num_rows + R - 1) / R;
+    if (bsr.num_rows != ref.num_rows || bsr.num_cols != ref.num_cols || bsr.row_offsets.size() != block_rows + 1 ||
+        bsr.col_indices.size() != bsr.num_blocks ||
+        bsr.values.size() != (ValueTraits<ValueType>::bytes != 0 ? bsr.num_blocks * R * C : 0)) {
+        return false;
+    }
+    std::map<std::pair<size_t, size_t>, Value> sums;
+    for (size_t i = 0; i < ref.num_rows; i++) {
+        for (size_t k = ref.row_offsets[i]; k < ref.row_offsets[i + 1]; k++) {
+            const auto inserted = sums.insert(std::make_pair(std::make_pair(i, size_t(ref.col_indices[k])),
+                                                             ref.values[k]));
+            if (!inserted.second) {
+                add_value(inserted.first->second, ref.values[k]);
+            }
+        }
+    }
+    size_t covered = 0;
+    for (size_t bi = 0; bi < block_rows; bi++) {
+        for (size_t k = bsr.row_offsets[bi]; k < bsr.row_offsets[bi + 1]; k++) {
+            if (k > bsr.row_offsets[bi] && bsr.col_indices[k] <= bsr.col_indices[k - 1]) {
+                return false;
+            }
+            bool nonempty = false;
+            for (size_t r = 0; r < R; r++) {
+                for (size_t c = 0; c < C; c++) {
+                    const size_t row = bi * R + r, col = size_t(bsr.col_indices[k]) * C + c;
+                    const Value& value = bsr.values[(k * R + r) * C + c];
+                    const auto sum = sums.find(std::make_pair(row, col));
+                    if (sum != sums.end()) {
+                        nonempty = true;
+                        covered++;
+                    }
+                    if (!same_value(value, sum != sums.end() ? sum->second : Value())) {
+                        return false;
+                    }
+                }
+            }
+            if (!nonempty) {
+                return false;
+            }
+        }
+    }
+    return covered == sums.size();
+}
+
+// Every matrix row sits in one slot with the reference row in its first
+// entries and zero padding after them
+template<typename ValueType>
+static bool check_sell(const std::string& file, const CSRMatrix<uint32_t,ValueType>& ref, unsigned threads) {
+    typedef typename ValueTraits<ValueType>::value_type Value;
+    const uint32_t chunk = 4, window = 8;
+    const auto sell = read_sell<uint32_t,ValueType>(file.c_str(), chunk, window,
+                                                    LoadOptions(LoadMode::PARALLEL, threads));
+    const size_t num_chunks = (ref.num_rows + chunk - 1) / chunk;
+    if (sell.num_rows != ref.num_rows || sell.num_nonzeros != ref.num_nonzeros ||
+        sell.chunk_offsets.size() != num_chunks + 1 || sell.permutation.size() < ref.num_rows) {
+        return false;
+    }
+    std::vector<bool> seen(ref.num_rows, false);
+    for (size_t s = 0; s < num_chunks * chunk; s++) {
+        const size_t c = s / chunk, r = s % chunk;
+        const size_t length = (sell.chunk_offsets[c + 1] - sell.chunk_offsets[c]) / chunk;
+        size_t first = 0, count = 0;
+        if (s < ref.num_rows) {
+            const size_t row = sell.permutation[s];
+            if (row >= ref.num_rows || seen[row]) {
+                return false;
+            }
+            seen[row] = true;
+            first = ref.row_offsets[row];
+            count = ref.row_offsets[row + 1] - first;
+        }
+        if (count > length) {
+            return false;
+        }
+        for (size_t j = 0; j < length; j++) {
+            const size_t k = sell.chunk_offsets[c] + j * chunk + r;
+            const bool padding = j >= count;
+            if (sell.col_indices[k] != (padding ? 0 : ref.col_indices[first + j]) ||
+                !same_value(sell.values[k], padding ? Value() : Value(ref.values[first + j]))) {
+                return false;
+            }
+        }
+    }
+    return true;
+}
+
+template<typename ValueType>
+static bool check_packed_csr(const std::string& file, const CSRMatrix<uint32_t,ValueType>& ref,
+                             unsigned threads) {
+    const auto packed = read_packed_csr<uint32_t,ValueType>(file.c_str(),
+                                                            LoadOptions(LoadMode::PARALLEL, threads));
+    if (packed.num_rows != ref.num_rows || !same_bytes(packed.row_offsets, ref.row_offsets) ||
+        !same_bytes(packed.values, ref.values)) {
+        return false;
+    }
+    for (uint32_t i = 0; i < ref.num_rows; i++) {
+        size_t k = ref.row_offsets[i];
+        for (uint32_t col : packed.row(i)) {
+            if (col != ref.col_indices[k++]) {
+                return false;
+            }
+        }
+    }
+    return true;
+}
+
+// Row i, column j of the reordered matrix is row and column perm[i], perm[j]
+// of the reference
+template<typename ValueType>
+static bool check_reordered(const std::string& file, const CSRMatrix<uint32_t,ValueType>& ref, unsigned threads,
+                            Reordering reordering) {
+    std::vector<uint64_t> perm;
+    LoadOptions options(LoadMode::PARALLEL, threads);
+    options.reordering = reordering;
+    options.permutation = &perm;
+    const auto csr = read_csr<uint32_t,ValueType>(file.c_str(), options);
+    if (!same_shape(csr, ref) || perm.size() != ref.num_rows) {
+        return false;
+    }
+    std::vector<uint64_t> sorted(perm);
+    std::sort(sorted.begin(), sorted.end());
+    for (size_t i = 0; i < sorted.size(); i++) {
+        if (sorted[i] != i) {
+            return false;
+        }
+    }
+    RowSets<ValueType> mine(ref.num_rows), theirs = row_sets(ref);
+    for (size_t i = 0; i < csr.num_rows; i++) {
+        for (size_t k = csr.row_offsets[i]; k < csr.row_offsets[i + 1]; k++) {
+            mine.add(perm[i], perm[csr.col_indices[k]], csr.values[k]);
+        }
+    }
+    return same_rows(mine, theirs);
+}
+
+// read_csr_block and the two-step scan_block_entries + assemble_csr_block
+// give the same blocks of the reference
+template<typename ValueType>
+static bool check_csr_block(const std::string& file, const CSRMatrix<uint32_t,ValueType>& ref,
+                            unsigned threads) {
+    const BlockGrid grid(2, 3);
+    const unsigned num_parts = 3;
+    const LoadOptions options(LoadMode::PARALLEL, threads);
+    std::vector<BlockScan<uint32_t,ValueType>> scans;
+    size_t lines = 0;
+    for (unsigned part = 0; part < num_parts; part++) {
+        scans.push_back(scan_block_entries<uint32_t,ValueType>(file.c_str(), grid, part, num_parts, options));
+        lines += scans.back().lines_parsed;
+    }
+    if (lines != scans[0].num_nonzeros) {
+        return false;
+    }
+    for (unsigned b = 0; b < grid.row_parts * grid.col_parts; b++) {
+        const auto block = read_csr_block<uint32_t,ValueType>(file.c_str(), grid, b, options);
+        std::vector<BlockEntries<uint32_t,ValueType>> received;
+        for (const auto& scan : scans) {
+            received.push_back(scan.blocks[b]);
+        }
+        const auto assembled = assemble_csr_block<uint32_t,ValueType>(ref.num_rows, ref.num_cols, grid, b,
+                                                                       received, options);
+        const auto& local = block.local;
+        if (block.first_row != assembled.first_row || block.first_col != assembled.first_col ||
+            !same_shape(assembled.local, local) || !same_bytes(assembled.local.row_offsets, local.row_offsets) ||
+            !same_segments(local.row_offsets, local.col_indices, local.values, assembled.local.col_indices,
+                           assembled.local.values)) {
+            return false;
+        }
+        RowSets<ValueType> mine(local.num_rows), theirs(local.num_rows);
+        for (size_t i = 0; i < local.num_rows; i++) {
+            for (size_t k = local.row_offsets[i]; k < local.row_offsets[i + 1]; k++) {
+                mine.add(i, local.col_indices[k], local.values[k]);
+            }
+            const size_t row = block.first_row + i;
+            for (size_t k = ref.row_offsets[row]; k < ref.row_offsets[row + 1]; k++) {
+                const uint32_t col = ref.col_indices[k];
+                if (col >= block.first_col && col - block.first_col < local.num_cols) {
+                    theirs.add(i, col - block.first_col, ref.values[k]);
+                }
+            }
+        }
+        if (!same_rows(mine, theirs)) {
+            return false;
+        }
+    }
+    return true;
+}
+
+// EntryReader with the mirrors of symmetric files yields the entries of the
+// reference; it has no form without values
+template<typename ValueType>
+static bool check_entry_reader(const std::string& file, const CSRMatrix<uint32_t,ValueType>& ref,
+                               std::false_type) {
+    RowSets<ValueType> mine(ref.num_rows), theirs = row_sets(ref);
+    for (const auto& entry : EntryReader<uint32_t,ValueType>(file.c_str(), true)) {
+        mine.add(entry.row, entry.col, entry.value);
+    }
+    return same_rows(mine, theirs);
+}
+
+template<typename ValueType>
+static bool check_entry_reader(const std::string&, const CSRMatrix<uint32_t,ValueType>&, std::true_type) {
+    return true;
+}
+
+#ifdef MATRIXMARKET_WITH_ZLIB
+// A gzip copy of the file loads to the reference
+template<typename ValueType>
+static bool check_gzip(const std::string& file, const CSRMatrix<uint32_t,ValueType>& ref, unsigned threads) {
+    const std::string data = read_file(file);
+    const std::string copy = scratch_name(file, ".gz");
+    gzFile gz = gzopen(copy.c_str(), "wb");
+    const unsigned size = static_cast<unsigned>(data.size());
+    const int put = gz != nullptr && size != 0 ? gzwrite(gz, data.data(), size) : 0;
+    if (gz == nullptr || gzclose(gz) != Z_OK || put != static_cast<int>(size)) {
+        throw std::runtime_error("could not write " + copy);
+    }
+    bool ok = true;
+    try {
+        for (LoadMode mode : { LoadMode::STREAM, LoadMode::PARALLEL }) {
+            ok = ok && same_matrix(read_csr<uint32_t,ValueType>(copy.c_str(), LoadOptions(mode, threads)), ref,
+                                   false);
+        }
+    } catch (...) {
+        std::remove(copy.c_str());
+        throw;
+    }
+    std::remove(copy.c_str());
+    return ok;
+}
+#endif
+
+// write_binary reads back and maps to the reference, in both layouts
+template<typename ValueType>
+static bool check_binary(const std::string& file, const CSRMatrix<uint32_t,ValueType>& ref,
+                         const CSCMatrix<uint32_t,ValueType>& ref_csc) {
+    const size_t value_bytes = ValueTraits<ValueType>::bytes;
+    auto same_arrays = [&](const uint32_t* offsets, const uint32_t* indices, const void* values, size_t num_major,
+                           const std::vector<uint32_t>& ref_offsets, const std::vector<uint32_t>& ref_indices,
+                           const void* ref_values) {
+        const size_t nnz = ref_indices.size();
+        return std::memcmp(offsets, ref_offsets.data(), (num_major + 1) * sizeof(uint32_t)) == 0 &&
+               (nnz == 0 || std::memcmp(indices, ref_indices.data(), nnz * sizeof(uint32_t)) == 0) &&
+               (nnz * value_bytes == 0 || std::memcmp(values, ref_values, nnz * value_bytes) == 0);
+    };
+    const std::string csr_copy = scratch_name(file, ".csr.bin");
+    const std::string csc_copy = scratch_name(file, ".csc.bin");
+    write_binary(csr_copy.c_str(), ref);
+    write_binary(csc_copy.c_str(), ref_csc);
+    bool ok = same_matrix(read_binary_csr<uint32_t,ValueType>(csr_copy.c_str()), ref, false) &&
+              same_matrix(read_binary_csc<uint32_t,ValueType>(csc_copy.c_str()), ref_csc, false);
+    {
+        const auto csr = map_binary_csr<uint32_t,ValueType>(csr_copy.c_str());
+        const auto csc = map_binary_csc<uint32_t,ValueType>(csc_copy.c_str());
+        ok = ok && csr.num_rows == ref.num_rows && csr.num_cols == ref.num_cols &&
+             csr.num_nonzeros == ref.num_nonzeros && csr.symmetry == ref.symmetry &&
+             same_arrays(csr.row_offsets, csr.col_indices, csr.values, ref.num_rows, ref.row_offsets,
+                         ref.col_indices, ref.values.data()) &&
+             csc.num_nonzeros == ref_csc.num_nonzeros &&
+             same_arrays(csc.col_offsets, csc.row_indices, csc.values, ref_csc.num_cols, ref_csc.col_offsets,
+                         ref_csc.row_indices, ref_csc.values.data());
+    }
+    std::remove(csr_copy.c_str());
+    std::remove(csc_copy.c_str());
+    return ok;
+}
+
+// Damaged binary files are rejected by read_binary_csr and map_binary_csr,
+// and a damaged sidecar of LoadOptions::cache is rebuilt
+template<typename ValueType>
+static bool check_binary_corrupt(const std::string& file, const CSRMatrix<uint32_t,ValueType>& ref) {
+    const std::string copy = scratch_name(file, ".bin");
+    write_binary(copy.c_str(), ref);
+    const std::string data = read_file(copy);
+    BinaryHeader header;
+    std::memcpy(&header, data.data(), sizeof(header));
+
+    auto patched = [&](size_t pos, uint64_t value, size_t bytes) {
+        std::string bad = data;
+        std::memcpy(&bad[pos], &value, bytes);
+        return bad;
+    };
+    const size_t offsets = static_cast<size_t>(header.array_pos[0]);
+    const size_t last_offset = offsets + static_cast<size_t>(header.array_len[0] - 1) * sizeof(uint32_t);
+    const std::vector<std::string> damaged = {
+        patched(offsetof(BinaryHeader, num_rows), uint64_t(ref.num_rows) + 1, sizeof(uint64_t)),
+        patched(offsetof(BinaryHeader, num_nonzeros), uint64_t(1) << 30, sizeof(uint64_t)),
+        patched(offsetof(BinaryHeader, array_len) + 2 * sizeof(uint64_t), uint64_t(1) << 61, sizeof(uint64_t)),
+        data.substr(0, data.size() - 1),
+        patched(offsets, 1, sizeof(uint32_t)),
+        patched(last_offset, ref.num_nonzeros + 1, sizeof(uint32_t)),
+    };
+    bool ok = true;
+    for (const auto& bad : damaged) {
+        write_file(copy, bad);
+        ok = ok && !rejection([&] { read_binary_csr<uint32_t,ValueType>(copy.c_str()); }).empty() &&
+             !rejection([&] { map_binary_csr<uint32_t,ValueType>(copy.c_str()); }).empty();
+    }
+    std::remove(copy.c_str());
+
+    LoadOptions options(LoadMode::STREAM);
+    options.cache = true;
+    const std::string sidecar = cache_file_name<uint32_t,ValueType>(file.c_str(), options, BinaryLayout::CSR);
+    const bool had_sidecar = file_exists(sidecar);
+    read_csr<uint32_t,ValueType>(file.c_str(), options);
+    if (file_exists(sidecar)) {
+        std::string bad = read_file(sidecar);
+        const uint64_t nnz = uint64_t(1) << 30;
+        std::memcpy(&bad[offsetof(BinaryHeader, num_nonzeros)], &nnz, sizeof(nnz));
+        write_file(sidecar, bad);
+        ok = ok && same_matrix(read_csr<uint32_t,ValueType>(file.c_str(), options), ref, false) &&
+             same_matrix(read_binary_csr<uint32_t,ValueType>(sidecar.c_str()), ref, false);
+    } else {
+        ok = false;
+    }
+    if (!had_sidecar) {
+        std::remove(sidecar.c_str());
+    }
+    return ok;
+}
+
+// Runs the checks of the other engines on a file the reference loads.
+// Returns the number of mismatches.
+template<typename ValueType>
+static int verify_engines(const std::string& file, const CSRMatrix<uint32_t,ValueType>& ref,
+                          const CSCMatrix<uint32_t,ValueType>& ref_csc, const std::string& configs,
+                          unsigned threads) {
+    int mismatches = 0;
+    mismatches += run_check(file, "write-mtx", configs, [&] { return check_write_mtx(file, ref); });
+    mismatches += run_check(file, "bsr", configs, [&] { return check_bsr(file, ref, threads); });
+    mismatches += run_check(file, "sell", configs, [&] { return check_sell(file, ref, threads); });
+    mismatches += run_check(file, "packed-csr", configs, [&] { return check_packed_csr(file, ref, threads); });
+    if (ref.num_rows == ref.num_cols) {
+        mismatches += run_check(file, "reordered-rcm", configs, [&] {
+            return check_reordered(file, ref, threads, Reordering::RCM);
+        });
+        mismatches += run_check(file, "reordered-degree", configs, [&] {
+            return check_reordered(file, ref, threads, Reordering::DEGREE);
+        });
+    }
+    mismatches += run_check(file, "csr-block", configs, [&] { return check_csr_block(file, ref, threads); });
+    if (!std::is_void<ValueType>::value) {
+        mismatches += run_check(file, "entry-reader", configs, [&] {
+            return check_entry_reader(file, ref, std::is_void<ValueType>());
+        });
+    }
+#ifdef MATRIXMARKET_WITH_ZLIB
+    mismatches += run_check(file, "gzip", configs, [&] { return check_gzip(file, ref, threads); });
+#endif
+    mismatches += run_check(file, "binary", configs, [&] { return check_binary(file, ref, ref_csc); });
+    mismatches += run_check(file, "binary-corrupt", configs, [&] { return check_binary_corrupt(file, ref); });
+    return mismatches;
+}
+
+// An array file of `kind` with values k / 8, exact in float and double, and
+// the whole matrix it stands for in column-major order
+static std::string write_dense_file(const char* name, const char* kind, size_t rows, size_t cols,
+                                    std::vector<double>& full) {
+    const std::string file = corpus_dir() + "/" + name;
+    FILE* f = std::fopen(file.c_str(), "wb");
+    if (f == nullptr) {
+        fprintf(stderr, "Could not write %s\n", file.c_str());
+        std::exit(1);
+    }
+    const bool symmetric = std::strstr(kind, "symmetric") != nullptr;
+    const bool skew = std::strstr(kind, "skew") != nullptr;
+    const bool integer = std::strstr(kind, "integer") != nullptr;
+    fprintf(f, "%%%%MatrixMarket matrix array %s\n%zu %zu\n", kind, rows, cols);
+    std::mt19937_64 rng(11);
+    full.assign(rows * cols, 0.0);
+    for (size_t j = 0; j < cols; j++) {
+        for (size_t i = symmetric ? j + (skew ? 1 : 0) : 0; i < rows; i++) {
+            const long k = static_cast<long>(rng() % 20001) - 10000;
+            full[j * rows + i] = integer ? k : k / 8.0;
+            if (symmetric) {
+                full[i * rows + j] = skew ? -full[j * rows + i] : full[j * rows + i];
+            }
+            fprintf(f, integer ? "%.0f\n" : "%.17g\n", full[j * rows + i]);
+        }
+    }
+    std::fclose(f);
+    return file;
+}
+
+// read_dense gives the generated matrix in every mode and layout. Returns the
+// number of mismatches.
+template<typename ValueType>
+static int verify_dense(const std::string& configs, unsigned threads, std::false_type) {
+    struct DenseFile {
+        const char* name;
+        const char* kind;
+        size_t rows;
+        size_t cols;
+    };
+    static const DenseFile dense_files[] = {
+        {"dense-general.mtx", "real general", 300, 200},
+        {"dense-integer.mtx", "integer general", 150, 400},
+        {"dense-symmetric.mtx", "real symmetric", 250, 250},
+        {"dense-skew.mtx", "real skew-symmetric", 250, 250},
+    };
+    int mismatches = 0;
+    for (const auto& dense : dense_files) {
+        std::vector<double> full;
+        const std::string file = write_dense_file(dense.name, dense.kind, dense.rows, dense.cols, full);
+        for (LoadMode mode : { LoadMode::STREAM, LoadMode::MMAP, LoadMode::PARALLEL }) {
+            for (DenseLayout layout : { DenseLayout::COL_MAJOR, DenseLayout::ROW_MAJOR }) {
+                const std::string name = std::string("dense-") +
+                                         (mode == LoadMode::STREAM ? "stream" :
+                                          mode == LoadMode::MMAP ? "mmap" : "parallel") +
+                                         (layout == DenseLayout::COL_MAJOR ? "-col" : "-row");
+                mismatches += run_check(file, name.c_str(), configs, [&] {
+                    const auto m = read_dense<ValueType>(file.c_str(), LoadOptions(mode, threads), layout);
+                    if (m.num_rows != dense.rows || m.num_cols != dense.cols || m.layout != layout ||
+                        m.values.size() != full.size()) {
+                        return false;
+                    }
+                    for (size_t i = 0; i < dense.rows; i++) {
+                        for (size_t j = 0; j < dense.cols; j++) {
+                            const size_t k = layout == DenseLayout::COL_MAJOR ? j * dense.rows + i
+                                                                              : i * dense.cols + j;
+                            if (m.values[k] != static_cast<ValueType>(full[j * dense.rows + i])) {
+                                return false;
+                            }
+                        }
+                    }
+                    return true;
+                });
+            }
+        }
+    }
+    return mismatches;
+}
+
+template<typename ValueType>
+static int verify_dense(const std::string&, unsigned, std::true_type) {
+    return 0;
+}
+
+// Checks every selected config against the STREAM reference on `file`.
+// Returns the number of mismatches.
+template<typename ValueType>
+static int verify_file(const std::string& file, const std::string& configs, unsigned threads) {
+    typedef CSRMatrix<uint32_t,ValueType> CSR;
+    typedef CSCMatrix<uint32_t,ValueType> CSC;
+    LoadOptions reference_options(LoadMode::STREAM);
+    reference_options.detect_sorted = false;
+    CSR ref_csr;
+    CSC ref_csc;
+    try {
+        ref_csr = read_csr<uint32_t,ValueType>(file.c_str(), reference_options);
+        ref_csc = read_csc<uint32_t,ValueType>(file.c_str(), reference_options);
+    } catch (const std::exception& e) {
+        fprintf(stderr, "%s [reference]: %s\n", file.c_str(), e.what());
+        print_check(file, "reference", false, 0, 0);
+        return 1;
+    }
+
+    const size_t bytes = file_size(file);
+    int mismatches = 0;
+    for (const auto& config : all_configs) {
+        if (!selected(configs, config.name)) {
+            continue;
+        }
+        LoadStats stats;
+        LoadOptions options = config_options(config, threads);
+        options.stats = &stats;
+        const std::string sidecar = cache_file_name<uint32_t,ValueType>(file.c_str(), options, BinaryLayout::CSR);
+        const bool had_sidecar = file_exists(sidecar);
+
+        bool ok = true;
+        // A cached config is checked on the load that writes the sidecar and
+        // on the one that reads it back
+        for (int pass = 0; pass < (config.cache ? 2 : 1) && ok; pass++) {
+            try {
+                if (std::strcmp(config.reader, "csc") == 0) {
+                    ok = same_matrix(read_csc<uint32_t,ValueType>(file.c_str(), options), ref_csc,
+                                     config.low_memory);
+                } else if (std::strcmp(config.reader, "csr_csc") == 0) {
+                    const auto both = read_csr_csc<uint32_t,ValueType>(file.c_str(), options);
+                    ok = same_matrix(both.first, ref_csr, config.low_memory) &&
+                         same_matrix(both.second, ref_csc, config.low_memory);
+                } else {
+                    ok = same_matrix(read_csr<uint32_t,ValueType>(file.c_str(), options), ref_csr,
+                                     config.low_memory);
+                }
+            } catch (const std::exception& e) {
+                fprintf(stderr, "%s [%s]: %s\n", file.c_str(), config.name, e.what());
+                ok = false;
+            }
+        }
+        if (config.cache && !had_sidecar) {
+            std::remove(sidecar.c_str());
+        }
+        print_check(file, config.name, ok, stats.total_seconds, bytes);
+        mismatches += ok ? 0 : 1;
+    }
+
+    if (selected(configs, "csr-memory")) {
+        // The whole file as an in-memory buffer, parsed in parallel
+        LoadStats stats;
+        LoadOptions options(LoadMode::PARALLEL, threads);
+        options.stats = &stats;
+        bool ok;
+        try {
+            const std::string data = read_file(file);
+            ok = same_matrix(read_csr<uint32_t,ValueType>(data.data(), data.size(), options), ref_csr, false);
+        } catch (const std::exception& e) {
+            fprintf(stderr, "%s [csr-memory]: %s\n", file.c_str(), e.what());
+            ok = false;
+        }
+        print_check(file, "csr-memory", ok, stats.total_seconds, bytes);
+        mismatches += ok ? 0 : 1;
+    }
+    return mismatches + verify_engines(file, ref_csr, ref_csc, configs, threads);
+}
+
+// Checks that every selected config rejects `file` with the message of the
+// STREAM reference. Returns the number of mismatches.
+template<typename ValueType>
+static int verify_rejected(const std::string& file, const std::string& configs, unsigned threads) {
+    LoadOptions reference_options(LoadMode::STREAM);
+    reference_options.detect_sorted = false;
+    const std::string expected = rejection([&] { read_csr<uint32_t,ValueType>(file.c_str(), reference_options); });
+    if (expected.empty()) {
+        fprintf(stderr, "%s [reference]: accepted\n", file.c_str());
+    }
+
+    const size_t bytes = file_size(file);
+    auto check = [&](const char* name, const std::string& message, const LoadStats& stats) {
+        const bool ok = !expected.empty() && message == expected;
+        if (!ok) {
+            fprintf(stderr, "%s [%s]: %s, expected %s\n", file.c_str(), name,
+                    message.empty() ? "accepted" : message.c_str(),
+                    expected.empty() ? "a rejection" : expected.c_str());
+        }
+        print_check(file, name, ok, stats.total_seconds, bytes);
+        return ok ? 0 : 1;
+    };
+
+    int mismatches = 0;
+    for (const auto& config : all_configs) {
+        if (!selected(configs, config.name)) {
+            continue;
+        }
+        LoadStats stats;
+        LoadOptions options = config_options(config, threads);
+        options.stats = &stats;
+        const std::string sidecar = cache_file_name<uint32_t,ValueType>(file.c_str(), options, BinaryLayout::CSR);
+        const bool had_sidecar = file_exists(sidecar);
+        const std::string message = rejection([&] { load_once<ValueType>(file.c_str(), config, options); });
+        if (config.cache && !had_sidecar) {
+            std::remove(sidecar.c_str());
+        }
+        mismatches += check(config.name, message, stats);
+    }
+    if (selected(configs, "csr-memory")) {
+        LoadStats stats;
+        LoadOptions options(LoadMode::PARALLEL, threads);
+        options.stats = &stats;
+        const std::string data = read_file(file);
+        const std::string message = rejection([&] {
+            read_csr<uint32_t,ValueType>(data.data(), data.size(), options);
+        });
+        mismatches += check("csr-memory", message, stats);
+    }
+    return mismatches;
+}
+
+template<typename ValueType>
+static int verify(std::vector<std::string> files, const std::string& configs, unsigned threads) {
+    const std::vector<std::string> corpus = write_corpus();
+    const std::vector<std::string> bad_corpus = write_bad_corpus();
+    files.insert(files.begin(), corpus.begin(), corpus.end());
+    printf("%-46s %-17s %-8s %10s %9s\n", "file", "config", "result", "seconds", "MB/s");
+    int mismatches = 0;
+    for (const auto& file : files) {
+        mismatches += verify_file<ValueType>(file, configs, threads);
+    }
+    for (const auto& file : bad_corpus) {
+        mismatches += verify_rejected<ValueType>(file, configs, threads);
+    }
+    mismatches += verify_dense<ValueType>(configs, threads, std::is_void<ValueType>());
+    printf("%zu files, %zu malformed files, %d mismatches\n", files.size(), bad_corpus.size(), mismatches);
+    return mismatches == 0 ? 0 : 1;
+}
+
+static void write_csv(const char* filename, const std::vector<Result>& results) {
+    FILE* f = std::fopen(filename, "w");
+    if (f == nullptr) {
+        fprintf(stderr, "Could not write %s\n", filename);
+        return;
+    }
+    fprintf(f, "file,config,bytes,nnz,repeats,min_s,median_s,header_s,parse_s,convert_s,assemble_s,"
+               "mb_per_s,nnz_per_s,peak_bytes\n");
+    for (const auto& r : results) {
+        fprintf(f, "%s,%s,%zu,%zu,%d,%.6f,%.6f,%.6f,%.6f,%.6f,%.6f,%.2f,%.0f,%zu\n",
+                r.file.c_str(), r.config.c_str(), r.bytes, r.nnz, r.repeats,
+                r.min_seconds, r.median_seconds, r.header_seconds, r.parse_seconds,
+                r.convert_seconds, r.assemble_seconds,
+                r.bytes / 1e6 / r.median_seconds, r.nnz / r.median_seconds, r.peak_bytes);
+    }
+    std::fclose(f);
+}
+
+static void write_json(const char* filename, const std::vector<Result>& results) {
+    FILE* f = std::fopen(filename, "w");
+    if (f == nullptr) {
+        fprintf(stderr, "Could not write %s\n", filename);
+        return;
+    }
+    fprintf(f, "[\n");
+    for (size_t i = 0; i < results.size(); i++) {
+        const auto& r = results[i];
+        fprintf(f, "  {\"file\": \"%s\", \"config\": \"%s\", \"bytes\": %zu, \"nnz\": %zu, \"repeats\": %d, "
+                   "\"min_s\": %.6f, \"median_s\": %.6f, \"header_s\": %.6f, \"parse_s\": %.6f, "
+                   "\"convert_s\": %.6f, \"assemble_s\": %.6f, \"mb_per_s\": %.2f, \"nnz_per_s\": %.0f, "
+                   "\"peak_bytes\": %zu}%s\n",
+                r.file.c_str(), r.config.c_str(), r.bytes, r.nnz, r.repeats,
+                r.min_seconds, r.median_seconds, r.header_seconds, r.parse_seconds,
+                r.convert_seconds, r.assemble_seconds,
+                r.bytes / 1e6 / r.median_seconds, r.nnz / r.median_seconds, r.peak_bytes,
+                i + 1 < results.size() ? "," : "");
+    }
+    fprintf(f, "]\n");
+    std::fclose(f);
+}
+
+int main(int argc, char* argv[]) {
+    int repeats = 5;
+    int warmup = 1;
+    unsigned threads = 0;
+    bool use_float = false;
+    bool no_values = false;
+    bool verify_mode = false;
+    std::string configs;
+    const char* csv = nullptr;
+    const char* json = nullptr;
+    std::vector<std::string> files;
+
+    for (int i = 1; i < argc; i++) {
+        const std::string arg = argv[i];
+        const bool has_value = i + 1 < argc;
+        if (arg == "--repeats" && has_value) {
+            repeats = std::max(1, std::atoi(argv[++i]));
+        } else if (arg == "--warmup" && has_value) {
+            warmup = std::max(0, std::atoi(argv[++i]));
+        } else if (arg == "--threads" && has_value) {
+            threads = static_cast<unsigned>(std::atoi(argv[++i]));
+        } else if (arg == "--float") {
+            use_float = true;
+        } else if (arg == "--no-values") {
+            no_values = true;
+        } else if (arg == "--configs" && has_value) {
+            configs = argv[++i];
+        } else if (arg == "--csv" && has_value) {
+            csv = argv[++i];
+        } else if (arg == "--json" && has_value) {
+            json = argv[++i];
+        } else if (arg == "--synthetic" && has_value) {
+            files.push_back(write_synthetic(argv[++i]));
+        } else if (arg == "--verify") {
+            verify_mode = true;
+        } else if (!arg.empty() && arg[0] == '-') {
+            fprintf(stderr, "Usage: %s [--repeats N] [--warmup N] [--threads N] [--float | --no-values]\n"
+                            "          [--configs name,...] [--csv FILE] [--json FILE]\n"
+                            "          [--synthetic ROWSxNNZ]... [--verify] [file.mtx ...]\n"
+                            "Configs:", argv[0]);
+            for (const auto& config : all_configs) {
+                fprintf(stderr, " %s", config.name);
+            }
+            fprintf(stderr, "\n  and with --verify: csr-memory write-mtx bsr sell packed-csr reordered-rcm\n"
+                            "  reordered-degree csr-block entry-reader gzip binary binary-corrupt dense-MODE-col\n"
+                            "  dense-MODE-row (MODE: stream, mmap or parallel)\n");
+            return 1;
+        } else {
+            files.push_back(arg);
+        }
+    }
+    if (verify_mode) {
+        if (no_values) {
+            return verify<void>(files, configs, threads);
+        } else if (use_float) {
+            return verify<float>(files, configs, threads);
+        }
+        return verify<double>(files, configs, threads);
+    }
+    if (files.empty()) {
+        files.push_back(write_synthetic("1000000x10000000"));
+    }
+
+    printf("%-40s %-17s %10s %10s %8s %8s %8s %8s %9s %10s %9s\n",
+           "file", "config", "min_s", "median_s", "header", "parse", "convert", "assemble",
+           "MB/s", "Mnnz/s", "peak_MB");
+
+    std::vector<Result> results;
+    for (const auto& file : files) {
+        for (const auto& config : all_configs) {
+            if (!selected(configs, config.name)) {
+                continue;
+            }
+            Result r;
+            try {
+                if (no_values) {
+                    r = run<void>(file, config, repeats, warmup, threads);
+                } else if (use_float) {
+                    r = run<float>(file, config, repeats, warmup, threads);
+                } else {
+                    r = run<double>(file, config, repeats, warmup, threads);
+                }
+            } catch (const std::exception& e) {
+                fprintf(stderr, "%s [%s]: %s\n", file.c_str(), config.name, e.what());
+                continue;
+            }
+            printf("%-40s %-17s %10.4f %10.4f %8.4f %8.4f %8.4f %8.4f %9.1f %10.2f %9.1f\n",
+                   r.file.c_str(), r.config.c_str(), r.min_seconds, r.median_seconds,
+                   r.header_seconds, r.parse_seconds, r.convert_seconds, r.assemble_seconds,
+                   r.bytes / 1e6 / r.median_seconds, r.nnz / 1e6 / r.median_seconds,
+                   r.peak_bytes / 1e6);
+            results.push_back(r);
+        }
+    }
+
+    if (csv != nullptr) {
+        write_csv(csv, results);
+    }
+    if (json != nullptr) {
+        write_json(json, results);
+    }
+    return 0;
+}
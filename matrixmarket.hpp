@@ -3,6 +3,10 @@
 #include <utility>
 #include <string>
 #include <cstdio>
+#include <cstdlib>
+#include <cstdint>
+#include <cstring>
+#include <cctype>
 #include <cassert>
 #include <vector>
 #include <tuple>
@@ -10,368 +14,6572 @@
 #include <sstream>
 #include <deque>
 #include <algorithm>
+#include <limits>
+#include <stdexcept>
+#include <type_traits>
+#include <cmath>
+#include <complex>
+#if __cplusplus >= 201703L
+#include <charconv>
+#endif
+#include <thread>
+#include <atomic>
+#include <exception>
+#include <memory>
+#include <iterator>
+#include <mutex>
+#include <condition_variable>
+#include <future>
+#include <chrono>
+#include <functional>
+#include <new>
+
+#include <fcntl.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <unistd.h>
+#ifdef __linux__
+#include <sched.h>
+#endif
+
+#ifdef MATRIXMARKET_WITH_ZLIB
+#include <zlib.h>
+#endif
+#ifdef MATRIXMARKET_WITH_ZSTD
+#include <zstd.h>
+#endif
+#ifdef MATRIXMARKET_WITH_LZMA
+#include <lzma.h>
+#endif
+
+// Vectorized scanning, unless disabled with MATRIXMARKET_NO_SIMD. x86-64
+// builds pick AVX-512BW or AVX2 at runtime, so they don't need -mavx2.
+#if !defined(MATRIXMARKET_NO_SIMD) && defined(__x86_64__) && defined(__GNUC__)
+#define MATRIXMARKET_SIMD_X86
+#include <immintrin.h>
+#elif !defined(MATRIXMARKET_NO_SIMD) && defined(__aarch64__) && defined(__ARM_NEON)
+#define MATRIXMARKET_SIMD_NEON
+#include <arm_neon.h>
+#endif
+#if defined(__BYTE_ORDER__) && __BYTE_ORDER__ == __ORDER_LITTLE_ENDIAN__
+#define MATRIXMARKET_SWAR
+#endif
 
 namespace MatrixMarket {
 
 ///////////////////////////////////////////////////////////////////////////////
-// Public API
+// Public API
+///////////////////////////////////////////////////////////////////////////////
+
+// For SKEW_SYMMETRIC matrices the mirrored entries are negated, for
+// HERMITIAN ones conjugated. COMPLEX values need a std::complex ValueType.
+enum class SymmetryType { GENERAL, SYMMETRIC, SKEW_SYMMETRIC, HERMITIAN };
+enum class ValueFormat { REAL, INTEGER, PATTERN, COMPLEX };
+
+// How the entry section of the file is read.
+//   STREAM:   std::ifstream + std::getline, one line at a time (the original path)
+//   MMAP:     the file is mapped into memory and parsed in place, no per-line
+//             allocation
+//   PARALLEL: like MMAP, but the entry section is split at line boundaries
+//             and the chunks are parsed concurrently
+enum class LoadMode { STREAM, MMAP, PARALLEL };
+
+// Phases of a load, as timed in LoadStats and reported to LoadOptions::on_phase
+enum class LoadPhase { HEADER, PARSE, CONVERT, ASSEMBLE, TOTAL };
+
+// What read_csr and read_csc do with entries that have the same coordinates
+// as an earlier one (after symmetric expansion):
+//   KEEP:  keep every one as a separate entry
+//   SUM:   add their values into a single entry
+//   LAST:  keep the one that comes last in the file
+//   ERROR: throw std::invalid_argument
+enum class DuplicatePolicy { KEEP, SUM, LAST, ERROR };
+
+// How read_csr and read_csc hold symmetric, skew-symmetric and hermitian
+// matrices:
+//   EXPAND: every off-diagonal entry is mirrored, giving a general matrix
+//   LOWER:  only the lower triangle (row >= col) is kept
+//   UPPER:  only the upper triangle (row <= col) is kept
+// Entries that the file lists in the other triangle are mirrored into the
+// kept one. General matrices are always read whole.
+enum class SymmetricStorage { EXPAND, LOWER, UPPER };
+
+// How read_csr, read_csc and the readers built on them check entry lines:
+//   STRICT:   each line is checked as it is parsed; the first bad one throws
+//             std::invalid_argument
+//   DEFERRED: the parse loop leaves the indices unchecked, and a separate
+//             pass over the parsed arrays, which the compiler can vectorize,
+//             bounds-checks them all and throws for the first bad one.
+//             Ill-shaped lines still throw as they are met.
+//   COLLECT:  bad lines are skipped and recorded in LoadOptions::errors,
+//             and the matrix is built from the others
+// Header errors and a file that ends before the declared nonzero count
+// throw in every mode. LoadMode::STREAM treats DEFERRED as STRICT.
+enum class ValidationMode { STRICT, DEFERRED, COLLECT };
+
+enum class EntryErrorCode { ILL_SHAPED_LINE, ROW_OUT_OF_BOUNDS, COL_OUT_OF_BOUNDS };
+
+// Symmetric renumberings of the rows and columns of a square matrix that
+// read_csr, read_csc and the readers built on them apply while loading,
+// computed from the structure of A + A^T:
+//   NONE:   the file order
+//   RCM:    reverse Cuthill-McKee, started from a pseudo-peripheral node of
+//           each connected component; reduces the bandwidth
+//   DEGREE: ascending number of neighbours
+enum class Reordering { NONE, RCM, DEGREE };
+
+// A bad entry line found under ValidationMode::COLLECT. `line` is 1-based
+// and counts the header lines; it is 0 where it isn't known (the parts of
+// scan_block_entries). `byte_offset` is from the start of the file, or of
+// the decompressed text of compressed input.
+struct EntryError {
+    EntryErrorCode code;
+    uint64_t line;
+    uint64_t byte_offset;
+};
+
+// Filled in by the readers when LoadOptions::stats is set
+struct LoadStats {
+    // Most bytes held at once by the reader's COO and output arrays
+    size_t peak_bytes;
+    // Bytes held by the arrays of the returned matrix
+    size_t matrix_bytes;
+    // Bytes of input read: the file size (the compressed size for compressed
+    // files, the sidecar size for cache hits)
+    size_t bytes_read;
+
+    // Entry lines parsed, i.e. the header's nonzero count
+    size_t lines_parsed;
+    // Comment lines skipped in the header
+    size_t comment_lines;
+    // Entries with the same coordinates as an earlier one (after symmetric
+    // expansion), whether kept or merged
+    size_t duplicate_entries;
+    // Mirrored entries added for symmetric matrices
+    size_t symmetric_expansions;
+    // Whether the input was already in order and assembled without a COO
+    // buffer, see LoadOptions::detect_sorted
+    bool sorted_input;
+    // Explicit zeros stored to fill out the blocks of read_bsr or the chunks
+    // of read_sell
+    size_t padding_entries;
+
+    // Wall time of each phase of the load, in seconds:
+    //   header:   opening or mapping the file and parsing the header
+    //   parse:    parsing the entry section into COO (including decompression,
+    //             or reading the binary cache), or for sorted input straight
+    //             into the output arrays
+    //   convert:  the counting sort into compressed segments
+    //   assemble: sorting within segments and finishing the output arrays
+    //             (including the transpose of read_csr_csc)
+    double header_seconds;
+    double parse_seconds;
+    double convert_seconds;
+    double assemble_seconds;
+    double total_seconds;
+
+    LoadStats()
+        : peak_bytes(0), matrix_bytes(0), bytes_read(0), lines_parsed(0), comment_lines(0),
+          duplicate_entries(0), symmetric_expansions(0), sorted_input(false), padding_entries(0),
+          header_seconds(0), parse_seconds(0),
+          convert_seconds(0), assemble_seconds(0), total_seconds(0) {}
+};
+
+struct LoadOptions {
+    LoadMode mode;
+    // Worker threads for LoadMode::PARALLEL, 0 means hardware concurrency
+    unsigned num_threads;
+    // Build the output arrays by permuting the COO buffer in place rather
+    // than scattering into new arrays. Keeps peak memory near the COO buffer
+    // size, but duplicate entries within a row end up in unspecified order,
+    // so DuplicatePolicy::LAST ignores it.
+    bool low_memory;
+    // Fill the output arrays in parallel along a static partition of the
+    // rows (CSR) or columns (CSC), thread t writing the entries of part t
+    // while pinned to the t-th CPU the process may run on (the placement of
+    // OMP_PROC_BIND=close). Every page is then first touched, and so placed
+    // on the NUMA node, by the thread that will work on those rows. Needs an
+    // allocator that leaves new elements unwritten, such as
+    // DefaultInitAllocator (see leaves_new_elements_unwritten); with any
+    // other the load throws, as resize() would touch every page on the
+    // calling thread. Disables the binary cache, whose arrays are copied in
+    // on one thread. Takes precedence over low_memory.
+    bool first_touch;
+    // Parse uncompressed files (LoadMode::MMAP or PARALLEL) straight into
+    // the output arrays for as long as the entries arrive in row order for
+    // CSR or column order for CSC, sorted within each row or column. Input
+    // that turns out to be unsorted is parsed again the usual way, so this
+    // costs little unless the order breaks late in the file. Not used for
+    // first_touch or for expanded symmetric matrices.
+    bool detect_sorted;
+    // Part boundaries for first_touch, ascending from 0 to the number of rows
+    // (CSR) or columns (CSC). Empty means num_threads parts of equal size,
+    // like an OpenMP static schedule.
+    std::vector<size_t> first_touch_partition;
+    // Applied while the segments are sorted, in parallel for
+    // LoadMode::PARALLEL
+    DuplicatePolicy duplicates;
+    SymmetricStorage symmetric_storage;
+    // 0 for 0-based output, 1 for 1-based (Fortran) offsets and indices
+    unsigned index_base;
+    // Optional out-parameter for load statistics
+    LoadStats* stats;
+    ValidationMode validation;
+    // Optional out-parameter for the bad lines skipped under
+    // ValidationMode::COLLECT, in file order
+    std::vector<EntryError>* errors;
+    // Renumber a square matrix while loading; other shapes throw once the
+    // header is read. The entries are relabelled before they are compressed,
+    // so the output is assembled in the new order directly, and a kept
+    // triangle is the one of the reordered matrix. The sorted input fast
+    // path and the cache are not used, nor can the readers that load part
+    // of a file reorder.
+    Reordering reordering;
+    // Optional out-parameter for reordering: (*permutation)[i] is the file
+    // row (and column) that became row i, following index_base like the
+    // matrix
+    std::vector<uint64_t>* permutation;
+    // Keep a binary copy of the result next to the file and load from it
+    // instead when it is newer than the file. See cache_file_name for its
+    // name, which tells apart the options and template types that change the
+    // result. Not used with ValidationMode::COLLECT, whose errors the
+    // cache wouldn't repeat, or with a reordering.
+    bool cache;
+    // Optional observer, called on the loading thread whenever a phase ends
+    // with its wall time in seconds (a phase may be reported in several
+    // pieces that add up to the LoadStats time). TOTAL comes last. Must not
+    // throw.
+    std::function<void(LoadPhase phase, double seconds)> on_phase;
+
+    LoadOptions(LoadMode mode = LoadMode::STREAM, unsigned num_threads = 0)
+        : mode(mode), num_threads(num_threads), low_memory(false), first_touch(false), detect_sorted(true),
+          duplicates(DuplicatePolicy::KEEP), symmetric_storage(SymmetricStorage::EXPAND),
+          index_base(0), stats(nullptr), validation(ValidationMode::STRICT), errors(nullptr),
+          reordering(Reordering::NONE), permutation(nullptr), cache(false) {}
+};
+
+// Pattern matrices can be read with ValueType = void, which stores no values
+// at all: `values` is then a NoValues, an always-empty stand-in for the
+// std::vector that allocates nothing. Values in the file are still checked
+// for syntax and then dropped, so this also reads just the structure of a
+// real or integer matrix.
+struct NoValue {};
+
+class NoValues {
+public:
+    typedef NoValue value_type;
+
+    NoValues() {}
+    template<typename Allocator>
+    explicit NoValues(const Allocator&) {}
+
+    size_t size() const { return 0; }
+    size_t capacity() const { return 0; }
+    size_t max_size() const { return std::numeric_limits<size_t>::max(); }
+    bool empty() const { return true; }
+    void resize(size_t) {}
+    const NoValue* data() const { return nullptr; }
+    NoValue& operator[](size_t) { return dummy; }
+    const NoValue& operator[](size_t) const { return dummy; }
+private:
+    NoValue dummy;
+};
+
+// A std::vector of T taking its memory from Allocator, rebound to T
+template<typename Allocator, typename T>
+using rebind_vector = std::vector<T, typename std::allocator_traits<Allocator>::template rebind_alloc<T>>;
+
+// How values of ValueType are held per entry and per matrix
+template<typename ValueType>
+struct ValueTraits {
+    typedef ValueType value_type;
+    typedef std::vector<ValueType> array_type;
+    template<typename Allocator>
+    using allocated_array = rebind_vector<Allocator, ValueType>;
+    static const size_t bytes = sizeof(ValueType);
+};
+
+template<>
+struct ValueTraits<void> {
+    typedef NoValue value_type;
+    typedef NoValues array_type;
+    template<typename Allocator>
+    using allocated_array = NoValues;
+    static const size_t bytes = 0;
+};
+
+// CoordType holds the dimensions and indices, OffsetType the offsets and the
+// nonzero count, so that matrices with more nonzeros than CoordType can
+// count keep narrow indices.
+// `symmetry` is GENERAL for a matrix held whole. Otherwise only one triangle
+// is held (see SymmetricStorage) and the other one follows from it.
+// `index_base` is 0, or 1 when every offset and index is 1-based
+// (LoadOptions::index_base).
+// The three arrays take their memory from Allocator, rebound to each
+// element type, so that large matrices can be assembled straight into huge
+// pages (see HugePageAllocator), pinned or NUMA-local memory or an arena.
+// The readers take an instance for allocators that carry state.
+template<typename CoordType, typename ValueType, typename OffsetType = CoordType,
+         typename Allocator = std::allocator<CoordType>>
+struct CSRMatrix {
+    CoordType num_rows;
+    CoordType num_cols;
+    OffsetType num_nonzeros;
+    SymmetryType symmetry;
+    unsigned index_base;
+    rebind_vector<Allocator, OffsetType> row_offsets;
+    rebind_vector<Allocator, CoordType> col_indices;
+    typename ValueTraits<ValueType>::template allocated_array<Allocator> values;
+};
+
+template<typename CoordType, typename ValueType, typename OffsetType = CoordType,
+         typename Allocator = std::allocator<CoordType>>
+CSRMatrix<CoordType,ValueType,OffsetType,Allocator> read_csr(const char* filename,
+                                                             const LoadOptions& options = LoadOptions(),
+                                                             const Allocator& allocator = Allocator());
+
+template<typename CoordType, typename ValueType, typename OffsetType = CoordType,
+         typename Allocator = std::allocator<CoordType>>
+struct CSCMatrix {
+    CoordType num_rows;
+    CoordType num_cols;
+    OffsetType num_nonzeros;
+    SymmetryType symmetry;
+    unsigned index_base;
+    rebind_vector<Allocator, OffsetType> col_offsets;
+    rebind_vector<Allocator, CoordType> row_indices;
+    typename ValueTraits<ValueType>::template allocated_array<Allocator> values;
+};
+
+template<typename CoordType, typename ValueType, typename OffsetType = CoordType,
+         typename Allocator = std::allocator<CoordType>>
+CSCMatrix<CoordType,ValueType,OffsetType,Allocator> read_csc(const char* filename,
+                                                             const LoadOptions& options = LoadOptions(),
+                                                             const Allocator& allocator = Allocator());
+
+// Parses the file once and returns both orientations. The CSC is computed
+// from the finished CSR by a linear-time transpose.
+template<typename CoordType, typename ValueType, typename OffsetType = CoordType,
+         typename Allocator = std::allocator<CoordType>>
+std::pair<CSRMatrix<CoordType,ValueType,OffsetType,Allocator>, CSCMatrix<CoordType,ValueType,OffsetType,Allocator>>
+read_csr_csc(const char* filename, const LoadOptions& options = LoadOptions(),
+             const Allocator& allocator = Allocator());
+
+// A pull-based stream of bytes, for reading a matrix that isn't in a file
+class InputSource {
+public:
+    virtual ~InputSource() {}
+    // Writes up to `capacity` bytes to `out` and returns how many were
+    // written; 0 means the end of the stream
+    virtual size_t read(char* out, size_t capacity) = 0;
+};
+
+// The readers also take the contents of a file from memory, e.g. straight
+// from a network buffer, or from an InputSource:
+// - The `size` bytes at `data` are parsed in place like a mapped file, in
+//   parallel for LoadMode::PARALLEL and sequentially otherwise. They may be
+//   compressed, as files may.
+// - An InputSource must yield the uncompressed text. It is read on a
+//   background thread and parsed block by block as the data arrives.
+// LoadOptions::cache applies to files only.
+template<typename CoordType, typename ValueType, typename OffsetType = CoordType,
+         typename Allocator = std::allocator<CoordType>>
+CSRMatrix<CoordType,ValueType,OffsetType,Allocator>
+read_csr(const char* data, size_t size, const LoadOptions& options = LoadOptions(),
+         const Allocator& allocator = Allocator());
+
+template<typename CoordType, typename ValueType, typename OffsetType = CoordType,
+         typename Allocator = std::allocator<CoordType>>
+CSRMatrix<CoordType,ValueType,OffsetType,Allocator>
+read_csr(InputSource& source, const LoadOptions& options = LoadOptions(), const Allocator& allocator = Allocator());
+
+template<typename CoordType, typename ValueType, typename OffsetType = CoordType,
+         typename Allocator = std::allocator<CoordType>>
+CSCMatrix<CoordType,ValueType,OffsetType,Allocator>
+read_csc(const char* data, size_t size, const LoadOptions& options = LoadOptions(),
+         const Allocator& allocator = Allocator());
+
+template<typename CoordType, typename ValueType, typename OffsetType = CoordType,
+         typename Allocator = std::allocator<CoordType>>
+CSCMatrix<CoordType,ValueType,OffsetType,Allocator>
+read_csc(InputSource& source, const LoadOptions& options = LoadOptions(), const Allocator& allocator = Allocator());
+
+template<typename CoordType, typename ValueType, typename OffsetType = CoordType,
+         typename Allocator = std::allocator<CoordType>>
+std::pair<CSRMatrix<CoordType,ValueType,OffsetType,Allocator>, CSCMatrix<CoordType,ValueType,OffsetType,Allocator>>
+read_csr_csc(const char* data, size_t size, const LoadOptions& options = LoadOptions(),
+             const Allocator& allocator = Allocator());
+
+template<typename CoordType, typename ValueType, typename OffsetType = CoordType,
+         typename Allocator = std::allocator<CoordType>>
+std::pair<CSRMatrix<CoordType,ValueType,OffsetType,Allocator>, CSCMatrix<CoordType,ValueType,OffsetType,Allocator>>
+read_csr_csc(InputSource& source, const LoadOptions& options = LoadOptions(),
+             const Allocator& allocator = Allocator());
+
+// What the header of a file says, for planning loads without parsing them
+struct MatrixInfo {
+    SymmetryType symmetry;
+    ValueFormat value_format;
+    // An "array" file rather than a "coordinate" one
+    bool dense;
+    uint64_t num_rows;
+    uint64_t num_cols;
+    // Entry lines, or for array files the values listed
+    uint64_t num_nonzeros;
+    size_t num_comment_lines;
+    // Size on disk, and whether that is gzip, zstd or xz compressed
+    uint64_t file_bytes;
+    bool compressed;
+};
+
+// Reads only the header: the first 4 KB of the file (decompressed, for
+// compressed files), and more only while the comment lines go on
+MatrixInfo peek_header(const char* filename);
+
+// Estimates from a sample of the entry lines of a coordinate file
+struct MatrixEstimate {
+    MatrixInfo info;
+    size_t sampled_lines;
+    // Entries after symmetric expansion (SymmetricStorage::EXPAND), from the
+    // sample's share of diagonal entries
+    uint64_t expanded_nonzeros;
+    // Rows of the expanded matrix by number of entries: row_lengths[0] rows
+    // are empty and row_lengths[k] hold 2^(k-1) to 2^k - 1 entries. Duplicates
+    // count as entries. From a sample, a row seen k times counts as k times
+    // num_nonzeros / sampled_lines long, so shorter rows aren't told apart.
+    std::vector<uint64_t> row_lengths;
+    uint64_t max_row_length;
+};
+
+// Samples about `sample_lines` entry lines at random positions of the file,
+// or reads them all (exact figures) if there are no more or sample_lines is
+// 0. Compressed files can't be sought, so their first lines are the sample,
+// which is biased for files in row order. Cheap next to a load: the sampled
+// pages are all that is read, and only the indices are parsed.
+MatrixEstimate estimate_stats(const char* filename, size_t sample_lines = 16384);
+
+// Block compressed sparse row (BSR): the matrix is cut into block_rows x
+// block_cols blocks and those holding a nonzero are stored whole, row by row
+// within the block, with explicit zeros for the entries the file doesn't
+// list. Block row i holds blocks row_offsets[i] to row_offsets[i + 1] in
+// ascending block column col_indices[k], the values of block k starting at
+// values[k * block_rows * block_cols]. Blocks at the bottom and right edges
+// are padded out past the matrix. Duplicates are added up. The offsets and
+// block column indices follow `index_base`.
+template<typename CoordType, typename ValueType, typename OffsetType = CoordType,
+         typename Allocator = std::allocator<CoordType>>
+struct BSRMatrix {
+    CoordType num_rows;
+    CoordType num_cols;
+    CoordType block_rows;
+    CoordType block_cols;
+    OffsetType num_blocks;
+    SymmetryType symmetry;
+    unsigned index_base;
+    rebind_vector<Allocator, OffsetType> row_offsets;
+    rebind_vector<Allocator, CoordType> col_indices;
+    typename ValueTraits<ValueType>::template allocated_array<Allocator> values;
+};
+
+// SELL-C-sigma: the rows are sorted by decreasing length within windows of
+// sort_window rows, and then every chunk_size consecutive ones form a chunk
+// that is stored column by column, padded to the length of its longest row.
+// Slot s = c * chunk_size + r holds matrix row permutation[s], and its j-th
+// entry is at chunk_offsets[c] + j * chunk_size + r. Padding has column
+// index 0 (index_base for 1-based output) and value zero, and the slots past
+// num_rows in the last chunk are padding throughout. Within a row the
+// entries are in column order. The offsets, permutation and column indices
+// follow `index_base`.
+template<typename CoordType, typename ValueType, typename OffsetType = CoordType,
+         typename Allocator = std::allocator<CoordType>>
+struct SELLMatrix {
+    CoordType num_rows;
+    CoordType num_cols;
+    OffsetType num_nonzeros;
+    CoordType chunk_size;
+    CoordType sort_window;
+    SymmetryType symmetry;
+    unsigned index_base;
+    rebind_vector<Allocator, OffsetType> chunk_offsets;
+    rebind_vector<Allocator, CoordType> permutation;
+    rebind_vector<Allocator, CoordType> col_indices;
+    typename ValueTraits<ValueType>::template allocated_array<Allocator> values;
+};
+
+// Build BSR or SELL-C-sigma arrays while loading, from the row segments of
+// the conversion engine (so the duplicate policy and symmetric storage apply
+// as for read_csr), without a CSRMatrix in between. LoadStats then counts
+// the padding. sort_window must be 1 (no sorting) or a multiple of
+// chunk_size. LoadOptions::cache is not used.
+template<typename CoordType, typename ValueType, typename OffsetType = CoordType,
+         typename Allocator = std::allocator<CoordType>>
+BSRMatrix<CoordType,ValueType,OffsetType,Allocator>
+read_bsr(const char* filename, CoordType block_rows, CoordType block_cols,
+         const LoadOptions& options = LoadOptions(), const Allocator& allocator = Allocator());
+
+template<typename CoordType, typename ValueType, typename OffsetType = CoordType,
+         typename Allocator = std::allocator<CoordType>>
+SELLMatrix<CoordType,ValueType,OffsetType,Allocator>
+read_sell(const char* filename, CoordType chunk_size, CoordType sort_window,
+          const LoadOptions& options = LoadOptions(), const Allocator& allocator = Allocator());
+
+// Bytes after the last group of a PackedCSRMatrix, so that the decoder can
+// read whole words
+const size_t packed_padding = 16;
+
+// The little-endian gap of 1, 2, 4 or 8 bytes (length code 0 to 3) at `p`
+inline uint64_t load_packed_gap(const unsigned char* p, unsigned code) {
+#ifdef MATRIXMARKET_SWAR
+    static const uint64_t masks[4] = { 0xff, 0xffff, 0xffffffff, ~uint64_t(0) };
+    uint64_t word;
+    std::memcpy(&word, p, sizeof(word));
+    return word & masks[code];
+#else
+    uint64_t word = 0;
+    for (unsigned k = 1u << code; k-- > 0;) {
+        word = (word << 8) | p[k];
+    }
+    return word;
+#endif
+}
+
+// The column indices of one row of a PackedCSRMatrix, decoded on the fly
+// one group of four at a time
+template<typename CoordType>
+class PackedRow {
+public:
+    class iterator {
+    public:
+        typedef std::input_iterator_tag iterator_category;
+        typedef CoordType value_type;
+        typedef std::ptrdiff_t difference_type;
+        typedef const CoordType* pointer;
+        typedef CoordType reference;
+
+        iterator() : data_(nullptr), remaining_(0), lane_(4), column_(0) {}
+        iterator(const unsigned char* data, size_t count, CoordType index_base)
+            : data_(data), remaining_(count), lane_(4), column_(index_base) {
+            if (remaining_ != 0) {
+                advance();
+            }
+        }
+
+        CoordType operator*() const { return column_; }
+        iterator& operator++() {
+            if (--remaining_ != 0) {
+                advance();
+            }
+            return *this;
+        }
+        iterator operator++(int) {
+            iterator before = *this;
+            ++*this;
+            return before;
+        }
+        // Only iterators over the same row compare meaningfully
+        bool operator==(const iterator& other) const { return remaining_ == other.remaining_; }
+        bool operator!=(const iterator& other) const { return remaining_ != other.remaining_; }
+
+    private:
+        void advance() {
+            if (lane_ == 4) {
+                const unsigned control = *data_++;
+                for (unsigned k = 0; k < 4; k++) {
+                    const unsigned code = (control >> (2 * k)) & 3;
+                    gaps_[k] = load_packed_gap(data_, code);
+                    data_ += 1u << code;
+                }
+                lane_ = 0;
+            }
+            column_ += static_cast<CoordType>(gaps_[lane_++]);
+        }
+
+        const unsigned char* data_;
+        size_t remaining_;
+        unsigned lane_;
+        CoordType column_;
+        uint64_t gaps_[4];
+    };
+
+    PackedRow(const unsigned char* data, size_t count, CoordType index_base)
+        : data_(data), count_(count), index_base_(index_base) {}
+
+    iterator begin() const { return iterator(data_, count_, index_base_); }
+    iterator end() const { return iterator(); }
+    size_t size() const { return count_; }
+
+private:
+    const unsigned char* data_;
+    size_t count_;
+    CoordType index_base_;
+};
+
+// CSR with compressed column indices, for large graphs where col_indices
+// would take most of the memory and bandwidth. The sorted indices of a row
+// are held as the gaps between neighbours (the first index is its own gap)
+// in group varint form: a control byte with the lengths of the next four
+// gaps as 2-bit codes, lowest first, for 1, 2, 4 or 8 bytes, followed by
+// the gaps little-endian. The last group of a row is completed with 1-byte
+// codes that have no bytes. Row i starts at encoded[row_bytes[i]] and its
+// row_offsets[i + 1] - row_offsets[i] values start at values[row_offsets[i]]
+// (less index_base), in the order of row(i). `encoded` ends with
+// packed_padding unused bytes. row(i) yields indices that follow index_base.
+template<typename CoordType, typename ValueType, typename OffsetType = CoordType,
+         typename Allocator = std::allocator<CoordType>>
+struct PackedCSRMatrix {
+    CoordType num_rows;
+    CoordType num_cols;
+    OffsetType num_nonzeros;
+    SymmetryType symmetry;
+    unsigned index_base;
+    rebind_vector<Allocator, OffsetType> row_offsets;
+    rebind_vector<Allocator, size_t> row_bytes;
+    rebind_vector<Allocator, unsigned char> encoded;
+    typename ValueTraits<ValueType>::template allocated_array<Allocator> values;
+
+    PackedRow<CoordType> row(CoordType i) const {
+        const size_t row = static_cast<size_t>(i);
+        return PackedRow<CoordType>(encoded.data() + row_bytes[row],
+                                    static_cast<size_t>(row_offsets[row + 1] - row_offsets[row]),
+                                    static_cast<CoordType>(index_base));
+    }
+};
+
+// Loads like read_csr and encodes the column indices row by row, in
+// parallel for LoadMode::PARALLEL. LoadOptions::cache is not used.
+template<typename CoordType, typename ValueType, typename OffsetType = CoordType,
+         typename Allocator = std::allocator<CoordType>>
+PackedCSRMatrix<CoordType,ValueType,OffsetType,Allocator>
+read_packed_csr(const char* filename, const LoadOptions& options = LoadOptions(),
+                const Allocator& allocator = Allocator());
+
+// Background loading. The loads run on other threads and hand back their
+// matrix (or exception) through the future, so a caller can start several
+// and do other work meanwhile. The options are copied, but LoadOptions::stats
+// must stay valid until the future is ready and LoadOptions::on_phase is
+// called on the loading thread.
+
+// A fixed set of worker threads that run loads in submission order, at most
+// num_workers() at a time. The destructor waits for every submitted load.
+class LoadPool {
+public:
+    // 0 workers means hardware concurrency
+    explicit LoadPool(unsigned num_workers = 0);
+    ~LoadPool();
+    LoadPool(const LoadPool&) = delete;
+    LoadPool& operator=(const LoadPool&) = delete;
+
+    template<typename Function>
+    auto submit(Function f) -> std::future<decltype(f())>;
+
+    unsigned num_workers() const { return static_cast<unsigned>(workers.size()); }
+
+private:
+    void work();
+
+    std::mutex mutex;
+    std::condition_variable changed;
+    std::deque<std::function<void()>> tasks;
+    bool stopping;
+    std::vector<std::thread> workers;
+};
+
+// Loads on a thread of their own
+template<typename CoordType, typename ValueType, typename OffsetType = CoordType,
+         typename Allocator = std::allocator<CoordType>>
+std::future<CSRMatrix<CoordType,ValueType,OffsetType,Allocator>>
+read_csr_async(const char* filename, const LoadOptions& options = LoadOptions(),
+               const Allocator& allocator = Allocator());
+
+template<typename CoordType, typename ValueType, typename OffsetType = CoordType,
+         typename Allocator = std::allocator<CoordType>>
+std::future<CSCMatrix<CoordType,ValueType,OffsetType,Allocator>>
+read_csc_async(const char* filename, const LoadOptions& options = LoadOptions(),
+               const Allocator& allocator = Allocator());
+
+// Loads on a worker of `pool`. In LoadMode::PARALLEL with num_threads = 0
+// every load gets an equal share of the hardware threads, so that the
+// concurrent loads don't oversubscribe the machine.
+template<typename CoordType, typename ValueType, typename OffsetType = CoordType,
+         typename Allocator = std::allocator<CoordType>>
+std::future<CSRMatrix<CoordType,ValueType,OffsetType,Allocator>>
+read_csr_async(LoadPool& pool, const char* filename, const LoadOptions& options = LoadOptions(),
+               const Allocator& allocator = Allocator());
+
+template<typename CoordType, typename ValueType, typename OffsetType = CoordType,
+         typename Allocator = std::allocator<CoordType>>
+std::future<CSCMatrix<CoordType,ValueType,OffsetType,Allocator>>
+read_csc_async(LoadPool& pool, const char* filename, const LoadOptions& options = LoadOptions(),
+               const Allocator& allocator = Allocator());
+
+// Submits one load per file to `pool`; the futures are in the order of
+// `filenames`. The loads can't share a LoadStats, so options.stats must be
+// null.
+template<typename CoordType, typename ValueType, typename OffsetType = CoordType,
+         typename Allocator = std::allocator<CoordType>>
+std::vector<std::future<CSRMatrix<CoordType,ValueType,OffsetType,Allocator>>>
+read_csr_batch(LoadPool& pool, const std::vector<std::string>& filenames,
+               const LoadOptions& options = LoadOptions(), const Allocator& allocator = Allocator());
+
+template<typename CoordType, typename ValueType, typename OffsetType = CoordType,
+         typename Allocator = std::allocator<CoordType>>
+std::vector<std::future<CSCMatrix<CoordType,ValueType,OffsetType,Allocator>>>
+read_csc_batch(LoadPool& pool, const std::vector<std::string>& filenames,
+               const LoadOptions& options = LoadOptions(), const Allocator& allocator = Allocator());
+
+// Linear-time conversions between the two orientations of the same matrix
+template<typename CoordType, typename ValueType, typename OffsetType = CoordType,
+         typename Allocator = std::allocator<CoordType>>
+CSCMatrix<CoordType,ValueType,OffsetType,Allocator>
+csr_to_csc(const CSRMatrix<CoordType,ValueType,OffsetType,Allocator>& csr);
+
+template<typename CoordType, typename ValueType, typename OffsetType = CoordType,
+         typename Allocator = std::allocator<CoordType>>
+CSRMatrix<CoordType,ValueType,OffsetType,Allocator>
+csc_to_csr(const CSCMatrix<CoordType,ValueType,OffsetType,Allocator>& csc);
+
+// Loading one block of a matrix for distributed-memory jobs. A BlockGrid
+// cuts the matrix into row_parts x col_parts blocks, numbered row by row:
+// block b covers row range b / col_parts and column range b % col_parts.
+// Rows and columns are split into near-equal ranges unless row_bounds or
+// col_bounds give the part boundaries (ascending, from 0 to the matrix
+// size). col_parts = 1 gives 1D row blocks.
+struct BlockGrid {
+    unsigned row_parts;
+    unsigned col_parts;
+    std::vector<size_t> row_bounds;
+    std::vector<size_t> col_bounds;
+
+    BlockGrid(unsigned row_parts = 1, unsigned col_parts = 1) : row_parts(row_parts), col_parts(col_parts) {}
+};
+
+// A block of a larger matrix: local row i is global row first_row + i and
+// local column j is global column first_col + j. For symmetric files kept as
+// one triangle the blocks together hold that triangle and are GENERAL
+// themselves.
+template<typename CoordType, typename ValueType, typename OffsetType = CoordType,
+         typename Allocator = std::allocator<CoordType>>
+struct CSRBlock {
+    CoordType global_rows;
+    CoordType global_cols;
+    CoordType first_row;
+    CoordType first_col;
+    CSRMatrix<CoordType,ValueType,OffsetType,Allocator> local;
+};
+
+// Reads the file and keeps only block `block` of `grid`. Every caller still
+// parses the whole file; see scan_block_entries for splitting the parse.
+template<typename CoordType, typename ValueType, typename OffsetType = CoordType,
+         typename Allocator = std::allocator<CoordType>>
+CSRBlock<CoordType,ValueType,OffsetType,Allocator>
+read_csr_block(const char* filename, const BlockGrid& grid, unsigned block,
+               const LoadOptions& options = LoadOptions(), const Allocator& allocator = Allocator());
+
+// Entries bound for one block, in global 0-based coordinates
+template<typename CoordType, typename ValueType>
+struct BlockEntries {
+    std::vector<CoordType> rows;
+    std::vector<CoordType> cols;
+    typename ValueTraits<ValueType>::array_type values;
+};
+
+template<typename CoordType, typename ValueType>
+struct BlockScan {
+    CoordType num_rows;
+    CoordType num_cols;
+    // The header's entry count and the entry lines of this part
+    size_t num_nonzeros;
+    size_t lines_parsed;
+    // Indexed by block number
+    std::vector<BlockEntries<CoordType,ValueType>> blocks;
+};
+
+// Distributed loading in two steps. Each of `num_parts` processes calls
+// scan_block_entries with its own `part`: it parses only the part-th of
+// num_parts line-aligned byte ranges of the entry section and buckets the
+// entries by block. After the processes have exchanged the buckets (e.g.
+// with MPI_Alltoallv), the owner of each block passes what it received to
+// assemble_csr_block. The lines_parsed of all parts must add up to
+// num_nonzeros, which only the caller can check. Unlike the other readers
+// this parses any lines past the declared entries. Compressed files can't
+// be entered midway, so part 0 reads them whole.
+template<typename CoordType, typename ValueType>
+BlockScan<CoordType,ValueType> scan_block_entries(const char* filename, const BlockGrid& grid,
+                                                  unsigned part, unsigned num_parts,
+                                                  const LoadOptions& options = LoadOptions());
+
+template<typename CoordType, typename ValueType, typename OffsetType = CoordType,
+         typename Allocator = std::allocator<CoordType>>
+CSRBlock<CoordType,ValueType,OffsetType,Allocator>
+assemble_csr_block(CoordType num_rows, CoordType num_cols, const BlockGrid& grid, unsigned block,
+                   const std::vector<BlockEntries<CoordType,ValueType>>& received,
+                   const LoadOptions& options = LoadOptions(), const Allocator& allocator = Allocator());
+
+// Allocator of `Alignment`-byte aligned memory (a power of two, at least
+// sizeof(void*))
+template<typename T, size_t Alignment = 64>
+class AlignedAllocator {
+public:
+    typedef T value_type;
+    template<typename U>
+    struct rebind {
+        typedef AlignedAllocator<U, Alignment> other;
+    };
+
+    AlignedAllocator() {}
+    template<typename U>
+    AlignedAllocator(const AlignedAllocator<U, Alignment>&) {}
+
+    T* allocate(size_t n) {
+        if (n > std::numeric_limits<size_t>::max() / sizeof(T)) {
+            throw std::bad_alloc();
+        }
+        void* p = nullptr;
+        if (::posix_memalign(&p, Alignment, std::max<size_t>(n * sizeof(T), 1)) != 0) {
+            throw std::bad_alloc();
+        }
+        return static_cast<T*>(p);
+    }
+    void deallocate(T* p, size_t) {
+        std::free(p);
+    }
+};
+
+template<typename T, typename U, size_t Alignment>
+bool operator==(const AlignedAllocator<T, Alignment>&, const AlignedAllocator<U, Alignment>&) {
+    return true;
+}
+
+template<typename T, typename U, size_t Alignment>
+bool operator!=(const AlignedAllocator<T, Alignment>&, const AlignedAllocator<U, Alignment>&) {
+    return false;
+}
+
+// Allocator for arrays held in 2 MB huge pages: allocations of at least one
+// huge page are rounded up to whole huge pages, aligned to them and advised
+// for transparent huge pages. Smaller ones are only cache line aligned.
+//
+//   auto csr = read_csr<uint32_t,double,uint64_t,HugePageAllocator<char>>(filename, options);
+template<typename T>
+class HugePageAllocator {
+public:
+    typedef T value_type;
+    static const size_t huge_page_bytes = size_t(2) << 20;
+
+    HugePageAllocator() {}
+    template<typename U>
+    HugePageAllocator(const HugePageAllocator<U>&) {}
+
+    T* allocate(size_t n) {
+        if (n > (std::numeric_limits<size_t>::max() - huge_page_bytes) / sizeof(T)) {
+            throw std::bad_alloc();
+        }
+        size_t bytes = std::max<size_t>(n * sizeof(T), 1);
+        const bool huge = bytes >= huge_page_bytes;
+        if (huge) {
+            bytes = (bytes + huge_page_bytes - 1) / huge_page_bytes * huge_page_bytes;
+        }
+        void* p = nullptr;
+        if (::posix_memalign(&p, huge ? huge_page_bytes : 64, bytes) != 0) {
+            throw std::bad_alloc();
+        }
+#ifdef MADV_HUGEPAGE
+        if (huge) {
+            ::madvise(p, bytes, MADV_HUGEPAGE);
+        }
+#endif
+        return static_cast<T*>(p);
+    }
+    void deallocate(T* p, size_t) {
+        std::free(p);
+    }
+};
+
+template<typename T, typename U>
+bool operator==(const HugePageAllocator<T>&, const HugePageAllocator<U>&) {
+    return true;
+}
+
+template<typename T, typename U>
+bool operator!=(const HugePageAllocator<T>&, const HugePageAllocator<U>&) {
+    return false;
+}
+
+// Adapts Base so that value-initializing an element, as resize() does,
+// default-initializes it instead: new elements of arithmetic type are then
+// left unwritten until they are filled in (see LoadOptions::first_touch).
+template<typename T, typename Base = std::allocator<T>>
+class DefaultInitAllocator : public Base {
+    typedef std::allocator_traits<Base> base_traits;
+public:
+    template<typename U>
+    struct rebind {
+        typedef DefaultInitAllocator<U, typename base_traits::template rebind_alloc<U>> other;
+    };
+
+    DefaultInitAllocator() {}
+    DefaultInitAllocator(const Base& base) : Base(base) {}
+    template<typename U, typename OtherBase>
+    DefaultInitAllocator(const DefaultInitAllocator<U, OtherBase>& other)
+        : Base(static_cast<const OtherBase&>(other)) {}
+
+    template<typename U>
+    void construct(U* p) {
+        ::new(static_cast<void*>(p)) U;
+    }
+    template<typename U, typename... Args>
+    void construct(U* p, Args&&... args) {
+        base_traits::construct(static_cast<Base&>(*this), p, std::forward<Args>(args)...);
+    }
+};
+
+// Whether resize() leaves the new elements of Array unwritten, which
+// LoadOptions::first_touch needs. Specialize it for vectors with another
+// such allocator.
+template<typename Array>
+struct leaves_new_elements_unwritten : std::false_type {};
+
+template<typename T, typename Base>
+struct leaves_new_elements_unwritten<std::vector<T, DefaultInitAllocator<T, Base>>> : std::true_type {};
+
+template<>
+struct leaves_new_elements_unwritten<NoValues> : std::true_type {};
+
+// Dense matrices from "array" files, which list the values column by column.
+// Symmetric, skew-symmetric and hermitian files list only the lower triangle
+// and the upper one is filled in from it.
+enum class DenseLayout { COL_MAJOR, ROW_MAJOR };
+
+template<typename ValueType>
+struct DenseMatrix {
+    size_t num_rows;
+    size_t num_cols;
+    DenseLayout layout;
+    // Entry (i, j) is at j * num_rows + i in COL_MAJOR layout and at
+    // i * num_cols + j in ROW_MAJOR layout
+    std::vector<ValueType, AlignedAllocator<ValueType>> values;
+};
+
+// LoadMode::PARALLEL splits the values among threads; STREAM reads like MMAP
+template<typename ValueType>
+DenseMatrix<ValueType> read_dense(const char* filename, const LoadOptions& options = LoadOptions(),
+                                  DenseLayout layout = DenseLayout::COL_MAJOR);
+
+// Native binary format: a fixed header recording the layout, the widths and
+// kinds of CoordType, ValueType and OffsetType, the index base, the
+// dimensions and the positions of the three arrays, which follow as raw,
+// 64-byte aligned native-endian data. The readers throw if the file was
+// written with different types.
+template<typename CoordType, typename ValueType, typename OffsetType = CoordType,
+         typename Allocator = std::allocator<CoordType>>
+void write_binary(const char* filename, const CSRMatrix<CoordType,ValueType,OffsetType,Allocator>& csr);
+
+template<typename CoordType, typename ValueType, typename OffsetType = CoordType,
+         typename Allocator = std::allocator<CoordType>>
+void write_binary(const char* filename, const CSCMatrix<CoordType,ValueType,OffsetType,Allocator>& csc);
+
+template<typename CoordType, typename ValueType, typename OffsetType = CoordType,
+         typename Allocator = std::allocator<CoordType>>
+CSRMatrix<CoordType,ValueType,OffsetType,Allocator> read_binary_csr(const char* filename,
+                                                                    const Allocator& allocator = Allocator());
+
+template<typename CoordType, typename ValueType, typename OffsetType = CoordType,
+         typename Allocator = std::allocator<CoordType>>
+CSCMatrix<CoordType,ValueType,OffsetType,Allocator> read_binary_csc(const char* filename,
+                                                                    const Allocator& allocator = Allocator());
+
+// Zero-copy views of a binary file: the arrays point straight into a
+// read-only mapping, which stays alive as long as the view (or a copy of it)
+// does.
+class MappedFile;
+
+template<typename CoordType, typename ValueType, typename OffsetType = CoordType>
+struct CSRMatrixView {
+    CoordType num_rows;
+    CoordType num_cols;
+    OffsetType num_nonzeros;
+    SymmetryType symmetry;
+    unsigned index_base;
+    const OffsetType* row_offsets;
+    const CoordType* col_indices;
+    const ValueType* values;
+    std::shared_ptr<const MappedFile> storage;
+};
+
+template<typename CoordType, typename ValueType, typename OffsetType = CoordType>
+struct CSCMatrixView {
+    CoordType num_rows;
+    CoordType num_cols;
+    OffsetType num_nonzeros;
+    SymmetryType symmetry;
+    unsigned index_base;
+    const OffsetType* col_offsets;
+    const CoordType* row_indices;
+    const ValueType* values;
+    std::shared_ptr<const MappedFile> storage;
+};
+
+template<typename CoordType, typename ValueType, typename OffsetType = CoordType>
+CSRMatrixView<CoordType,ValueType,OffsetType> map_binary_csr(const char* filename);
+
+template<typename CoordType, typename ValueType, typename OffsetType = CoordType>
+CSCMatrixView<CoordType,ValueType,OffsetType> map_binary_csc(const char* filename);
+
+// Streaming access to the entries of a file, for jobs that don't need the
+// assembled matrix. Entries come out in file order, bounds-checked and
+// 0-indexed, and memory use stays constant regardless of the file size.
+// For symmetric files only the stored entries are produced unless
+// `expand_symmetric` is set, in which case every off-diagonal entry is
+// followed by its mirror.
+template<typename CoordType, typename ValueType>
+struct Entry {
+    CoordType row;
+    CoordType col;
+    ValueType value;
+};
+
+template<typename CoordType, typename ValueType>
+class EntryReader;
+
+// Calls f(row, col, value) for every entry; EntryReader::header() has the
+// dimensions when they are needed up front
+template<typename CoordType, typename ValueType, typename Function>
+void for_each_entry(const char* filename, Function f, bool expand_symmetric = false);
+
+struct WriteOptions {
+    // REAL, INTEGER, PATTERN (no values) or COMPLEX in the output. REAL is
+    // written as COMPLEX for std::complex values and as PATTERN for void.
+    ValueFormat value_type;
+    // SYMMETRIC and HERMITIAN write only the lower triangle (row >= col),
+    // SKEW_SYMMETRIC only the strictly lower one, of a matrix the caller
+    // knows to have that symmetry
+    SymmetryType symmetry;
+    // Formatting threads, 0 means hardware concurrency
+    unsigned num_threads;
+
+    WriteOptions(ValueFormat value_type = ValueFormat::REAL,
+                 SymmetryType symmetry = SymmetryType::GENERAL, unsigned num_threads = 0)
+        : value_type(value_type), symmetry(symmetry), num_threads(num_threads) {}
+};
+
+// Writes a MatrixMarket coordinate file. CSR input is written in row-major
+// order and CSC input in column-major order. Reals are written so that they
+// read back to the same value, with the shortest such decimal under C++17
+// (std::to_chars) and max_digits10 digits before that. A matrix holding one
+// triangle is written with its own symmetry, whatever WriteOptions::symmetry
+// says.
+template<typename CoordType, typename ValueType, typename OffsetType = CoordType,
+         typename Allocator = std::allocator<CoordType>>
+void write_mtx(const char* filename, const CSRMatrix<CoordType,ValueType,OffsetType,Allocator>& csr,
+               const WriteOptions& options = WriteOptions());
+
+template<typename CoordType, typename ValueType, typename OffsetType = CoordType,
+         typename Allocator = std::allocator<CoordType>>
+void write_mtx(const char* filename, const CSCMatrix<CoordType,ValueType,OffsetType,Allocator>& csc,
+               const WriteOptions& options = WriteOptions());
+
+///////////////////////////////////////////////////////////////////////////////
+// Utility struct for the header
+///////////////////////////////////////////////////////////////////////////////
+
+template<typename CoordType>
+struct Header {
+    SymmetryType symmetry;
+    ValueFormat value_type;
+    CoordType num_rows;
+    CoordType num_cols;
+    // Entry lines, which may be more than CoordType can count
+    size_t num_nonzeros;
+    size_t num_comment_lines;
+};
+
+///////////////////////////////////////////////////////////////////////////////
+// Utility Token class
+///////////////////////////////////////////////////////////////////////////////
+
+// The fields of a line, split at runs of white space as the Matrix Market
+// format allows (and as the in-place parsers do)
+class Tokens {
+public:
+    explicit Tokens(const std::string& str) {
+        std::istringstream iss(str);
+        std::string token;
+        while (iss >> token) {
+            tokens.push_back(token);
+        }
+    }
+    std::string pop() {
+        assert(!tokens.empty());
+        auto token = tokens.front();
+        tokens.pop_front();
+        return token;
+    }
+    std::string& peek() {
+        assert(!tokens.empty());
+        return tokens.front();
+    }
+    size_t size() {
+        return tokens.size();
+    }
+private:
+    std::deque<std::string> tokens;
+};
+
+///////////////////////////////////////////////////////////////////////////////
+// Utility MappedFile class
+///////////////////////////////////////////////////////////////////////////////
+
+// Read-only, private mapping of a whole file. An empty file maps to an empty
+// range (data() == nullptr, size() == 0).
+class MappedFile {
+public:
+    explicit MappedFile(const char* filename) : ptr(nullptr), len(0) {
+        int fd = ::open(filename, O_RDONLY);
+        if (fd < 0) {
+            throw std::invalid_argument("Could not open file for reading");
+        }
+        struct stat st;
+        if (::fstat(fd, &st) != 0) {
+            ::close(fd);
+            throw std::invalid_argument("Could not stat file");
+        }
+        len = static_cast<size_t>(st.st_size);
+        if (len > 0) {
+            void* p = ::mmap(nullptr, len, PROT_READ, MAP_PRIVATE, fd, 0);
+            if (p == MAP_FAILED) {
+                ::close(fd);
+                throw std::invalid_argument("Could not mmap file");
+            }
+            ::madvise(p, len, MADV_SEQUENTIAL);
+            ptr = static_cast<const char*>(p);
+        }
+        ::close(fd);
+    }
+    ~MappedFile() {
+        if (ptr != nullptr) {
+            ::munmap(const_cast<char*>(ptr), len);
+        }
+    }
+    MappedFile(const MappedFile&) = delete;
+    MappedFile& operator=(const MappedFile&) = delete;
+
+    const char* data() const { return ptr; }
+    size_t size() const { return len; }
+    const char* begin() const { return ptr; }
+    const char* end() const { return ptr + len; }
+
+    // Drops the pages wholly before `pos` from the mapping; they are read
+    // back from the file if touched again. Keeps the resident size of a
+    // single front-to-back pass bounded.
+    void release_before(const char* pos) const {
+        const size_t page = static_cast<size_t>(::sysconf(_SC_PAGESIZE));
+        const size_t bytes = static_cast<size_t>(pos - ptr) / page * page;
+        if (bytes > 0) {
+            ::madvise(const_cast<char*>(ptr), bytes, MADV_DONTNEED);
+        }
+    }
+private:
+    const char* ptr;
+    size_t len;
+};
+
+///////////////////////////////////////////////////////////////////////////////
+// Utility threading functions
+///////////////////////////////////////////////////////////////////////////////
+
+inline unsigned resolve_num_threads(unsigned requested) {
+    if (requested != 0) {
+        return requested;
+    }
+    unsigned hardware = std::thread::hardware_concurrency();
+    return hardware != 0 ? hardware : 1;
+}
+
+// Pins the calling thread to the `index`-th CPU (wrapping around) of those it
+// may run on. Best effort: does nothing where affinity isn't supported.
+inline void pin_to_cpu(unsigned index) {
+#ifdef __linux__
+    cpu_set_t allowed;
+    if (::sched_getaffinity(0, sizeof(allowed), &allowed) != 0 || CPU_COUNT(&allowed) == 0) {
+        return;
+    }
+    unsigned skip = index % static_cast<unsigned>(CPU_COUNT(&allowed));
+    for (int cpu = 0; cpu < CPU_SETSIZE; cpu++) {
+        if (CPU_ISSET(cpu, &allowed) && skip-- == 0) {
+            cpu_set_t one;
+            CPU_ZERO(&one);
+            CPU_SET(cpu, &one);
+            ::sched_setaffinity(0, sizeof(one), &one);
+            return;
+        }
+    }
+#else
+    (void)index;
+#endif
+}
+
+// Runs f(thread_index) for every index in [0, num_threads), on the calling
+// thread when there is only one. The first exception thrown (by thread
+// index) is rethrown once every thread has finished.
+template<typename Function>
+void parallel_for_threads(unsigned num_threads, Function f) {
+    if (num_threads <= 1) {
+        f(0u);
+        return;
+    }
+    std::vector<std::exception_ptr> errors(num_threads);
+    std::vector<std::thread> threads;
+    threads.reserve(num_threads);
+    for (unsigned t = 0; t < num_threads; t++) {
+        threads.emplace_back([&f, &errors, t]() {
+            try {
+                f(t);
+            } catch (...) {
+                errors[t] = std::current_exception();
+            }
+        });
+    }
+    for (auto& thread : threads) {
+        thread.join();
+    }
+    for (auto& error : errors) {
+        if (error) {
+            std::rethrow_exception(error);
+        }
+    }
+}
+
+///////////////////////////////////////////////////////////////////////////////
+// Utility functions
+///////////////////////////////////////////////////////////////////////////////
+
+inline ValueFormat parse_value_fmt(std::string value_fmt_string) {
+    if (value_fmt_string == "real") {
+        return ValueFormat::REAL;
+    } else if (value_fmt_string == "integer") {
+        return ValueFormat::INTEGER;
+    } else if (value_fmt_string == "pattern") {
+        return ValueFormat::PATTERN;
+    } else if (value_fmt_string == "complex") {
+        return ValueFormat::COMPLEX;
+    } else {
+        throw std::invalid_argument("Bad Header: unknown value format");
+    }
+}
+
+inline SymmetryType parse_symmetry(std::string symmetry_string) {
+    if (symmetry_string == "general") {
+        return SymmetryType::GENERAL;
+    } else if (symmetry_string == "symmetric") {
+        return SymmetryType::SYMMETRIC;
+    } else if (symmetry_string == "skew-symmetric") {
+        return SymmetryType::SKEW_SYMMETRIC;
+    } else if (symmetry_string == "hermitian") {
+        return SymmetryType::HERMITIAN;
+    } else {
+        throw std::invalid_argument("Bad Header: unknown symmetry");
+    }
+}
+
+template<typename IntType>
+IntType parse_int(std::string int_string) {
+    std::istringstream iss(int_string);
+    IntType int_val;
+    iss >> int_val;
+    return int_val;
+}
+
+// A size from the header, which must fit in IntType
+template<typename IntType>
+IntType parse_size(const std::string& size_string) {
+    const unsigned long long size = parse_int<unsigned long long>(size_string);
+    if (size > static_cast<unsigned long long>(std::numeric_limits<IntType>::max())) {
+        throw std::invalid_argument("Bad Header: matrix size overflows its type");
+    }
+    return static_cast<IntType>(size);
+}
+
+// An entry coordinate. One that overflows IntType or has anything after the
+// digits is rejected as in the in-place parser below, rather than clamped to
+// the maximum or cut short by operator>>.
+template<typename IntType>
+IntType parse_coord(const std::string& int_string, const char* ill_shaped) {
+    std::istringstream iss(int_string);
+    IntType int_val;
+    if (!(iss >> int_val) || !iss.eof()) {
+        throw std::invalid_argument(ill_shaped);
+    }
+    return int_val;
+}
+
+inline float strto_num(const char* str, char** str_end, float) {
+    return std::strtof(str, str_end);
+}
+inline double strto_num(const char* str, char** str_end, double) {
+    return std::strtod(str, str_end);
+}
+inline long double strto_num(const char* str, char** str_end, long double) {
+    return std::strtold(str, str_end);
+}
+template<typename T>
+std::complex<T> strto_num(const char* str, char** str_end, std::complex<T>) {
+    return std::complex<T>(strto_num(str, str_end, T()));
+}
+
+// Integer values that don't fit NumType are rejected; floating-point ones
+// go through strtod, so that out-of-range values become inf as they do in
+// the in-place parser (operator>> would clamp them to the maximum). Either
+// must be the whole field, and hexadecimal floats, which strtod would take
+// but the in-place parser doesn't, are rejected.
+template<typename NumType>
+NumType parse_num(const std::string& num_string, std::true_type /* integral */) {
+    std::istringstream iss(num_string);
+    NumType num_val;
+    if (!(iss >> num_val) || !iss.eof()) {
+        throw std::invalid_argument("Bad Matrix: ill-shaped value line");
+    }
+    return num_val;
+}
+
+template<typename NumType>
+NumType parse_num(const std::string& num_string, std::false_type /* integral */) {
+    char* end;
+    const NumType num_val = strto_num(num_string.c_str(), &end, NumType());
+    if (end == num_string.c_str() || *end != '\0' || num_string.find_first_of("xX") != std::string::npos) {
+        throw std::invalid_argument("Bad Matrix: ill-shaped value line");
+    }
+    return num_val;
+}
+
+template<typename NumType>
+NumType parse_num(std::string num_string) {
+    return parse_num<NumType>(num_string, std::is_integral<NumType>());
+}
+
+template<typename NumType>
+void parse_value(const std::string& num_string, NumType& value) {
+    value = parse_num<NumType>(num_string);
+}
+
+inline void parse_value(const std::string& num_string, NoValue&) {
+    parse_num<double>(num_string);
+}
+
+template<typename NumType>
+struct is_complex : std::false_type {};
+
+template<typename NumType>
+struct is_complex<std::complex<NumType>> : std::true_type {};
+
+// Real and imaginary parts of a complex entry
+template<typename NumType>
+void parse_complex_value(const std::string&, const std::string&, NumType&) {
+    throw std::invalid_argument("Bad Matrix: complex values need a std::complex ValueType");
+}
+
+template<typename NumType>
+void parse_complex_value(const std::string& real, const std::string& imag, std::complex<NumType>& value) {
+    value = std::complex<NumType>(parse_num<NumType>(real), parse_num<NumType>(imag));
+}
+
+inline void parse_complex_value(const std::string& real, const std::string& imag, NoValue&) {
+    parse_num<double>(real);
+    parse_num<double>(imag);
+}
+
+// The value stored for the entries of a pattern matrix
+template<typename NumType>
+void set_pattern_value(NumType& value) {
+    value = 1;
+}
+
+inline void set_pattern_value(NoValue&) {}
+
+///////////////////////////////////////////////////////////////////////////////
+// In-place number parsing
+///////////////////////////////////////////////////////////////////////////////
+
+// These parse a single field starting at `pos` without allocating, advance
+// `pos` past it and return false if no number was found. None of them read
+// at or beyond `end`, so they are safe on a mapping that is not
+// NUL-terminated.
+
+inline bool is_blank(char c) {
+    return c == ' ' || c == '\t';
+}
+
+inline void skip_blanks(const char*& pos, const char* end) {
+    while (pos != end && is_blank(*pos)) {
+        ++pos;
+    }
+}
+
+#ifdef MATRIXMARKET_SWAR
+// Decodes the run of leading digits in the 8 bytes at `p` in one go (SWAR:
+// the bytes are handled as lanes of a 64-bit register). Returns the number
+// of digits, 0 to 8, and stores their value.
+inline unsigned parse_digits8(const char* p, uint64_t& out) {
+    uint64_t word;
+    std::memcpy(&word, p, sizeof(word));
+    // Digits become 0-9 in their byte. Anything else gets its top bit set,
+    // either directly or by the add; a carry out of such a byte only affects
+    // the bytes after the first non-digit.
+    uint64_t lanes = word ^ 0x3030303030303030ULL;
+    const uint64_t non_digits = ((lanes + 0x7676767676767676ULL) | lanes) & 0x8080808080808080ULL;
+    const unsigned num_digits = non_digits == 0 ? 8 : static_cast<unsigned>(__builtin_ctzll(non_digits)) / 8;
+    out = 0;
+    if (num_digits == 0) {
+        return 0;
+    }
+    // Shift the digits to the top so that the bytes below act as leading
+    // zeros, then combine pairs of digits, pairs of pairs and so on
+    lanes <<= 8 * (8 - num_digits);
+    lanes = (lanes * 10 + (lanes >> 8)) & 0x00FF00FF00FF00FFULL;
+    lanes = (lanes * 100 + (lanes >> 16)) & 0x0000FFFF0000FFFFULL;
+    lanes = (lanes * 10000 + (lanes >> 32)) & 0x00000000FFFFFFFFULL;
+    out = lanes;
+    return num_digits;
+}
+
+static const uint64_t pow10_table[9] = {
+    1, 10, 100, 1000, 10000, 100000, 1000000, 10000000, 100000000
+};
+
+// Appends the digits at `p` to a float mantissa eight at a time while a
+// full word is left before `end`, counting the significant ones (those after
+// leading zeros) in `num_digits`. Returns the number of digits consumed.
+inline int accumulate_digits8(const char*& p, const char* end, uint64_t& mantissa, int& num_digits) {
+    int consumed = 0;
+    while (end - p >= 8) {
+        uint64_t chunk;
+        const unsigned n = parse_digits8(p, chunk);
+        if (mantissa != 0) {
+            num_digits += static_cast<int>(n);
+        } else {
+            unsigned significant = 0;
+            while (significant < n && chunk >= pow10_table[significant]) {
+                ++significant;
+            }
+            num_digits += static_cast<int>(significant);
+        }
+        mantissa = mantissa * pow10_table[n] + chunk;
+        consumed += static_cast<int>(n);
+        p += n;
+        if (n < 8) {
+            break;
+        }
+    }
+    return consumed;
+}
+#endif
+
+template<typename IntType>
+bool parse_int_inplace(const char*& pos, const char* end, IntType& out) {
+    static_assert(std::is_integral<IntType>::value, "IntType must be integral");
+    using UIntType = typename std::make_unsigned<IntType>::type;
+
+    const char* p = pos;
+    bool negative = false;
+    if (p != end && (*p == '-' || *p == '+')) {
+        negative = *p == '-';
+        ++p;
+    }
+    const char* digits = p;
+    // The largest magnitude that fits; anything above it is rejected, as
+    // operator>> does, instead of wrapping around
+    const uint64_t limit = static_cast<uint64_t>(std::numeric_limits<IntType>::max()) +
+                           (negative && std::is_signed<IntType>::value ? 1 : 0);
+    uint64_t value = 0;
+#ifdef MATRIXMARKET_SWAR
+    // Eight digits at a time while a full word is left before `end`
+    while (end - p >= 8) {
+        uint64_t chunk;
+        const unsigned num_digits = parse_digits8(p, chunk);
+        if (chunk > limit || value > (limit - chunk) / pow10_table[num_digits]) {
+            return false;
+        }
+        value = value * pow10_table[num_digits] + chunk;
+        p += num_digits;
+        if (num_digits < 8) {
+            break;
+        }
+    }
+#endif
+    while (p != end && static_cast<unsigned char>(*p - '0') < 10) {
+        const uint64_t digit = static_cast<uint64_t>(*p - '0');
+        if (value > (limit - digit) / 10) {
+            return false;
+        }
+        value = value * 10 + digit;
+        ++p;
+    }
+    if (p == digits) {
+        return false;
+    }
+    // Like operator>>, a negative value for an unsigned type wraps around
+    const UIntType magnitude = static_cast<UIntType>(value);
+    out = static_cast<IntType>(negative ? static_cast<UIntType>(0 - magnitude) : magnitude);
+    pos = p;
+    return true;
+}
+
+// Limits of the exact fast path: a decimal mantissa below 2^digits times a
+// power of ten that is itself exactly representable gives a correctly rounded
+// result with a single multiplication or division (Clinger's fast path).
+template<typename FloatType> struct FastFloatTraits {
+    static constexpr uint64_t max_mantissa = 0;
+    static constexpr int max_exponent = -1;
+};
+template<> struct FastFloatTraits<float> {
+    static constexpr uint64_t max_mantissa = uint64_t(1) << 24;
+    static constexpr int max_exponent = 10;
+};
+template<> struct FastFloatTraits<double> {
+    static constexpr uint64_t max_mantissa = uint64_t(1) << 53;
+    static constexpr int max_exponent = 22;
+};
+
+template<typename FloatType>
+FloatType exact_pow10(int exponent) {
+    static const FloatType table[] = {
+        1e0, 1e1, 1e2, 1e3, 1e4, 1e5, 1e6, 1e7, 1e8, 1e9, 1e10, 1e11,
+        1e12, 1e13, 1e14, 1e15, 1e16, 1e17, 1e18, 1e19, 1e20, 1e21, 1e22
+    };
+    return table[exponent];
+}
+
+// Slow path for anything the fast path can't handle exactly (long mantissas,
+// large exponents, inf/nan, long double): copy the token out so that the libc
+// parser sees a NUL-terminated string.
+template<typename FloatType>
+bool parse_float_fallback(const char*& pos, const char* end, FloatType& out) {
+    const char* token_end = pos;
+    while (token_end != end && !is_blank(*token_end) &&
+           *token_end != '\n' && *token_end != '\r') {
+        ++token_end;
+    }
+    std::string token(pos, token_end);
+    char* parsed_end = nullptr;
+    out = strto_num(token.c_str(), &parsed_end, FloatType());
+    if (parsed_end == token.c_str()) {
+        return false;
+    }
+    pos += parsed_end - token.c_str();
+    return true;
+}
+
+template<typename FloatType>
+bool parse_float_inplace(const char*& pos, const char* end, FloatType& out) {
+    using Traits = FastFloatTraits<FloatType>;
+
+    const char* p = pos;
+    bool negative = false;
+    if (p != end && (*p == '-' || *p == '+')) {
+        negative = *p == '-';
+        ++p;
+    }
+
+    uint64_t mantissa = 0;
+    int num_digits = 0;
+    int exponent = 0;
+    bool any_digits = false;
+
+#ifdef MATRIXMARKET_SWAR
+    any_digits = accumulate_digits8(p, end, mantissa, num_digits) > 0;
+#endif
+    while (p != end && static_cast<unsigned char>(*p - '0') < 10) {
+        if (mantissa != 0 || *p != '0') {
+            ++num_digits;
+        }
+        mantissa = mantissa * 10 + static_cast<uint64_t>(*p - '0');
+        any_digits = true;
+        ++p;
+    }
+    if (p != end && *p == '.') {
+        ++p;
+#ifdef MATRIXMARKET_SWAR
+        const int fraction_digits = accumulate_digits8(p, end, mantissa, num_digits);
+        exponent -= fraction_digits;
+        any_digits = any_digits || fraction_digits > 0;
+#endif
+        while (p != end && static_cast<unsigned char>(*p - '0') < 10) {
+            if (mantissa != 0 || *p != '0') {
+                ++num_digits;
+            }
+            mantissa = mantissa * 10 + static_cast<uint64_t>(*p - '0');
+            --exponent;
+            any_digits = true;
+            ++p;
+        }
+    }
+    if (!any_digits || num_digits > 19) {
+        return parse_float_fallback(pos, end, out);
+    }
+    if (p != end && (*p == 'e' || *p == 'E')) {
+        const char* q = p + 1;
+        bool exp_negative = false;
+        if (q != end && (*q == '-' || *q == '+')) {
+            exp_negative = *q == '-';
+            ++q;
+        }
+        if (q == end || static_cast<unsigned char>(*q - '0') >= 10) {
+            return parse_float_fallback(pos, end, out);
+        }
+        int exp_value = 0;
+        while (q != end && static_cast<unsigned char>(*q - '0') < 10) {
+            if (exp_value < 100000) {
+                exp_value = exp_value * 10 + (*q - '0');
+            }
+            ++q;
+        }
+        exponent += exp_negative ? -exp_value : exp_value;
+        p = q;
+    }
+
+    if (mantissa == 0) {
+        out = negative ? -FloatType(0) : FloatType(0);
+    } else if (mantissa <= Traits::max_mantissa &&
+               exponent >= -Traits::max_exponent && exponent <= Traits::max_exponent) {
+        FloatType value = static_cast<FloatType>(mantissa);
+        if (exponent < 0) {
+            value /= exact_pow10<FloatType>(-exponent);
+        } else {
+            value *= exact_pow10<FloatType>(exponent);
+        }
+        out = negative ? -value : value;
+    } else {
+        return parse_float_fallback(pos, end, out);
+    }
+    pos = p;
+    return true;
+}
+
+template<typename NumType>
+bool parse_num_inplace(const char*& pos, const char* end, NumType& out, std::true_type /* integral */) {
+    return parse_int_inplace(pos, end, out);
+}
+
+template<typename NumType>
+bool parse_num_inplace(const char*& pos, const char* end, NumType& out, std::false_type /* integral */) {
+    return parse_float_inplace(pos, end, out);
+}
+
+template<typename NumType>
+bool parse_num_inplace(const char*& pos, const char* end, NumType& out) {
+    return parse_num_inplace(pos, end, out, std::is_integral<NumType>());
+}
+
+// Values read with ValueType = void are checked and dropped
+inline bool parse_num_inplace(const char*& pos, const char* end, NoValue&) {
+    double discarded;
+    return parse_float_inplace(pos, end, discarded);
+}
+
+// A real value read into a complex ValueType
+template<typename NumType>
+bool parse_num_inplace(const char*& pos, const char* end, std::complex<NumType>& out) {
+    NumType real;
+    if (!parse_num_inplace(pos, end, real)) {
+        return false;
+    }
+    out = std::complex<NumType>(real, NumType(0));
+    return true;
+}
+
+// The real and imaginary part fields of a complex entry
+template<typename NumType>
+bool parse_complex_inplace(const char*&, const char*, NumType&) {
+    throw std::invalid_argument("Bad Matrix: complex values need a std::complex ValueType");
+}
+
+template<typename NumType>
+bool parse_complex_inplace(const char*& pos, const char* end, std::complex<NumType>& out) {
+    NumType real, imag;
+    if (!parse_num_inplace(pos, end, real)) {
+        return false;
+    }
+    skip_blanks(pos, end);
+    if (!parse_num_inplace(pos, end, imag)) {
+        return false;
+    }
+    out = std::complex<NumType>(real, imag);
+    return true;
+}
+
+inline bool parse_complex_inplace(const char*& pos, const char* end, NoValue& out) {
+    if (!parse_num_inplace(pos, end, out)) {
+        return false;
+    }
+    skip_blanks(pos, end);
+    return parse_num_inplace(pos, end, out);
+}
+
+///////////////////////////////////////////////////////////////////////////////
+// Vectorized scanning
+///////////////////////////////////////////////////////////////////////////////
+
+// Counting newlines is the inner loop of splitting the entry section into
+// chunks and lines. The portable version looks at 8 bytes at a time; on
+// x86-64 the AVX-512BW or AVX2 version is chosen once at runtime, and
+// AArch64 uses NEON.
+
+inline size_t count_newlines_scalar(const char* begin, const char* end) {
+    size_t count = 0;
+    const char* pos = begin;
+#ifdef MATRIXMARKET_SWAR
+    const uint64_t low7 = 0x7F7F7F7F7F7F7F7FULL;
+    for (; end - pos >= 8; pos += 8) {
+        uint64_t word;
+        std::memcpy(&word, pos, sizeof(word));
+        // Exactly the bytes equal to '\n' end up as 0x80, then sum the lanes
+        const uint64_t x = word ^ 0x0A0A0A0A0A0A0A0AULL;
+        const uint64_t zero = ~(((x & low7) + low7) | x | low7);
+        count += static_cast<size_t>(((zero >> 7) * 0x0101010101010101ULL) >> 56);
+    }
+#endif
+    for (; pos != end; ++pos) {
+        count += *pos == '\n';
+    }
+    return count;
+}
+
+#ifdef MATRIXMARKET_SIMD_X86
+__attribute__((target("avx2,popcnt")))
+inline size_t count_newlines_avx2(const char* begin, const char* end) {
+    const __m256i newline = _mm256_set1_epi8('\n');
+    size_t count = 0;
+    const char* pos = begin;
+    for (; end - pos >= 32; pos += 32) {
+        const __m256i block = _mm256_loadu_si256(reinterpret_cast<const __m256i*>(pos));
+        const unsigned mask = static_cast<unsigned>(_mm256_movemask_epi8(_mm256_cmpeq_epi8(block, newline)));
+        count += static_cast<size_t>(__builtin_popcount(mask));
+    }
+    return count + count_newlines_scalar(pos, end);
+}
+
+__attribute__((target("avx512bw,popcnt")))
+inline size_t count_newlines_avx512(const char* begin, const char* end) {
+    const __m512i newline = _mm512_set1_epi8('\n');
+    size_t count = 0;
+    const char* pos = begin;
+    for (; end - pos >= 64; pos += 64) {
+        const __m512i block = _mm512_loadu_si512(pos);
+        count += static_cast<size_t>(__builtin_popcountll(_mm512_cmpeq_epi8_mask(block, newline)));
+    }
+    return count + count_newlines_scalar(pos, end);
+}
+
+typedef size_t (*CountNewlines)(const char*, const char*);
+
+inline CountNewlines select_count_newlines() {
+    __builtin_cpu_init();
+    if (__builtin_cpu_supports("avx512bw")) {
+        return count_newlines_avx512;
+    }
+    if (__builtin_cpu_supports("avx2")) {
+        return count_newlines_avx2;
+    }
+    return count_newlines_scalar;
+}
+#endif
+
+#ifdef MATRIXMARKET_SIMD_NEON
+inline size_t count_newlines_neon(const char* begin, const char* end) {
+    const uint8x16_t newline = vdupq_n_u8('\n');
+    size_t count = 0;
+    const char* pos = begin;
+    while (end - pos >= 16) {
+        // Matches are 0xFF, so subtracting them counts up by one per lane.
+        // 255 blocks at most before a lane could overflow.
+        uint8x16_t lanes = vdupq_n_u8(0);
+        for (int i = 0; i < 255 && end - pos >= 16; i++, pos += 16) {
+            lanes = vsubq_u8(lanes, vceqq_u8(vld1q_u8(reinterpret_cast<const uint8_t*>(pos)), newline));
+        }
+        count += vaddlvq_u8(lanes);
+    }
+    return count + count_newlines_scalar(pos, end);
+}
+#endif
+
+inline size_t count_newlines(const char* begin, const char* end) {
+#if defined(MATRIXMARKET_SIMD_X86)
+    static const CountNewlines count = select_count_newlines();
+    return count(begin, end);
+#elif defined(MATRIXMARKET_SIMD_NEON)
+    return count_newlines_neon(begin, end);
+#else
+    return count_newlines_scalar(begin, end);
+#endif
+}
+
+// The two coordinates at the start of an entry line are the other inner
+// loop. With AVX2, one 32-byte load gives the masks of digits and blanks
+// that delimit both fields, and both are decoded at once, one per 128-bit
+// lane. Fields longer than CoordDigits, signs, values that don't fit
+// CoordType and the last bytes of the input take the scalar parser.
+
+// The longest field the vector decoder takes for CoordType: as many digits
+// as its maximum has, at most 16 (one lane)
+template<typename CoordType>
+struct CoordDigits {
+    static const int value = std::numeric_limits<CoordType>::digits10 < 15
+                           ? std::numeric_limits<CoordType>::digits10 + 1 : 16;
+};
+
+#ifdef MATRIXMARKET_SIMD_X86
+inline bool have_avx2() {
+    static const bool avx2 = (__builtin_cpu_init(), __builtin_cpu_supports("avx2") != 0);
+    return avx2;
+}
+
+// Parses "row<blanks>col" at `pos`, which needs 48 readable bytes. Returns
+// false, without moving `pos`, for anything it leaves to the scalar parser.
+template<typename CoordType>
+__attribute__((target("avx2")))
+bool parse_coordinates_avx2(const char*& pos, CoordType& row, CoordType& col) {
+    const __m256i block = _mm256_loadu_si256(reinterpret_cast<const __m256i*>(pos));
+    const __m256i digit = _mm256_sub_epi8(block, _mm256_set1_epi8('0'));
+    const __m256i is_digit = _mm256_cmpeq_epi8(_mm256_min_epu8(digit, _mm256_set1_epi8(9)), digit);
+    const __m256i is_blank = _mm256_or_si256(_mm256_cmpeq_epi8(block, _mm256_set1_epi8(' ')),
+                                             _mm256_cmpeq_epi8(block, _mm256_set1_epi8('\t')));
+    const uint64_t digits = static_cast<uint32_t>(_mm256_movemask_epi8(is_digit));
+    const uint64_t blanks = static_cast<uint32_t>(_mm256_movemask_epi8(is_blank));
+
+    // Row digits, blanks, then column digits that end inside the block
+    const int max_digits = CoordDigits<CoordType>::value;
+    const int row_digits = __builtin_ctzll(~digits);
+    if (row_digits == 0 || row_digits > max_digits) {
+        return false;
+    }
+    const int col_start = row_digits + __builtin_ctzll(~(blanks >> row_digits));
+    if (col_start == row_digits || col_start >= 32) {
+        return false;
+    }
+    const int col_digits = __builtin_ctzll(~(digits >> col_start));
+    if (col_digits == 0 || col_digits > max_digits || col_start + col_digits >= 32) {
+        return false;
+    }
+
+    // Each field goes to its own lane, moved to the top so that the bytes
+    // below act as leading zeros (shuffle indices with the top bit set give
+    // 0). Then pairs of digits, pairs of pairs and so on are combined.
+    const __m256i fields = _mm256_inserti128_si256(
+        _mm256_castsi128_si256(_mm_loadu_si128(reinterpret_cast<const __m128i*>(pos))),
+        _mm_loadu_si128(reinterpret_cast<const __m128i*>(pos + col_start)), 1);
+    const __m256i shift = _mm256_inserti128_si256(_mm256_castsi128_si256(_mm_set1_epi8(char(row_digits - 16))),
+                                                  _mm_set1_epi8(char(col_digits - 16)), 1);
+    const __m256i iota = _mm256_setr_epi8(0, 1, 2, 3, 4, 5, 6, 7, 8, 9, 10, 11, 12, 13, 14, 15,
+                                          0, 1, 2, 3, 4, 5, 6, 7, 8, 9, 10, 11, 12, 13, 14, 15);
+    __m256i lanes = _mm256_shuffle_epi8(_mm256_sub_epi8(fields, _mm256_set1_epi8('0')),
+                                        _mm256_add_epi8(iota, shift));
+    lanes = _mm256_maddubs_epi16(lanes, _mm256_set1_epi16(0x010A));
+    lanes = _mm256_madd_epi16(lanes, _mm256_set1_epi32(0x00010064));
+    lanes = _mm256_packus_epi32(lanes, lanes);
+    lanes = _mm256_madd_epi16(lanes, _mm256_set1_epi32(0x00012710));
+
+    const uint64_t row_value = static_cast<uint64_t>(static_cast<uint32_t>(_mm256_extract_epi32(lanes, 0))) *
+                               100000000 + static_cast<uint32_t>(_mm256_extract_epi32(lanes, 1));
+    const uint64_t col_value = static_cast<uint64_t>(static_cast<uint32_t>(_mm256_extract_epi32(lanes, 4))) *
+                               100000000 + static_cast<uint32_t>(_mm256_extract_epi32(lanes, 5));
+    const uint64_t max_value = static_cast<uint64_t>(std::numeric_limits<CoordType>::max());
+    if (row_value > max_value || col_value > max_value) {
+        return false;
+    }
+    row = static_cast<CoordType>(row_value);
+    col = static_cast<CoordType>(col_value);
+    pos += col_start + col_digits;
+    return true;
+}
+#endif
+
+// Parses the row and column of an entry line and leaves `pos` after the
+// column. Returns false if either is missing or out of range for CoordType.
+template<typename CoordType>
+bool parse_coordinates_inplace(const char*& pos, const char* end, CoordType& row, CoordType& col) {
+#ifdef MATRIXMARKET_SIMD_X86
+    if (end - pos >= 48 && have_avx2() && parse_coordinates_avx2(pos, row, col)) {
+        return true;
+    }
+#endif
+    if (!parse_int_inplace(pos, end, row)) {
+        return false;
+    }
+    skip_blanks(pos, end);
+    return parse_int_inplace(pos, end, col);
+}
+
+///////////////////////////////////////////////////////////////////////////////
+// Header parsing
+///////////////////////////////////////////////////////////////////////////////
+
+inline void strip_carriage_return(std::string& line) {
+    if (!line.empty() && line.back() == '\r') {
+        line.pop_back();
+    }
+}
+
+// `dense` selects the "array" format instead of "coordinate"
+template<typename CoordType>
+void parse_banner_line(std::string& line, Header<CoordType>& header, bool dense = false) {
+    strip_carriage_return(line);
+
+    auto format_tokens = Tokens(line);
+    if (format_tokens.size() != 5) {
+        throw std::invalid_argument("Bad Header: ill-shaped format line");
+    }
+
+    if (format_tokens.pop() != "%%MatrixMarket") {
+        throw std::invalid_argument("Bad Header: missing %%%%MatrixMarket");
+    }
+
+    if (format_tokens.pop() != "matrix") {
+        throw std::invalid_argument("Bad Header: only matrix supported");
+    }
+
+    if (format_tokens.pop() != (dense ? "array" : "coordinate")) {
+        throw std::invalid_argument(dense ? "Bad Header: only array supported"
+                                          : "Bad Header: only coordinate supported");
+    }
+
+    header.value_type = parse_value_fmt(format_tokens.pop());
+    header.symmetry = parse_symmetry(format_tokens.pop());
+
+    if (dense && header.value_type == ValueFormat::PATTERN) {
+        throw std::invalid_argument("Bad Header: array matrix can't be pattern");
+    }
+}
+
+// Number of values an array file lists: every one for general matrices, the
+// lower triangle for symmetric and hermitian ones and the strictly lower
+// triangle for skew-symmetric ones
+inline size_t dense_stored_values(SymmetryType symmetry, size_t num_rows, size_t num_cols) {
+    switch (symmetry) {
+    case SymmetryType::GENERAL:
+        if (num_cols != 0 && num_rows > std::numeric_limits<size_t>::max() / num_cols) {
+            throw std::invalid_argument("Bad Header: matrix size overflows");
+        }
+        return num_rows * num_cols;
+    case SymmetryType::SKEW_SYMMETRIC:
+        return num_rows % 2 == 0 ? num_rows / 2 * (num_rows - 1) : (num_rows - 1) / 2 * num_rows;
+    default:
+        return num_rows % 2 == 0 ? num_rows / 2 * (num_rows + 1) : (num_rows + 1) / 2 * num_rows;
+    }
+}
+
+// Array files have no nonzero count; theirs is the number of values listed
+template<typename CoordType>
+void parse_size_line(std::string& line, Header<CoordType>& header, bool dense = false) {
+    strip_carriage_return(line);
+
+    auto mtx_size_tokens = Tokens(line);
+    if (mtx_size_tokens.size() != (dense ? 2u : 3u)) {
+        throw std::invalid_argument("Bad Header: missing matrix size");
+    }
+
+    header.num_rows = parse_size<CoordType>(mtx_size_tokens.pop());
+    header.num_cols = parse_size<CoordType>(mtx_size_tokens.pop());
+
+    // Mirrored entries would land outside of a non-square matrix
+    if (header.symmetry != SymmetryType::GENERAL && header.num_rows != header.num_cols) {
+        throw std::invalid_argument("Bad Header: symmetric matrix must be square");
+    }
+
+    header.num_nonzeros = dense ? dense_stored_values(header.symmetry, header.num_rows, header.num_cols)
+                                : parse_size<size_t>(mtx_size_tokens.pop());
+}
+
+template<typename CoordType>
+Header<CoordType> read_header(std::ifstream& f) {
+    assert(f.is_open());
+
+    Header<CoordType> header;
+    std::string line;
+    std::getline(f, line);
+    parse_banner_line(line, header);
+
+    header.num_comment_lines = 0;
+    std::getline(f, line);
+    while (line[0] == '%') {
+        header.num_comment_lines++;
+        std::getline(f, line);
+    }
+
+    parse_size_line(line, header);
+    return header;
+}
+
+// Same as above, reading from an in-memory buffer. On return `pos` points at
+// the first byte of the entry section.
+inline std::string next_line(const char*& pos, const char* end) {
+    const char* newline = static_cast<const char*>(std::memchr(pos, '\n', end - pos));
+    const char* line_end = newline != nullptr ? newline : end;
+    std::string line(pos, line_end);
+    pos = newline != nullptr ? newline + 1 : end;
+    return line;
+}
+
+template<typename CoordType>
+Header<CoordType> read_header(const char*& pos, const char* end, bool dense = false) {
+    Header<CoordType> header;
+    std::string line = next_line(pos, end);
+    parse_banner_line(line, header, dense);
+
+    header.num_comment_lines = 0;
+    line = next_line(pos, end);
+    while (line[0] == '%') {
+        header.num_comment_lines++;
+        line = next_line(pos, end);
+    }
+
+    parse_size_line(line, header, dense);
+    return header;
+}
+
+///////////////////////////////////////////////////////////////////////////////
+// Utility COO buffer and memory accounting
+///////////////////////////////////////////////////////////////////////////////
+
+// "COO format" entries as three parallel arrays. Keeping them apart lets the
+// low-memory conversion hand the index and value arrays over to the output
+// matrix instead of copying them.
+template<typename T, typename Allocator>
+void copy_within(std::vector<T,Allocator>& v, size_t first, size_t last, size_t dst) {
+    std::copy(v.begin() + first, v.begin() + last, v.begin() + dst);
+}
+
+inline void copy_within(NoValues&, size_t, size_t, size_t) {}
+
+template<typename CoordType, typename ValueType>
+struct CooBuffer {
+    std::vector<CoordType> rows;
+    std::vector<CoordType> cols;
+    typename ValueTraits<ValueType>::array_type values;
+
+    size_t size() const {
+        return rows.size();
+    }
+    void resize(size_t n) {
+        rows.resize(n);
+        cols.resize(n);
+        values.resize(n);
+    }
+    // Moves entries [first, last) down to position `dst`
+    void move_down(size_t first, size_t last, size_t dst) {
+        copy_within(rows, first, last, dst);
+        copy_within(cols, first, last, dst);
+        copy_within(values, first, last, dst);
+    }
+};
+
+template<typename T, typename Allocator>
+size_t vector_bytes(const std::vector<T,Allocator>& v) {
+    return v.capacity() * sizeof(T);
+}
+
+inline size_t vector_bytes(const NoValues&) {
+    return 0;
+}
+
+template<typename T, typename Allocator>
+void release_vector(std::vector<T,Allocator>& v) {
+    std::vector<T,Allocator>(v.get_allocator()).swap(v);
+}
+
+inline void release_vector(NoValues&) {}
+
+// Hands a buffer array over as an output array: moved when both use the
+// default allocator, copied into the output's memory otherwise
+template<typename T>
+void take_array(std::vector<T>& from, std::vector<T>& to) {
+    to = std::move(from);
+}
+
+template<typename From, typename To>
+void take_array(From& from, To& to) {
+    to.assign(from.begin(), from.end());
+    release_vector(from);
+}
+
+inline void take_array(NoValues&, NoValues&) {}
+
+// Tracks the bytes held by the reader's large buffers, as reported through
+// LoadStats::peak_bytes.
+class MemoryTracker {
+public:
+    MemoryTracker() : current(0), peak(0) {}
+    void allocate(size_t bytes) {
+        current += bytes;
+        peak = std::max(peak, current);
+    }
+    void release(size_t bytes) {
+        current -= std::min(current, bytes);
+    }
+    size_t peak_bytes() const {
+        return peak;
+    }
+private:
+    size_t current;
+    size_t peak;
+};
+
+inline double& phase_seconds(LoadStats& stats, LoadPhase phase) {
+    switch (phase) {
+    case LoadPhase::HEADER: return stats.header_seconds;
+    case LoadPhase::PARSE: return stats.parse_seconds;
+    case LoadPhase::CONVERT: return stats.convert_seconds;
+    case LoadPhase::ASSEMBLE: return stats.assemble_seconds;
+    default: return stats.total_seconds;
+    }
+}
+
+// Adds the wall time of its scope to `seconds`, or to the LoadStats field of
+// a phase and then reports it to LoadOptions::on_phase
+class PhaseTimer {
+public:
+    explicit PhaseTimer(double& seconds)
+        : seconds(seconds), phase(LoadPhase::TOTAL), observer(nullptr),
+          start(std::chrono::steady_clock::now()) {}
+    PhaseTimer(LoadStats& stats, LoadPhase phase, const LoadOptions& options)
+        : seconds(phase_seconds(stats, phase)), phase(phase),
+          observer(options.on_phase ? &options.on_phase : nullptr),
+          start(std::chrono::steady_clock::now()) {}
+    ~PhaseTimer() {
+        const double elapsed = std::chrono::duration<double>(std::chrono::steady_clock::now() - start).count();
+        seconds += elapsed;
+        if (observer != nullptr) {
+            (*observer)(phase, elapsed);
+        }
+    }
+    PhaseTimer(const PhaseTimer&) = delete;
+    PhaseTimer& operator=(const PhaseTimer&) = delete;
+private:
+    double& seconds;
+    LoadPhase phase;
+    const std::function<void(LoadPhase, double)>* observer;
+    std::chrono::steady_clock::time_point start;
+};
+
+///////////////////////////////////////////////////////////////////////////////
+// Entry parsing
+///////////////////////////////////////////////////////////////////////////////
+
+// Exact upper bound on the COO entries produced by `num_lines` entry lines
+template<typename CoordType>
+size_t max_entries(const Header<CoordType>& header, size_t num_lines) {
+    return header.symmetry != SymmetryType::GENERAL ? 2 * num_lines : num_lines;
+}
+
+// Bounds-checks one entry and converts it to 0-indexing
+template<typename CoordType>
+void check_and_rebase(const Header<CoordType>& header, CoordType& row, CoordType& col) {
+    if (row < 1 || row > header.num_rows) {
+        throw std::invalid_argument("Bad Matrix: row out of bounds");
+    }
+
+    if (col < 1 || col > header.num_cols) {
+        throw std::invalid_argument("Bad Matrix: col out of bounds");
+    }
+
+    // Fix the 1-indexing
+    row--;
+    col--;
+}
+
+template<typename NumType>
+NumType negate_value(const NumType& value) {
+    return -value;
+}
+
+inline NoValue negate_value(NoValue value) {
+    return value;
+}
+
+template<typename NumType>
+NumType conjugate_value(const NumType& value) {
+    return value;
+}
+
+template<typename NumType>
+std::complex<NumType> conjugate_value(const std::complex<NumType>& value) {
+    return std::conj(value);
+}
+
+// The value of the mirrored entry (col, row) of a stored entry (row, col)
+template<SymmetryType Symmetry, typename NumType>
+NumType mirror_value(const NumType& value) {
+    return Symmetry == SymmetryType::SKEW_SYMMETRIC ? negate_value(value)
+         : Symmetry == SymmetryType::HERMITIAN ? conjugate_value(value)
+         : value;
+}
+
+template<typename NumType>
+NumType mirror_value(SymmetryType symmetry, const NumType& value) {
+    return symmetry == SymmetryType::SKEW_SYMMETRIC ? negate_value(value)
+         : symmetry == SymmetryType::HERMITIAN ? conjugate_value(value)
+         : value;
+}
+
+// Stores the 0-based entry (and its mirror for symmetric, skew-symmetric and
+// hermitian matrices) at position `count` of the COO buffer, which must
+// already be large enough. Returns the new number of entries.
+template<SymmetryType Symmetry, typename CoordType, typename ValueType>
+size_t store_nonzero_as(CoordType row, CoordType col, const typename ValueTraits<ValueType>::value_type& value,
+                        CooBuffer<CoordType,ValueType>& coo, size_t count) {
+    coo.rows[count] = row;
+    coo.cols[count] = col;
+    coo.values[count] = value;
+    count++;
+    if (Symmetry != SymmetryType::GENERAL && row != col) {
+        coo.rows[count] = col;
+        coo.cols[count] = row;
+        coo.values[count] = mirror_value<Symmetry>(value);
+        count++;
+    }
+    return count;
+}
+
+// Bounds-checks one entry, converts it to 0-indexing and stores it
+template<SymmetryType Symmetry, typename CoordType, typename ValueType>
+size_t add_nonzero_as(const Header<CoordType>& header, CoordType row, CoordType col,
+                      const typename ValueTraits<ValueType>::value_type& value,
+                      CooBuffer<CoordType,ValueType>& coo, size_t count) {
+    check_and_rebase(header, row, col);
+    return store_nonzero_as<Symmetry>(row, col, value, coo, count);
+}
+
+// Converts an index to 0-indexing without checking it. Out-of-range values
+// end up at or past the dimension when read as unsigned.
+template<typename CoordType>
+CoordType rebase_unchecked(CoordType index) {
+    typedef typename std::make_unsigned<CoordType>::type UnsignedType;
+    return static_cast<CoordType>(static_cast<UnsignedType>(index) - 1);
+}
+
+// Which bound a 1-based entry breaks, if any (`valid` is set otherwise)
+template<typename CoordType>
+EntryErrorCode entry_bounds_error(const Header<CoordType>& header, CoordType row, CoordType col, bool& valid) {
+    valid = false;
+    if (row < 1 || row > header.num_rows) {
+        return EntryErrorCode::ROW_OUT_OF_BOUNDS;
+    }
+    if (col < 1 || col > header.num_cols) {
+        return EntryErrorCode::COL_OUT_OF_BOUNDS;
+    }
+    valid = true;
+    return EntryErrorCode::ILL_SHAPED_LINE;
+}
+
+// Where the parsers record bad lines under ValidationMode::COLLECT. Line i
+// of a parse call is file line first_line + i (or 0 when first_line is 0),
+// and position `origin` of the text is at byte origin_offset of the input.
+struct ErrorSink {
+    const char* origin;
+    uint64_t origin_offset;
+    uint64_t first_line;
+    std::vector<EntryError> errors;
+
+    ErrorSink() : origin(nullptr), origin_offset(0), first_line(0) {}
+
+    void add(EntryErrorCode code, size_t line, const char* pos) {
+        errors.push_back(EntryError{ code, first_line != 0 ? first_line + line : 0,
+                                     origin_offset + static_cast<uint64_t>(pos - origin) });
+    }
+};
+
+template<typename CoordType, typename ValueType>
+size_t add_nonzero(const Header<CoordType>& header, CoordType row, CoordType col,
+                   const typename ValueTraits<ValueType>::value_type& value,
+                   CooBuffer<CoordType,ValueType>& coo, size_t count) {
+    switch (header.symmetry) {
+    case SymmetryType::SYMMETRIC:
+        return add_nonzero_as<SymmetryType::SYMMETRIC>(header, row, col, value, coo, count);
+    case SymmetryType::SKEW_SYMMETRIC:
+        return add_nonzero_as<SymmetryType::SKEW_SYMMETRIC>(header, row, col, value, coo, count);
+    case SymmetryType::HERMITIAN:
+        return add_nonzero_as<SymmetryType::HERMITIAN>(header, row, col, value, coo, count);
+    default:
+        return add_nonzero_as<SymmetryType::GENERAL>(header, row, col, value, coo, count);
+    }
+}
+
+// End of [begin, end) with any trailing white space cut off
+inline const char* trim_trailing_space(const char* begin, const char* end) {
+    while (end != begin && std::isspace(static_cast<unsigned char>(end[-1]))) {
+        --end;
+    }
+    return end;
+}
+
+// Every reader rejects entry lines past the declared count; blank space
+// after the last entry is fine
+inline void check_no_more_entries(const char* pos, const char* end) {
+    if (trim_trailing_space(pos, end) != pos) {
+        throw std::invalid_argument("Bad Matrix: more nonzeros than declared");
+    }
+}
+
+inline void check_no_more_entries(std::istream& in) {
+    std::string line;
+    while (std::getline(in, line)) {
+        check_no_more_entries(line.data(), line.data() + line.size());
+    }
+}
+
+template<typename CoordType, typename ValueType>
+size_t read_entries(std::ifstream& infile, const Header<CoordType>& header,
+                    CooBuffer<CoordType,ValueType>& coo) {
+    size_t count = 0;
+    for (size_t i = 0; i < header.num_nonzeros; i++) {
+        std::string line;
+        if (!std::getline(infile, line)) {
+            throw std::invalid_argument("Bad Matrix: fewer nonzeros than declared");
+        }
+        auto tokens = Tokens(line);
+
+        if (header.value_type == ValueFormat::PATTERN && tokens.size() != 2) {
+            throw std::invalid_argument("Bad Matrix: ill-shaped pattern line");
+        } else if (header.value_type == ValueFormat::COMPLEX && tokens.size() != 4) {
+            throw std::invalid_argument("Bad Matrix: ill-shaped value line");
+        } else if (header.value_type != ValueFormat::PATTERN && header.value_type != ValueFormat::COMPLEX &&
+                   tokens.size() != 3) {
+            throw std::invalid_argument("Bad Matrix: ill-shaped value line");
+        }
+
+        const char* ill_shaped = header.value_type == ValueFormat::PATTERN ? "Bad Matrix: ill-shaped pattern line"
+                                                                            : "Bad Matrix: ill-shaped value line";
+        auto row = parse_coord<CoordType>(tokens.pop(), ill_shaped);
+        auto col = parse_coord<CoordType>(tokens.pop(), ill_shaped);
+        typename ValueTraits<ValueType>::value_type value{};
+        if (header.value_type == ValueFormat::PATTERN) {
+            set_pattern_value(value);
+        } else if (header.value_type == ValueFormat::COMPLEX) {
+            auto real = tokens.pop();
+            auto imag = tokens.pop();
+            parse_complex_value(real, imag, value);
+        } else {
+            parse_value(tokens.pop(), value);
+        }
+
+        count = add_nonzero(header, row, col, value, coo, count);
+    }
+    check_no_more_entries(infile);
+    return count;
+}
+
+// Parses the value (or, for COMPLEX, the two values) that follows `pos`.
+// Returns false if there is none.
+template<ValueFormat Format, typename ValueType>
+bool scan_value_field(const char*& pos, const char* end, ValueType& value) {
+    if (Format == ValueFormat::PATTERN) {
+        set_pattern_value(value);
+        return true;
+    }
+    skip_blanks(pos, end);
+    return Format == ValueFormat::COMPLEX ? parse_complex_inplace(pos, end, value)
+                                          : parse_num_inplace(pos, end, value);
+}
+
+template<ValueFormat Format, typename ValueType>
+void parse_value_field(const char*& pos, const char* end, ValueType& value, const char* ill_shaped) {
+    if (!scan_value_field<Format>(pos, end, value)) {
+        throw std::invalid_argument(ill_shaped);
+    }
+}
+
+// Checks that nothing but blanks is left on the line and moves `pos` to the
+// start of the next one. Returns false otherwise.
+inline bool scan_line_end(const char*& pos, const char* end) {
+    skip_blanks(pos, end);
+    if (pos != end && *pos == '\r') {
+        ++pos;
+    }
+    if (pos != end) {
+        if (*pos != '\n') {
+            return false;
+        }
+        ++pos;
+    }
+    return true;
+}
+
+inline void finish_line(const char*& pos, const char* end, const char* ill_shaped) {
+    if (!scan_line_end(pos, end)) {
+        throw std::invalid_argument(ill_shaped);
+    }
+}
+
+// Parses one entry line starting at `pos` in place. On success `pos` is left
+// at the start of the next line; otherwise it is somewhere on the line and
+// false is returned.
+// REAL and INTEGER values parse alike, so they share instantiations.
+template<ValueFormat Format, typename CoordType, typename ValueType>
+bool scan_entry_line_as(const char*& pos, const char* end, CoordType& row, CoordType& col, ValueType& value) {
+    skip_blanks(pos, end);
+    return parse_coordinates_inplace(pos, end, row, col) && scan_value_field<Format>(pos, end, value) &&
+           scan_line_end(pos, end);
+}
+
+template<ValueFormat Format, typename CoordType, typename ValueType>
+void parse_entry_line_as(const char*& pos, const char* end, CoordType& row, CoordType& col, ValueType& value) {
+    if (!scan_entry_line_as<Format>(pos, end, row, col, value)) {
+        throw std::invalid_argument(Format == ValueFormat::PATTERN ? "Bad Matrix: ill-shaped pattern line"
+                                                                   : "Bad Matrix: ill-shaped value line");
+    }
+}
+
+template<typename CoordType, typename ValueType>
+void parse_entry_line(const char*& pos, const char* end, const Header<CoordType>& header,
+                      CoordType& row, CoordType& col, ValueType& value) {
+    switch (header.value_type) {
+    case ValueFormat::PATTERN:
+        return parse_entry_line_as<ValueFormat::PATTERN>(pos, end, row, col, value);
+    case ValueFormat::COMPLEX:
+        return parse_entry_line_as<ValueFormat::COMPLEX>(pos, end, row, col, value);
+    default:
+        return parse_entry_line_as<ValueFormat::REAL>(pos, end, row, col, value);
+    }
+}
+
+// read_entries for ValidationMode::COLLECT: lines that don't parse or are
+// out of bounds are recorded in `sink` and skipped. The entry section starts
+// at byte `offset` of the file.
+template<typename CoordType, typename ValueType>
+size_t read_entries_collect(std::ifstream& infile, const Header<CoordType>& header,
+                            CooBuffer<CoordType,ValueType>& coo, ErrorSink& sink, uint64_t offset) {
+    size_t count = 0;
+    std::string line;
+    for (size_t i = 0; i < header.num_nonzeros; i++) {
+        if (!std::getline(infile, line)) {
+            throw std::invalid_argument("Bad Matrix: fewer nonzeros than declared");
+        }
+        const char* begin = line.data();
+        const char* pos = begin;
+        const char* end = begin + line.size();
+        CoordType row, col;
+        typename ValueTraits<ValueType>::value_type value{};
+        bool valid;
+        switch (header.value_type) {
+        case ValueFormat::PATTERN:
+            valid = scan_entry_line_as<ValueFormat::PATTERN>(pos, end, row, col, value);
+            break;
+        case ValueFormat::COMPLEX:
+            valid = scan_entry_line_as<ValueFormat::COMPLEX>(pos, end, row, col, value);
+            break;
+        default:
+            valid = scan_entry_line_as<ValueFormat::REAL>(pos, end, row, col, value);
+            break;
+        }
+        const EntryErrorCode code = valid ? entry_bounds_error(header, row, col, valid)
+                                          : EntryErrorCode::ILL_SHAPED_LINE;
+        sink.origin = begin;
+        sink.origin_offset = offset;
+        if (valid) {
+            count = add_nonzero(header, row, col, value, coo, count);
+        } else {
+            sink.add(code, i, begin);
+        }
+        offset += line.size() + 1;
+    }
+    check_no_more_entries(infile);
+    return count;
+}
+
+template<ValueFormat Format, SymmetryType Symmetry, ValidationMode Mode, typename CoordType, typename ValueType>
+size_t parse_entries_as(const char* pos, const char* end, const Header<CoordType>& header,
+                        size_t num_lines, CooBuffer<CoordType,ValueType>& coo, size_t first, ErrorSink* sink,
+                        const char** stop) {
+    size_t count = first;
+    for (size_t i = 0; i < num_lines; i++) {
+        if (pos == end) {
+            throw std::invalid_argument("Bad Matrix: fewer nonzeros than declared");
+        }
+        CoordType row, col;
+        typename ValueTraits<ValueType>::value_type value{};
+        if (Mode == ValidationMode::COLLECT) {
+            const char* line = pos;
+            bool valid = scan_entry_line_as<Format>(pos, end, row, col, value);
+            EntryErrorCode code = valid ? entry_bounds_error(header, row, col, valid)
+                                        : EntryErrorCode::ILL_SHAPED_LINE;
+            if (!valid) {
+                sink->add(code, i, line);
+                const char* newline = static_cast<const char*>(std::memchr(line, '\n', end - line));
+                pos = newline != nullptr ? newline + 1 : end;
+                continue;
+            }
+            count = store_nonzero_as<Symmetry>(CoordType(row - 1), CoordType(col - 1), value, coo, count);
+        } else if (Mode == ValidationMode::DEFERRED) {
+            parse_entry_line_as<Format>(pos, end, row, col, value);
+            count = store_nonzero_as<Symmetry>(rebase_unchecked(row), rebase_unchecked(col), value, coo, count);
+        } else {
+            parse_entry_line_as<Format>(pos, end, row, col, value);
+            count = add_nonzero_as<Symmetry>(header, row, col, value, coo, count);
+        }
+    }
+    if (stop != nullptr) {
+        *stop = pos;
+    }
+    return count;
+}
+
+template<ValueFormat Format, SymmetryType Symmetry, typename CoordType, typename ValueType>
+size_t parse_entries_symmetry(const char* pos, const char* end, const Header<CoordType>& header,
+                              size_t num_lines, CooBuffer<CoordType,ValueType>& coo, size_t first,
+                              ValidationMode mode, ErrorSink* sink, const char** stop) {
+    switch (mode) {
+    case ValidationMode::DEFERRED:
+        return parse_entries_as<Format, Symmetry, ValidationMode::DEFERRED>(pos, end, header, num_lines, coo,
+                                                                            first, sink, stop);
+    case ValidationMode::COLLECT:
+        return parse_entries_as<Format, Symmetry, ValidationMode::COLLECT>(pos, end, header, num_lines, coo,
+                                                                           first, sink, stop);
+    default:
+        return parse_entries_as<Format, Symmetry, ValidationMode::STRICT>(pos, end, header, num_lines, coo,
+                                                                          first, sink, stop);
+    }
+}
+
+template<ValueFormat Format, typename CoordType, typename ValueType>
+size_t parse_entries_format(const char* pos, const char* end, const Header<CoordType>& header,
+                            size_t num_lines, CooBuffer<CoordType,ValueType>& coo, size_t first,
+                            ValidationMode mode, ErrorSink* sink, const char** stop) {
+    switch (header.symmetry) {
+    case SymmetryType::SYMMETRIC:
+        return parse_entries_symmetry<Format, SymmetryType::SYMMETRIC>(pos, end, header, num_lines, coo, first,
+                                                                       mode, sink, stop);
+    case SymmetryType::SKEW_SYMMETRIC:
+        return parse_entries_symmetry<Format, SymmetryType::SKEW_SYMMETRIC>(pos, end, header, num_lines, coo,
+                                                                            first, mode, sink, stop);
+    case SymmetryType::HERMITIAN:
+        return parse_entries_symmetry<Format, SymmetryType::HERMITIAN>(pos, end, header, num_lines, coo, first,
+                                                                       mode, sink, stop);
+    default:
+        return parse_entries_symmetry<Format, SymmetryType::GENERAL>(pos, end, header, num_lines, coo, first,
+                                                                     mode, sink, stop);
+    }
+}
+
+// Parses `num_lines` entry lines starting at `pos` into the COO buffer from
+// position `first` on. Returns the position after the last entry written,
+// and stores where the parsed lines end in `stop` if given.
+// The value format, symmetry and validation mode are dispatched on once
+// here, so the loop itself is compiled separately for each combination.
+// COLLECT needs a `sink`.
+template<typename CoordType, typename ValueType>
+size_t parse_entries(const char* pos, const char* end, const Header<CoordType>& header,
+                     size_t num_lines, CooBuffer<CoordType,ValueType>& coo, size_t first,
+                     ValidationMode mode = ValidationMode::STRICT, ErrorSink* sink = nullptr,
+                     const char** stop = nullptr) {
+    switch (header.value_type) {
+    case ValueFormat::PATTERN:
+        return parse_entries_format<ValueFormat::PATTERN>(pos, end, header, num_lines, coo, first, mode, sink,
+                                                          stop);
+    case ValueFormat::COMPLEX:
+        return parse_entries_format<ValueFormat::COMPLEX>(pos, end, header, num_lines, coo, first, mode, sink,
+                                                          stop);
+    default:
+        return parse_entries_format<ValueFormat::REAL>(pos, end, header, num_lines, coo, first, mode, sink,
+                                                       stop);
+    }
+}
+
+// Number of lines in [begin, end), counting a final unterminated line
+inline size_t count_lines(const char* begin, const char* end) {
+    const size_t newlines = count_newlines(begin, end);
+    return begin != end && end[-1] != '\n' ? newlines + 1 : newlines;
+}
+
+// Splits [begin, end) into `num_chunks` pieces of roughly equal size whose
+// boundaries fall just after a newline. Returns num_chunks + 1 boundaries;
+// some chunks may be empty.
+inline std::vector<const char*> split_lines(const char* begin, const char* end, size_t num_chunks) {
+    std::vector<const char*> bounds(num_chunks + 1, end);
+    bounds[0] = begin;
+    const size_t chunk_size = static_cast<size_t>(end - begin) / num_chunks;
+    for (size_t c = 1; c < num_chunks; c++) {
+        const char* pos = std::max(bounds[c - 1], begin + c * chunk_size);
+        if (pos != begin && pos != end && pos[-1] != '\n') {
+            const char* newline = static_cast<const char*>(std::memchr(pos, '\n', end - pos));
+            pos = newline != nullptr ? newline + 1 : end;
+        }
+        bounds[c] = pos;
+    }
+    return bounds;
+}
+
+// Parallel version of parse_entries for the whole entry section. Each thread
+// first counts the lines of its chunk so that it knows how many of the
+// header's num_nonzeros lines fall inside it (trailing blank space is cut
+// off first, so any line past them is an error). That also bounds how many
+// entries each chunk can produce, so every thread parses straight into its
+// own region of the shared COO buffer; regions left partly empty by
+// unmirrored diagonal entries of symmetric matrices are closed up afterwards
+// in file order.
+// Under COLLECT each thread records its own errors, which are then appended
+// to `sink` in file order.
+template<typename CoordType, typename ValueType>
+void parse_entries_parallel(const char* pos, const char* end, const Header<CoordType>& header,
+                            unsigned num_threads, CooBuffer<CoordType,ValueType>& coo,
+                            ValidationMode mode = ValidationMode::STRICT, ErrorSink* sink = nullptr) {
+    end = trim_trailing_space(pos, end);
+    // Don't bother splitting small inputs
+    const size_t min_chunk_bytes = size_t(1) << 16;
+    const size_t max_chunks = std::max<size_t>(1, static_cast<size_t>(end - pos) / min_chunk_bytes);
+    num_threads = static_cast<unsigned>(std::min<size_t>(num_threads, max_chunks));
+
+    auto bounds = split_lines(pos, end, num_threads);
+
+    std::vector<size_t> chunk_lines(num_threads);
+    parallel_for_threads(num_threads, [&](unsigned t) {
+        chunk_lines[t] = count_lines(bounds[t], bounds[t + 1]);
+    });
+
+    size_t lines_before = 0;
+    std::vector<size_t> chunk_limit(num_threads);
+    std::vector<size_t> region(num_threads + 1, 0);
+    for (unsigned t = 0; t < num_threads; t++) {
+        const size_t wanted = static_cast<size_t>(header.num_nonzeros);
+        const size_t remaining = wanted > lines_before ? wanted - lines_before : 0;
+        chunk_limit[t] = std::min(remaining, chunk_lines[t]);
+        region[t + 1] = region[t] + max_entries(header, chunk_limit[t]);
+        lines_before += chunk_lines[t];
+    }
+    if (lines_before < static_cast<size_t>(header.num_nonzeros)) {
+        throw std::invalid_argument("Bad Matrix: fewer nonzeros than declared");
+    }
+    if (lines_before > static_cast<size_t>(header.num_nonzeros)) {
+        throw std::invalid_argument("Bad Matrix: more nonzeros than declared");
+    }
+
+    std::vector<ErrorSink> sinks(mode == ValidationMode::COLLECT ? num_threads : 0);
+    size_t lines_ahead = 0;
+    for (unsigned t = 0; t < sinks.size(); t++) {
+        sinks[t].origin = sink->origin;
+        sinks[t].origin_offset = sink->origin_offset;
+        sinks[t].first_line = sink->first_line != 0 ? sink->first_line + lines_ahead : 0;
+        lines_ahead += chunk_lines[t];
+    }
+
+    coo.resize(region[num_threads]);
+    std::vector<size_t> region_end(num_threads);
+    parallel_for_threads(num_threads, [&](unsigned t) {
+        region_end[t] = parse_entries(bounds[t], bounds[t + 1], header, chunk_limit[t], coo, region[t], mode,
+                                      sinks.empty() ? nullptr : &sinks[t]);
+    });
+    for (const auto& part : sinks) {
+        sink->errors.insert(sink->errors.end(), part.errors.begin(), part.errors.end());
+    }
+
+    size_t count = region_end[0];
+    for (unsigned t = 1; t < num_threads; t++) {
+        if (count != region[t]) {
+            coo.move_down(region[t], region_end[t], count);
+        }
+        count += region_end[t] - region[t];
+    }
+    coo.resize(count);
+}
+
+// The bounds check of ValidationMode::DEFERRED over the parsed entries.
+// Each part is an OR reduction of unsigned comparisons with no early exit,
+// which vectorizes; only if one finds a bad entry is the first one searched
+// for, and reported as STRICT would have.
+template<typename CoordType, typename ValueType>
+void check_deferred_bounds(const CooBuffer<CoordType,ValueType>& coo, const Header<CoordType>& header,
+                           unsigned num_threads) {
+    typedef typename std::make_unsigned<CoordType>::type UnsignedType;
+    const UnsignedType num_rows = static_cast<UnsignedType>(header.num_rows);
+    const UnsignedType num_cols = static_cast<UnsignedType>(header.num_cols);
+    const CoordType* rows = coo.rows.data();
+    const CoordType* cols = coo.cols.data();
+    const size_t n = coo.size();
+    num_threads = static_cast<unsigned>(std::max<size_t>(1, std::min<size_t>(num_threads, n >> 16)));
+
+    std::vector<unsigned char> bad(num_threads, 0);
+    parallel_for_threads(num_threads, [&](unsigned t) {
+        const size_t first = n / num_threads * t + std::min<size_t>(t, n % num_threads);
+        const size_t last = n / num_threads * (t + 1) + std::min<size_t>(t + 1, n % num_threads);
+        unsigned char out = 0;
+        for (size_t i = first; i < last; i++) {
+            out |= static_cast<unsigned char>(static_cast<UnsignedType>(rows[i]) >= num_rows) |
+                   static_cast<unsigned char>(static_cast<UnsignedType>(cols[i]) >= num_cols);
+        }
+        bad[t] = out;
+    });
+    if (std::find(bad.begin(), bad.end(), 1) == bad.end()) {
+        return;
+    }
+    for (size_t i = 0; i < n; i++) {
+        if (static_cast<UnsignedType>(rows[i]) >= num_rows) {
+            throw std::invalid_argument("Bad Matrix: row out of bounds");
+        }
+        if (static_cast<UnsignedType>(cols[i]) >= num_cols) {
+            throw std::invalid_argument("Bad Matrix: col out of bounds");
+        }
+    }
+}
+
+// Runs the deferred bounds check, or hands the collected errors over to
+// LoadOptions::errors
+template<typename CoordType, typename ValueType>
+void finish_validation(const CooBuffer<CoordType,ValueType>& coo, const Header<CoordType>& header,
+                       const LoadOptions& options, ErrorSink& sink) {
+    if (options.validation == ValidationMode::DEFERRED) {
+        check_deferred_bounds(coo, header,
+                              options.mode == LoadMode::PARALLEL ? resolve_num_threads(options.num_threads) : 1);
+    } else if (options.validation == ValidationMode::COLLECT && options.errors != nullptr) {
+        *options.errors = std::move(sink.errors);
+    }
+}
+
+// File line of the first entry line: after the banner, comments and size line
+template<typename CoordType>
+uint64_t first_entry_line(const Header<CoordType>& header) {
+    return static_cast<uint64_t>(header.num_comment_lines) + 3;
+}
+
+///////////////////////////////////////////////////////////////////////////////
+// Streaming entries
+///////////////////////////////////////////////////////////////////////////////
+
+template<typename CoordType, typename ValueType>
+class EntryReader {
+public:
+    static_assert(std::is_integral<CoordType>::value, "CoordType must be integral");
+    static_assert(std::is_arithmetic<ValueType>::value || is_complex<ValueType>::value,
+                  "ValueType must be arithmetic or std::complex");
+
+    explicit EntryReader(const char* filename, bool expand_symmetric = false)
+        : file(filename), pos(file.begin()), released(file.begin()), lines_left(0),
+          expand_symmetric(expand_symmetric), has_mirror(false) {
+        file_header = read_header<CoordType>(pos, file.end());
+        lines_left = static_cast<size_t>(file_header.num_nonzeros);
+    }
+
+    const Header<CoordType>& header() const {
+        return file_header;
+    }
+
+    // Stores the next entry and returns true, or returns false at the end
+    bool next(Entry<CoordType,ValueType>& entry) {
+        if (has_mirror) {
+            entry = mirror;
+            has_mirror = false;
+            return true;
+        }
+        if (lines_left == 0) {
+            check_no_more_entries(pos, file.end());
+            return false;
+        }
+        if (pos == file.end()) {
+            throw std::invalid_argument("Bad Matrix: fewer nonzeros than declared");
+        }
+        parse_entry_line(pos, file.end(), file_header, entry.row, entry.col, entry.value);
+        check_and_rebase(file_header, entry.row, entry.col);
+        lines_left--;
+
+        if (expand_symmetric && file_header.symmetry != SymmetryType::GENERAL && entry.row != entry.col) {
+            mirror = Entry<CoordType,ValueType>{entry.col, entry.row,
+                                                mirror_value(file_header.symmetry, entry.value)};
+            has_mirror = true;
+        }
+        if (static_cast<size_t>(pos - released) >= release_interval) {
+            file.release_before(pos);
+            released = pos;
+        }
+        return true;
+    }
+
+    class iterator {
+    public:
+        using iterator_category = std::input_iterator_tag;
+        using value_type = Entry<CoordType,ValueType>;
+        using difference_type = std::ptrdiff_t;
+        using pointer = const value_type*;
+        using reference = const value_type&;
+
+        iterator() : reader(nullptr) {}
+        explicit iterator(EntryReader* reader) : reader(reader) {
+            ++*this;
+        }
+        reference operator*() const { return current; }
+        pointer operator->() const { return &current; }
+        iterator& operator++() {
+            if (!reader->next(current)) {
+                reader = nullptr;
+            }
+            return *this;
+        }
+        bool operator==(const iterator& other) const { return reader == other.reader; }
+        bool operator!=(const iterator& other) const { return reader != other.reader; }
+    private:
+        EntryReader* reader;
+        value_type current;
+    };
+
+    // Single pass: begin() continues from wherever next() left off
+    iterator begin() { return iterator(this); }
+    iterator end() { return iterator(); }
+
+private:
+    static const size_t release_interval = size_t(64) << 20;
+
+    MappedFile file;
+    Header<CoordType> file_header;
+    const char* pos;
+    const char* released;
+    size_t lines_left;
+    bool expand_symmetric;
+    bool has_mirror;
+    Entry<CoordType,ValueType> mirror;
+};
+
+template<typename CoordType, typename ValueType, typename Function>
+void for_each_entry(const char* filename, Function f, bool expand_symmetric) {
+    EntryReader<CoordType,ValueType> reader(filename, expand_symmetric);
+    Entry<CoordType,ValueType> entry;
+    while (reader.next(entry)) {
+        f(entry.row, entry.col, entry.value);
+    }
+}
+
+///////////////////////////////////////////////////////////////////////////////
+// Compressed input
+///////////////////////////////////////////////////////////////////////////////
+
+// gzip, zstd and xz inputs are recognized by their magic bytes. Support for
+// each is compiled in with MATRIXMARKET_WITH_ZLIB, MATRIXMARKET_WITH_ZSTD and
+// MATRIXMARKET_WITH_LZMA (linking -lz, -lzstd and -llzma respectively).
+enum class Compression { NONE, GZIP, ZSTD, XZ };
+
+inline Compression detect_compression(const char* data, size_t size) {
+    const unsigned char* bytes = reinterpret_cast<const unsigned char*>(data);
+    if (size >= 2 && bytes[0] == 0x1f && bytes[1] == 0x8b) {
+        return Compression::GZIP;
+    }
+    if (size >= 4 && bytes[0] == 0x28 && bytes[1] == 0xb5 && bytes[2] == 0x2f && bytes[3] == 0xfd) {
+        return Compression::ZSTD;
+    }
+    if (size >= 6 && bytes[0] == 0xfd && std::memcmp(bytes + 1, "7zXZ", 4) == 0 && bytes[5] == 0x00) {
+        return Compression::XZ;
+    }
+    return Compression::NONE;
+}
+
+inline Compression detect_compression(const char* filename) {
+    char magic[6];
+    size_t size = 0;
+    FILE* f = std::fopen(filename, "rb");
+    if (f != nullptr) {
+        size = std::fread(magic, 1, sizeof(magic), f);
+        std::fclose(f);
+    }
+    return detect_compression(magic, size);
+}
+
+#ifdef MATRIXMARKET_WITH_ZLIB
+// Concatenated gzip members are decoded back to back, as gzip -d does
+class GzipSource : public InputSource {
+public:
+    GzipSource(const char* data, size_t size) : next(data), remaining(size), in_member(true) {
+        std::memset(&stream, 0, sizeof(stream));
+        if (inflateInit2(&stream, 15 + 32) != Z_OK) {
+            throw std::invalid_argument("Bad Compression: could not initialize zlib");
+        }
+    }
+    ~GzipSource() {
+        inflateEnd(&stream);
+    }
+    size_t read(char* out, size_t capacity) {
+        const uInt max_chunk = std::numeric_limits<uInt>::max();
+        stream.next_out = reinterpret_cast<Bytef*>(out);
+        stream.avail_out = static_cast<uInt>(std::min<size_t>(capacity, max_chunk));
+        while (stream.avail_out > 0) {
+            if (stream.avail_in == 0) {
+                if (remaining == 0) {
+                    if (in_member) {
+                        throw std::invalid_argument("Bad Compression: truncated gzip stream");
+                    }
+                    break;
+                }
+                const size_t chunk = std::min<size_t>(remaining, max_chunk);
+                stream.next_in = reinterpret_cast<Bytef*>(const_cast<char*>(next));
+                stream.avail_in = static_cast<uInt>(chunk);
+                next += chunk;
+                remaining -= chunk;
+            }
+            if (!in_member) {
+                inflateReset(&stream);
+                in_member = true;
+            }
+            const int ret = inflate(&stream, Z_NO_FLUSH);
+            if (ret == Z_STREAM_END) {
+                in_member = false;
+            } else if (ret != Z_OK && ret != Z_BUF_ERROR) {
+                throw std::invalid_argument("Bad Compression: corrupt gzip stream");
+            }
+        }
+        return static_cast<size_t>(reinterpret_cast<char*>(stream.next_out) - out);
+    }
+private:
+    z_stream stream;
+    const char* next;
+    size_t remaining;
+    bool in_member;
+};
+#endif
+
+#ifdef MATRIXMARKET_WITH_ZSTD
+class ZstdSource : public InputSource {
+public:
+    ZstdSource(const char* data, size_t size) : context(ZSTD_createDCtx()), last_ret(0) {
+        if (context == nullptr) {
+            throw std::invalid_argument("Bad Compression: could not initialize zstd");
+        }
+        input.src = data;
+        input.size = size;
+        input.pos = 0;
+    }
+    ~ZstdSource() {
+        ZSTD_freeDCtx(context);
+    }
+    size_t read(char* out, size_t capacity) {
+        ZSTD_outBuffer output = { out, capacity, 0 };
+        while (output.pos < output.size) {
+            if (input.pos == input.size && last_ret == 0) {
+                break;
+            }
+            const size_t in_before = input.pos;
+            const size_t out_before = output.pos;
+            last_ret = ZSTD_decompressStream(context, &output, &input);
+            if (ZSTD_isError(last_ret)) {
+                throw std::invalid_argument("Bad Compression: corrupt zstd stream");
+            }
+            if (input.pos == in_before && output.pos == out_before) {
+                throw std::invalid_argument("Bad Compression: truncated zstd stream");
+            }
+        }
+        return output.pos;
+    }
+private:
+    ZSTD_DCtx* context;
+    ZSTD_inBuffer input;
+    size_t last_ret;
+};
+
+// Frame positions and decompressed sizes of a zstd file. Returns false unless
+// every frame records its content size, which is what allows the frames to
+// be decoded independently straight into their place in the output.
+inline bool zstd_frames(const char* data, size_t size, std::vector<size_t>& frame_pos,
+                        std::vector<size_t>& frame_bytes, std::vector<size_t>& content_bytes) {
+    size_t pos = 0;
+    while (pos < size) {
+        const size_t frame_size = ZSTD_findFrameCompressedSize(data + pos, size - pos);
+        const unsigned long long content_size = ZSTD_getFrameContentSize(data + pos, size - pos);
+        if (ZSTD_isError(frame_size) || content_size == ZSTD_CONTENTSIZE_UNKNOWN ||
+            content_size == ZSTD_CONTENTSIZE_ERROR) {
+            return false;
+        }
+        frame_pos.push_back(pos);
+        frame_bytes.push_back(frame_size);
+        content_bytes.push_back(static_cast<size_t>(content_size));
+        pos += frame_size;
+    }
+    return true;
+}
+
+// Decodes a multi-frame zstd file (as written by pzstd or zstd's seekable
+// format) with the frames spread over `num_threads` threads. Returns false,
+// leaving `out` untouched, if the frame sizes aren't all known.
+inline bool zstd_decompress_parallel(const char* data, size_t size, unsigned num_threads,
+                                     std::vector<char>& out) {
+    std::vector<size_t> frame_pos, frame_bytes, content_bytes;
+    if (!zstd_frames(data, size, frame_pos, frame_bytes, content_bytes) || frame_pos.size() < 2) {
+        return false;
+    }
+    std::vector<size_t> out_pos(frame_pos.size() + 1, 0);
+    for (size_t i = 0; i < frame_pos.size(); i++) {
+        out_pos[i + 1] = out_pos[i] + content_bytes[i];
+    }
+    out.resize(out_pos.back());
+    num_threads = static_cast<unsigned>(std::min<size_t>(num_threads, frame_pos.size()));
+    parallel_for_threads(num_threads, [&](unsigned t) {
+        ZSTD_DCtx* context = ZSTD_createDCtx();
+        if (context == nullptr) {
+            throw std::invalid_argument("Bad Compression: could not initialize zstd");
+        }
+        for (size_t i = t; i < frame_pos.size(); i += num_threads) {
+            const size_t ret = ZSTD_decompressDCtx(context, out.data() + out_pos[i], content_bytes[i],
+                                                   data + frame_pos[i], frame_bytes[i]);
+            if (ZSTD_isError(ret) || ret != content_bytes[i]) {
+                ZSTD_freeDCtx(context);
+                throw std::invalid_argument("Bad Compression: corrupt zstd frame");
+            }
+        }
+        ZSTD_freeDCtx(context);
+    });
+    return true;
+}
+#endif
+
+#ifdef MATRIXMARKET_WITH_LZMA
+// Concatenated xz streams are decoded back to back, as xz -d does
+class XzSource : public InputSource {
+public:
+    XzSource(const char* data, size_t size) : finished(false) {
+        lzma_stream init = LZMA_STREAM_INIT;
+        stream = init;
+        if (lzma_stream_decoder(&stream, UINT64_MAX, LZMA_CONCATENATED) != LZMA_OK) {
+            throw std::invalid_argument("Bad Compression: could not initialize lzma");
+        }
+        stream.next_in = reinterpret_cast<const uint8_t*>(data);
+        stream.avail_in = size;
+    }
+    ~XzSource() {
+        lzma_end(&stream);
+    }
+    size_t read(char* out, size_t capacity) {
+        stream.next_out = reinterpret_cast<uint8_t*>(out);
+        stream.avail_out = capacity;
+        while (stream.avail_out > 0 && !finished) {
+            const lzma_ret ret = lzma_code(&stream, stream.avail_in == 0 ? LZMA_FINISH : LZMA_RUN);
+            if (ret == LZMA_STREAM_END) {
+                finished = true;
+            } else if (ret == LZMA_BUF_ERROR) {
+                throw std::invalid_argument("Bad Compression: truncated xz stream");
+            } else if (ret != LZMA_OK) {
+                throw std::invalid_argument("Bad Compression: corrupt xz stream");
+            }
+        }
+        return static_cast<size_t>(reinterpret_cast<char*>(stream.next_out) - out);
+    }
+private:
+    lzma_stream stream;
+    bool finished;
+};
+#endif
+
+// Decompressor for `data`, or an exception if that format wasn't compiled in
+inline std::unique_ptr<InputSource> make_decompressor(Compression compression, const char* data, size_t size) {
+    switch (compression) {
+#ifdef MATRIXMARKET_WITH_ZLIB
+    case Compression::GZIP:
+        return std::unique_ptr<InputSource>(new GzipSource(data, size));
+#endif
+#ifdef MATRIXMARKET_WITH_ZSTD
+    case Compression::ZSTD:
+        return std::unique_ptr<InputSource>(new ZstdSource(data, size));
+#endif
+#ifdef MATRIXMARKET_WITH_LZMA
+    case Compression::XZ:
+        return std::unique_ptr<InputSource>(new XzSource(data, size));
+#endif
+    default:
+        break;
+    }
+    (void)data;
+    (void)size;
+    switch (compression) {
+    case Compression::GZIP:
+        throw std::invalid_argument("gzip input requires MATRIXMARKET_WITH_ZLIB");
+    case Compression::ZSTD:
+        throw std::invalid_argument("zstd input requires MATRIXMARKET_WITH_ZSTD");
+    case Compression::XZ:
+        throw std::invalid_argument("xz input requires MATRIXMARKET_WITH_LZMA");
+    default:
+        throw std::invalid_argument("Input is not compressed");
+    }
+}
+
+// Decompresses the whole of `data` into memory
+inline std::vector<char> decompress_all(Compression compression, const char* data, size_t size) {
+    auto source = make_decompressor(compression, data, size);
+    const size_t min_free = size_t(1) << 20;
+    std::vector<char> out;
+    size_t filled = 0;
+    for (;;) {
+        if (out.size() - filled < min_free) {
+            out.resize(std::max(2 * out.size(), size_t(4) << 20));
+        }
+        const size_t n = source->read(out.data() + filled, out.size() - filled);
+        if (n == 0) {
+            break;
+        }
+        filled += n;
+    }
+    out.resize(filled);
+    return out;
+}
+
+///////////////////////////////////////////////////////////////////////////////
+// Utility BlockPipeline class
+///////////////////////////////////////////////////////////////////////////////
+
+// Pulls fixed-size blocks from an InputSource on a background thread, a
+// bounded number of blocks ahead of the consumer, so that producing the
+// bytes (e.g. decompressing) overlaps with parsing them. An exception thrown
+// by the source is rethrown from next().
+class BlockPipeline {
+public:
+    BlockPipeline(InputSource& source, size_t block_size = size_t(4) << 20, size_t max_blocks = 4)
+        : source(source), block_size(block_size), max_blocks(max_blocks), done(false), stopping(false) {
+        producer = std::thread([this]() { produce(); });
+    }
+    ~BlockPipeline() {
+        {
+            std::lock_guard<std::mutex> lock(mutex);
+            stopping = true;
+        }
+        changed.notify_all();
+        producer.join();
+    }
+    BlockPipeline(const BlockPipeline&) = delete;
+    BlockPipeline& operator=(const BlockPipeline&) = delete;
+
+    // Appends the next block to `out`; returns false at the end of the stream
+    bool next(std::vector<char>& out) {
+        std::unique_lock<std::mutex> lock(mutex);
+        changed.wait(lock, [this]() { return !blocks.empty() || done; });
+        if (blocks.empty()) {
+            if (error) {
+                std::rethrow_exception(error);
+            }
+            return false;
+        }
+        std::vector<char> block = std::move(blocks.front());
+        blocks.pop_front();
+        lock.unlock();
+        changed.notify_all();
+        out.insert(out.end(), block.begin(), block.end());
+        return true;
+    }
+
+private:
+    void produce() {
+        try {
+            while (true) {
+                std::vector<char> block(block_size);
+                size_t filled = 0;
+                while (filled < block_size) {
+                    const size_t n = source.read(block.data() + filled, block_size - filled);
+                    if (n == 0) {
+                        break;
+                    }
+                    filled += n;
+                }
+                if (filled == 0) {
+                    break;
+                }
+                block.resize(filled);
+                std::unique_lock<std::mutex> lock(mutex);
+                changed.wait(lock, [this]() { return blocks.size() < max_blocks || stopping; });
+                if (stopping) {
+                    return;
+                }
+                blocks.push_back(std::move(block));
+                lock.unlock();
+                changed.notify_all();
+            }
+        } catch (...) {
+            std::lock_guard<std::mutex> lock(mutex);
+            error = std::current_exception();
+        }
+        {
+            std::lock_guard<std::mutex> lock(mutex);
+            done = true;
+        }
+        changed.notify_all();
+    }
+
+    InputSource& source;
+    const size_t block_size;
+    const size_t max_blocks;
+    std::mutex mutex;
+    std::condition_variable changed;
+    std::deque<std::vector<char>> blocks;
+    std::exception_ptr error;
+    bool done;
+    bool stopping;
+    std::thread producer;
+};
+
+///////////////////////////////////////////////////////////////////////////////
+// Block-wise parsing
+///////////////////////////////////////////////////////////////////////////////
+
+// End of the header (banner, comments and size line) in [begin, end), or
+// nullptr if the size line isn't complete yet
+inline const char* find_header_end(const char* begin, const char* end) {
+    const char* pos = begin;
+    bool banner = true;
+    while (pos != end) {
+        const char* newline = static_cast<const char*>(std::memchr(pos, '\n', end - pos));
+        if (newline == nullptr) {
+            return nullptr;
+        }
+        if (!banner && *pos != '%') {
+            return newline + 1;
+        }
+        banner = false;
+        pos = newline + 1;
+    }
+    return nullptr;
+}
+
+// The start of the stream up to at least the end of the header (or all of
+// it, if shorter), read in steps that double from 4 KB. `header_end` is left
+// null if the header doesn't end.
+inline std::vector<char> read_header_prefix(InputSource& source, const char*& header_end) {
+    std::vector<char> buffer;
+    header_end = nullptr;
+    size_t step = size_t(4) << 10;
+    while (header_end == nullptr) {
+        const size_t size = buffer.size();
+        buffer.resize(size + step);
+        const size_t n = source.read(buffer.data() + size, step);
+        buffer.resize(size + n);
+        header_end = find_header_end(buffer.data(), buffer.data() + buffer.size());
+        if (n == 0) {
+            break;
+        }
+        step = std::min(2 * step, size_t(1) << 20);
+    }
+    return buffer;
+}
+
+// Position just past the last newline in [begin, end), or begin if none
+inline const char* after_last_newline(const char* begin, const char* end) {
+    for (const char* pos = end; pos != begin; --pos) {
+        if (pos[-1] == '\n') {
+            return pos;
+        }
+    }
+    return begin;
+}
+
+// The header the entries are parsed with. When only one triangle is kept
+// nothing is mirrored while parsing; fold_triangle then moves the entries
+// into the kept triangle.
+template<typename CoordType>
+Header<CoordType> entry_header(Header<CoordType> header, const LoadOptions& options) {
+    if (options.reordering != Reordering::NONE && header.num_rows != header.num_cols) {
+        throw std::invalid_argument("Bad Matrix: reordering needs a square matrix");
+    }
+    if (options.symmetric_storage != SymmetricStorage::EXPAND) {
+        header.symmetry = SymmetryType::GENERAL;
+    }
+    return header;
+}
+
+// Parses an input that arrives in blocks: every complete line of the bytes
+// received so far is parsed as soon as the block arrives, and only the
+// trailing partial line is carried over to the next one.
+template<typename CoordType, typename ValueType>
+Header<CoordType> read_nonzeros_blocks(BlockPipeline& pipeline, const LoadOptions& options,
+                                       CooBuffer<CoordType,ValueType>& coo) {
+    std::vector<char> buffer;
+    bool eof = false;
+    while (!eof && find_header_end(buffer.data(), buffer.data() + buffer.size()) == nullptr) {
+        eof = !pipeline.next(buffer);
+    }
+
+    const char* pos = buffer.data();
+    auto header = read_header<CoordType>(pos, buffer.data() + buffer.size());
+    const auto parse_header = entry_header(header, options);
+    size_t consumed = static_cast<size_t>(pos - buffer.data());
+
+    // Bytes of the input dropped from the front of the buffer
+    uint64_t dropped = 0;
+    ErrorSink sink;
+    size_t lines_left = static_cast<size_t>(header.num_nonzeros);
+    size_t count = 0;
+    coo.resize(max_entries(parse_header, lines_left));
+    while (lines_left > 0) {
+        const char* begin = buffer.data() + consumed;
+        const char* end = buffer.data() + buffer.size();
+        const char* stop = eof ? end : after_last_newline(begin, end);
+        if (stop != begin) {
+            const size_t lines = std::min(count_lines(begin, stop), lines_left);
+            sink.origin = buffer.data();
+            sink.origin_offset = dropped;
+            sink.first_line = first_entry_line(header) + (static_cast<size_t>(header.num_nonzeros) - lines_left);
+            const char* parsed;
+            count = parse_entries(begin, stop, parse_header, lines, coo, count, options.validation, &sink,
+                                  &parsed);
+            lines_left -= lines;
+            consumed = static_cast<size_t>((lines_left == 0 ? parsed : stop) - buffer.data());
+        }
+        if (lines_left == 0) {
+            break;
+        }
+        if (eof) {
+            throw std::invalid_argument("Bad Matrix: fewer nonzeros than declared");
+        }
+        buffer.erase(buffer.begin(), buffer.begin() + consumed);
+        dropped += consumed;
+        consumed = 0;
+        eof = !pipeline.next(buffer);
+    }
+    // The rest of the input, block by block
+    while (true) {
+        check_no_more_entries(buffer.data() + consumed, buffer.data() + buffer.size());
+        if (eof) {
+            break;
+        }
+        buffer.clear();
+        consumed = 0;
+        eof = !pipeline.next(buffer);
+    }
+    coo.resize(count);
+    finish_validation(coo, parse_header, options, sink);
+    return header;
+}
+
+// Reads the header and all of the entries of the in-memory file
+// [begin, end) into "COO format", in parallel for LoadMode::PARALLEL
+template<typename CoordType, typename ValueType>
+Header<CoordType> read_nonzeros_buffer(const char* begin, const char* end, const LoadOptions& options,
+                                       CooBuffer<CoordType,ValueType>& coo, LoadStats& stats) {
+    const char* pos = begin;
+    Header<CoordType> header;
+    {
+        PhaseTimer timer(stats, LoadPhase::HEADER, options);
+        header = read_header<CoordType>(pos, end);
+    }
+    PhaseTimer timer(stats, LoadPhase::PARSE, options);
+    const auto parse_header = entry_header(header, options);
+    const size_t num_lines = static_cast<size_t>(header.num_nonzeros);
+    ErrorSink sink;
+    sink.origin = begin;
+    sink.first_line = first_entry_line(header);
+    if (options.mode == LoadMode::PARALLEL) {
+        parse_entries_parallel(pos, end, parse_header, resolve_num_threads(options.num_threads), coo,
+                               options.validation, &sink);
+    } else {
+        const char* stop;
+        coo.resize(max_entries(parse_header, num_lines));
+        coo.resize(parse_entries(pos, end, parse_header, num_lines, coo, 0, options.validation, &sink, &stop));
+        check_no_more_entries(stop, end);
+    }
+    finish_validation(coo, parse_header, options, sink);
+    return header;
+}
+
+// Compressed files are decompressed on a background thread and parsed block
+// by block as the data arrives. In LoadMode::PARALLEL, zstd files made of
+// independent frames with known sizes are instead decoded frame-parallel
+// into memory and then parsed in parallel.
+template<typename CoordType, typename ValueType>
+Header<CoordType> read_nonzeros_compressed(const char* data, size_t size, Compression compression,
+                                           const LoadOptions& options,
+                                           CooBuffer<CoordType,ValueType>& coo, LoadStats& stats) {
+    stats.bytes_read = size;
+#ifdef MATRIXMARKET_WITH_ZSTD
+    if (compression == Compression::ZSTD && options.mode == LoadMode::PARALLEL) {
+        std::vector<char> decompressed;
+        bool decoded;
+        {
+            PhaseTimer timer(stats, LoadPhase::PARSE, options);
+            decoded = zstd_decompress_parallel(data, size, resolve_num_threads(options.num_threads), decompressed);
+        }
+        if (decoded) {
+            return read_nonzeros_buffer(decompressed.data(), decompressed.data() + decompressed.size(),
+                                        options, coo, stats);
+        }
+    }
+#endif
+    PhaseTimer timer(stats, LoadPhase::PARSE, options);
+    auto source = make_decompressor(compression, data, size);
+    BlockPipeline pipeline(*source);
+    return read_nonzeros_blocks(pipeline, options, coo);
+}
+
+template<typename CoordType, typename ValueType>
+Header<CoordType> read_nonzeros_compressed(const char* filename, Compression compression,
+                                           const LoadOptions& options,
+                                           CooBuffer<CoordType,ValueType>& coo, LoadStats& stats) {
+    std::unique_ptr<MappedFile> file;
+    {
+        PhaseTimer timer(stats, LoadPhase::HEADER, options);
+        file.reset(new MappedFile(filename));
+    }
+    return read_nonzeros_compressed(file->data(), file->size(), compression, options, coo, stats);
+}
+
+// Counts the bytes an InputSource yields
+class CountingSource : public InputSource {
+public:
+    explicit CountingSource(InputSource& source) : source(source), count(0) {}
+    size_t read(char* out, size_t capacity) override {
+        const size_t n = source.read(out, capacity);
+        count += n;
+        return n;
+    }
+    size_t bytes() const { return count; }
+private:
+    InputSource& source;
+    size_t count;
+};
+
+// Where a reader takes its input from: a file, `size` bytes at `data` or
+// an InputSource
+struct LoadInput {
+    const char* filename;
+    const char* data;
+    size_t size;
+    InputSource* source;
+
+    explicit LoadInput(const char* filename) : filename(filename), data(nullptr), size(0), source(nullptr) {}
+    LoadInput(const char* data, size_t size) : filename(nullptr), data(data), size(size), source(nullptr) {}
+    explicit LoadInput(InputSource& source) : filename(nullptr), data(nullptr), size(0), source(&source) {}
+};
+
+// Reads the header and all of the entries of `filename` into "COO format".
+// The buffer is sized once from the header's nonzero count.
+template<typename CoordType, typename ValueType>
+Header<CoordType> read_nonzeros(const char* filename, const LoadOptions& options,
+                                CooBuffer<CoordType,ValueType>& coo, LoadStats& stats) {
+
+    static_assert(std::is_integral<CoordType>::value, "CoordType must be integral");
+    static_assert(std::is_arithmetic<ValueType>::value || is_complex<ValueType>::value ||
+                  std::is_void<ValueType>::value, "ValueType must be arithmetic, std::complex or void");
+
+    const Compression compression = detect_compression(filename);
+    if (compression != Compression::NONE) {
+        return read_nonzeros_compressed(filename, compression, options, coo, stats);
+    }
+
+    if (options.mode == LoadMode::MMAP || options.mode == LoadMode::PARALLEL) {
+        std::unique_ptr<MappedFile> file;
+        {
+            PhaseTimer timer(stats, LoadPhase::HEADER, options);
+            file.reset(new MappedFile(filename));
+        }
+        stats.bytes_read = file->size();
+        return read_nonzeros_buffer(file->begin(), file->end(), options, coo, stats);
+    }
+
+    std::ifstream infile;
+    Header<CoordType> header;
+    {
+        PhaseTimer timer(stats, LoadPhase::HEADER, options);
+        infile.open(filename);
+        if (!infile.is_open()) {
+            throw std::invalid_argument("Could not open file for reading");
+        }
+        header = read_header<CoordType>(infile);
+    }
+
+    PhaseTimer timer(stats, LoadPhase::PARSE, options);
+    const auto parse_header = entry_header(header, options);
+    coo.resize(max_entries(parse_header, static_cast<size_t>(header.num_nonzeros)));
+    if (options.validation == ValidationMode::COLLECT) {
+        ErrorSink sink;
+        sink.first_line = first_entry_line(header);
+        const std::streamoff offset = infile.tellg();
+        coo.resize(read_entries_collect(infile, parse_header, coo, sink, static_cast<uint64_t>(offset)));
+        finish_validation(coo, parse_header, options, sink);
+    } else {
+        coo.resize(read_entries(infile, parse_header, coo));
+    }
+    infile.clear();
+    stats.bytes_read = static_cast<size_t>(std::max<std::streamoff>(0, infile.tellg()));
+    return header;
+}
+
+template<typename CoordType, typename ValueType>
+Header<CoordType> read_nonzeros(const LoadInput& input, const LoadOptions& options,
+                                CooBuffer<CoordType,ValueType>& coo, LoadStats& stats) {
+    if (input.filename != nullptr) {
+        return read_nonzeros(input.filename, options, coo, stats);
+    }
+    if (input.source != nullptr) {
+        PhaseTimer timer(stats, LoadPhase::PARSE, options);
+        CountingSource counted(*input.source);
+        Header<CoordType> header;
+        {
+            BlockPipeline pipeline(counted);
+            header = read_nonzeros_blocks(pipeline, options, coo);
+        }
+        stats.bytes_read = counted.bytes();
+        return header;
+    }
+    const Compression compression = detect_compression(input.data, input.size);
+    if (compression != Compression::NONE) {
+        return read_nonzeros_compressed(input.data, input.size, compression, options, coo, stats);
+    }
+    stats.bytes_read = input.size;
+    return read_nonzeros_buffer(input.data, input.data + input.size, options, coo, stats);
+}
+
+///////////////////////////////////////////////////////////////////////////////
+// COO to compressed conversion
+///////////////////////////////////////////////////////////////////////////////
+
+// The conversion engine shared by read_csr and read_csc. The "major" coordinate
+// is the one being compressed (rows for CSR, columns for CSC) and the "minor"
+// one ends up in the index array.
+
+// Sorts each compressed segment by minor index, carrying the values along.
+// Segments that are already in order are left untouched, and duplicates keep
+// the order they had before.
+template<typename OffsetArray, typename IndexArray, typename ValueArray>
+void sort_segments(const OffsetArray& offsets, size_t first, size_t last,
+                   IndexArray& indices, ValueArray& values) {
+    typedef typename IndexArray::value_type CoordType;
+    typedef typename ValueArray::value_type ValueType;
+    std::vector<std::pair<CoordType,ValueType>> scratch;
+    for (size_t m = first; m < last; m++) {
+        const size_t begin = static_cast<size_t>(offsets[m]);
+        const size_t end = static_cast<size_t>(offsets[m + 1]);
+        if (std::is_sorted(indices.begin() + begin, indices.begin() + end)) {
+            continue;
+        }
+        scratch.clear();
+        for (size_t i = begin; i < end; i++) {
+            scratch.emplace_back(indices[i], values[i]);
+        }
+        std::stable_sort(scratch.begin(), scratch.end(),
+                [](const std::pair<CoordType,ValueType>& a, const std::pair<CoordType,ValueType>& b) {
+            return a.first < b.first;
+        });
+        for (size_t i = begin; i < end; i++) {
+            indices[i] = scratch[i - begin].first;
+            values[i] = scratch[i - begin].second;
+        }
+    }
+}
+
+// Without values only the indices need sorting
+template<typename OffsetArray, typename IndexArray>
+void sort_segments(const OffsetArray& offsets, size_t first, size_t last,
+                   IndexArray& indices, NoValues&) {
+    for (size_t m = first; m < last; m++) {
+        const auto begin = indices.begin() + static_cast<size_t>(offsets[m]);
+        const auto end = indices.begin() + static_cast<size_t>(offsets[m + 1]);
+        if (!std::is_sorted(begin, end)) {
+            std::sort(begin, end);
+        }
+    }
+}
+
+template<typename NumType>
+void accumulate_value(NumType& sum, const NumType& value) {
+    sum += value;
+}
+
+inline void accumulate_value(NoValue&, const NoValue&) {}
+
+// Merges the runs of equal indices of the sorted segment [begin, end) as
+// `policy` says, packing what is left down to `begin`. Returns the number of
+// entries left.
+template<typename IndexArray, typename ValueArray>
+size_t coalesce_segment(size_t begin, size_t end, DuplicatePolicy policy,
+                        IndexArray& indices, ValueArray& values) {
+    size_t out = begin;
+    for (size_t i = begin; i < end; i++) {
+        if (out != begin && indices[out - 1] == indices[i]) {
+            if (policy == DuplicatePolicy::ERROR) {
+                throw std::invalid_argument("Bad Matrix: duplicate entry");
+            } else if (policy == DuplicatePolicy::SUM) {
+                accumulate_value(values[out - 1], values[i]);
+            } else {
+                values[out - 1] = values[i];
+            }
+            continue;
+        }
+        if (out != i) {
+            indices[out] = indices[i];
+            values[out] = values[i];
+        }
+        out++;
+    }
+    return out - begin;
+}
+
+// Sorts the segments by minor index (unless `sorted`) and applies the
+// duplicate policy to them, with the segments divided among `num_threads`
+// threads by entry count. Every thread coalesces its segments within their
+// own space; the segments are then closed up in order and the offsets
+// rewritten. Returns the number of entries merged away.
+template<typename OffsetArray, typename IndexArray, typename ValueArray>
+size_t finish_segments(OffsetArray& offsets, IndexArray& indices,
+                       ValueArray& values, bool sorted, DuplicatePolicy policy, unsigned num_threads) {
+    typedef typename OffsetArray::value_type OffsetType;
+    const size_t num_major = offsets.size() - 1;
+    const size_t nnz = indices.size();
+    if ((sorted && policy == DuplicatePolicy::KEEP) || num_major == 0) {
+        return 0;
+    }
+
+    // Don't bother splitting small matrices
+    const size_t min_thread_entries = size_t(1) << 16;
+    num_threads = static_cast<unsigned>(std::max<size_t>(1,
+        std::min<size_t>(num_threads, nnz / min_thread_entries)));
+    std::vector<size_t> first_segment(num_threads + 1, num_major);
+    first_segment[0] = 0;
+    for (unsigned t = 1; t < num_threads; t++) {
+        const OffsetType split = static_cast<OffsetType>(nnz / num_threads * t);
+        first_segment[t] = static_cast<size_t>(
+            std::lower_bound(offsets.begin(), offsets.end() - 1, split) - offsets.begin());
+    }
+
+    std::vector<OffsetType> kept(policy == DuplicatePolicy::KEEP ? 0 : num_major);
+    parallel_for_threads(num_threads, [&](unsigned t) {
+        if (!sorted) {
+            sort_segments(offsets, first_segment[t], first_segment[t + 1], indices, values);
+        }
+        if (policy != DuplicatePolicy::KEEP) {
+            for (size_t m = first_segment[t]; m < first_segment[t + 1]; m++) {
+                kept[m] = static_cast<OffsetType>(coalesce_segment(static_cast<size_t>(offsets[m]),
+                    static_cast<size_t>(offsets[m + 1]), policy, indices, values));
+            }
+        }
+    });
+    if (policy == DuplicatePolicy::KEEP) {
+        return 0;
+    }
+
+    size_t count = 0;
+    for (size_t m = 0; m < num_major; m++) {
+        const size_t begin = static_cast<size_t>(offsets[m]);
+        const size_t size = static_cast<size_t>(kept[m]);
+        if (count != begin) {
+            copy_within(indices, begin, begin + size, count);
+            copy_within(values, begin, begin + size, count);
+        }
+        offsets[m] = static_cast<OffsetType>(count);
+        count += size;
+    }
+    offsets[num_major] = static_cast<OffsetType>(count);
+    indices.resize(count);
+    values.resize(count);
+    return nnz - count;
+}
+
+// Histogram pass: fills `offsets` with the prefix sum of the entries per
+// major coordinate and returns whether the buffer is already in
+// (major, minor) order.
+template<typename CoordType, typename OffsetArray>
+bool histogram_offsets(const std::vector<CoordType>& major, const std::vector<CoordType>& minor,
+                       CoordType num_major, OffsetArray& offsets) {
+    const size_t nnz = major.size();
+    offsets.assign(static_cast<size_t>(num_major) + 1, 0);
+    bool sorted = true;
+    for (size_t i = 0; i < nnz; i++) {
+        offsets[static_cast<size_t>(major[i]) + 1]++;
+        if (i > 0) {
+            sorted = sorted && (major[i - 1] < major[i] ||
+                (major[i - 1] == major[i] && minor[i - 1] <= minor[i]));
+        }
+    }
+    for (size_t m = 0; m < static_cast<size_t>(num_major); m++) {
+        offsets[m + 1] += offsets[m];
+    }
+    return sorted;
+}
+
+// Boundaries of `num_parts` near-equal ranges covering [0, size), or
+// `given` once checked to hold num_parts + 1 boundaries ascending from 0 to
+// `size`. Throws `error` otherwise.
+inline std::vector<size_t> partition_bounds(const std::vector<size_t>& given, size_t num_parts, size_t size,
+                                            const char* error) {
+    std::vector<size_t> parts = given;
+    if (parts.empty() && num_parts != 0) {
+        for (size_t t = 0; t <= num_parts; t++) {
+            parts.push_back(size / num_parts * t + std::min(t, size % num_parts));
+        }
+    }
+    if (parts.size() != num_parts + 1 || num_parts == 0 || parts.front() != 0 || parts.back() != size ||
+        !std::is_sorted(parts.begin(), parts.end())) {
+        throw std::invalid_argument(error);
+    }
+    return parts;
+}
+
+template<typename OffsetArray, typename IndexArray, typename ValueArray>
+void check_first_touch(const LoadOptions& options) {
+    if (options.first_touch && !(leaves_new_elements_unwritten<OffsetArray>::value &&
+                                 leaves_new_elements_unwritten<IndexArray>::value &&
+                                 leaves_new_elements_unwritten<ValueArray>::value)) {
+        throw std::invalid_argument("first_touch needs an allocator that leaves new elements unwritten");
+    }
+}
+
+// Part boundaries of LoadOptions::first_touch for `num_major` segments
+inline std::vector<size_t> first_touch_parts(const LoadOptions& options, size_t num_major) {
+    const std::vector<size_t>& given = options.first_touch_partition;
+    return partition_bounds(given, given.empty() ? resolve_num_threads(options.num_threads) : given.size() - 1,
+                            num_major, "first_touch_partition must ascend from 0 to the number of segments");
+}
+
+// The scatter of LoadOptions::first_touch. The buffer positions are first
+// bucketed by the part their segment falls in: every thread counts the parts
+// of one slice of the buffer, and after a prefix sum over (part, slice)
+// copies its positions into place. Then every thread takes one part, writes
+// its stretch of the offsets and scatters the entries of its own bucket, so
+// each output page is first written by the thread that owns its segments.
+// Both passes read the buffer once in total. Within a segment entries keep
+// their buffer order, as in the serial scatter.
+template<typename CoordType, typename ValueType, typename OffsetArray, typename IndexArray, typename ValueArray>
+void scatter_first_touch(const CooBuffer<CoordType,ValueType>& coo, bool by_col,
+                         const std::vector<typename OffsetArray::value_type>& counts,
+                         const std::vector<size_t>& parts,
+                         OffsetArray& offsets, IndexArray& indices, ValueArray& values, MemoryTracker& memory) {
+    typedef typename OffsetArray::value_type OffsetType;
+    const std::vector<CoordType>& major = by_col ? coo.cols : coo.rows;
+    const std::vector<CoordType>& minor = by_col ? coo.rows : coo.cols;
+    const size_t nnz = coo.size();
+    const unsigned num_parts = static_cast<unsigned>(parts.size() - 1);
+    // The part of segment m: how many of the inner boundaries are <= m. The
+    // search is branch-free since segments come in random order.
+    const size_t* const bounds = parts.data() + 1;
+    auto part_of = [bounds, num_parts](size_t m) {
+        const size_t* base = bounds;
+        size_t n = num_parts - 1;
+        while (n > 1) {
+            const size_t half = n / 2;
+            base = base[half] <= m ? base + half : base;
+            n -= half;
+        }
+        return static_cast<unsigned>(base - bounds) + (*base <= m ? 1 : 0);
+    };
+
+    // Positions of the entries, grouped by part in buffer order;
+    // bucket_start[p * num_parts + s] is where slice s starts its share of
+    // part p, and bucket_start[p * num_parts] where part p starts
+    std::vector<OffsetType> order;
+    std::vector<size_t> bucket_start;
+    if (num_parts > 1) {
+        order.resize(nnz);
+        bucket_start.assign(static_cast<size_t>(num_parts) * num_parts + 1, 0);
+        memory.allocate(vector_bytes(order) + vector_bytes(bucket_start));
+        auto slice_begin = [&](unsigned s) { return nnz / num_parts * s + std::min<size_t>(s, nnz % num_parts); };
+        parallel_for_threads(num_parts, [&](unsigned s) {
+            std::vector<size_t> count(num_parts, 0);
+            const size_t slice_end = slice_begin(s + 1);
+            for (size_t i = slice_begin(s); i < slice_end; i++) {
+                count[part_of(static_cast<size_t>(major[i]))]++;
+            }
+            for (unsigned p = 0; p < num_parts; p++) {
+                bucket_start[static_cast<size_t>(p) * num_parts + s + 1] = count[p];
+            }
+        });
+        for (size_t b = 1; b < bucket_start.size(); b++) {
+            bucket_start[b] += bucket_start[b - 1];
+        }
+        parallel_for_threads(num_parts, [&](unsigned s) {
+            std::vector<size_t> next(num_parts);
+            for (unsigned p = 0; p < num_parts; p++) {
+                next[p] = bucket_start[static_cast<size_t>(p) * num_parts + s];
+            }
+            const size_t slice_end = slice_begin(s + 1);
+            for (size_t i = slice_begin(s); i < slice_end; i++) {
+                order[next[part_of(static_cast<size_t>(major[i]))]++] = static_cast<OffsetType>(i);
+            }
+        });
+    }
+
+    offsets.resize(counts.size());
+    indices.resize(nnz);
+    values.resize(nnz);
+    memory.allocate(vector_bytes(offsets) + vector_bytes(indices) + vector_bytes(values));
+    parallel_for_threads(num_parts, [&](unsigned t) {
+        if (num_parts > 1) {
+            pin_to_cpu(t);
+        }
+        const size_t first = parts[t];
+        const size_t last = parts[t + 1];
+        std::copy(counts.begin() + first, counts.begin() + last + (t + 1 == num_parts), offsets.begin() + first);
+        if (counts[first] == counts[last]) {
+            return;
+        }
+        std::vector<OffsetType> next(counts.begin() + first, counts.begin() + last);
+        auto place = [&](size_t i) {
+            const size_t dst = static_cast<size_t>(next[static_cast<size_t>(major[i]) - first]++);
+            indices[dst] = minor[i];
+            values[dst] = coo.values[i];
+        };
+        if (num_parts == 1) {
+            for (size_t i = 0; i < nnz; i++) {
+                place(i);
+            }
+        } else {
+            const size_t bucket_end = bucket_start[static_cast<size_t>(t + 1) * num_parts];
+            for (size_t k = bucket_start[static_cast<size_t>(t) * num_parts]; k < bucket_end; k++) {
+                place(static_cast<size_t>(order[k]));
+            }
+        }
+    });
+    memory.release(vector_bytes(order) + vector_bytes(bucket_start));
+}
+
+// Counting sort of the COO buffer on the major coordinate: a histogram pass
+// builds the offsets, a stable scatter places every entry in its segment and
+// only the segments that came out unsorted are sorted by minor index. When
+// the whole buffer is already in (major, minor) order, which is detected
+// during the histogram pass, no entry is moved or sorted at all.
+//
+// By default the scatter goes into freshly allocated output arrays. With
+// LoadOptions::low_memory the entries are instead permuted within the COO buffer (cycle
+// by cycle, swapping each entry straight into its segment), and the minor
+// and value arrays become the output; only the offsets and one cursor per
+// segment are allocated on top of the COO buffer. The in-place permutation
+// is not stable, so duplicate entries come out in unspecified order.
+//
+// With LoadOptions::first_touch the scatter is scatter_first_touch instead.
+//
+// Duplicates are then handled during the sort within segments, see
+// finish_segments. The COO buffer is consumed either way.
+template<typename CoordType, typename ValueType, typename OffsetArray, typename IndexArray, typename ValueArray>
+void compress_coo(CooBuffer<CoordType,ValueType>& coo, CoordType num_major, bool by_col,
+                  const LoadOptions& options,
+                  OffsetArray& offsets,
+                  IndexArray& indices,
+                  ValueArray& values,
+                  MemoryTracker& memory, LoadStats& stats) {
+    typedef typename OffsetArray::value_type OffsetType;
+    std::vector<CoordType>& major = by_col ? coo.cols : coo.rows;
+    std::vector<CoordType>& minor = by_col ? coo.rows : coo.cols;
+    const size_t nnz = coo.size();
+
+    const bool in_place = options.low_memory && options.duplicates != DuplicatePolicy::LAST;
+    const unsigned num_threads = options.mode == LoadMode::PARALLEL ? resolve_num_threads(options.num_threads) : 1;
+
+    std::unique_ptr<PhaseTimer> timer(new PhaseTimer(stats, LoadPhase::CONVERT, options));
+    if (options.first_touch) {
+        const std::vector<size_t> parts = first_touch_parts(options, static_cast<size_t>(num_major));
+        std::vector<OffsetType> counts;
+        const bool sorted = histogram_offsets(major, minor, num_major, counts);
+        memory.allocate(vector_bytes(counts));
+        scatter_first_touch(coo, by_col, counts, parts, offsets, indices, values, memory);
+        memory.release(vector_bytes(counts) + vector_bytes(coo.rows) + vector_bytes(coo.cols) +
+                       vector_bytes(coo.values));
+        release_vector(coo.rows);
+        release_vector(coo.cols);
+        release_vector(coo.values);
+
+        timer.reset(new PhaseTimer(stats, LoadPhase::ASSEMBLE, options));
+        stats.duplicate_entries = finish_segments(offsets, indices, values, sorted, options.duplicates, num_threads);
+        return;
+    }
+
+    const bool sorted = histogram_offsets(major, minor, num_major, offsets);
+    memory.allocate(vector_bytes(offsets));
+
+    if (sorted || in_place) {
+        if (!sorted) {
+            std::vector<OffsetType> next(offsets.begin(), offsets.end() - 1);
+            memory.allocate(vector_bytes(next));
+            for (size_t m = 0; m < static_cast<size_t>(num_major); m++) {
+                const size_t segment_end = static_cast<size_t>(offsets[m + 1]);
+                while (static_cast<size_t>(next[m]) < segment_end) {
+                    const size_t i = static_cast<size_t>(next[m]);
+                    const size_t target = static_cast<size_t>(major[i]);
+                    if (target == m) {
+                        next[m]++;
+                        continue;
+                    }
+                    const size_t j = static_cast<size_t>(next[target]++);
+                    std::swap(major[i], major[j]);
+                    std::swap(minor[i], minor[j]);
+                    std::swap(coo.values[i], coo.values[j]);
+                }
+            }
+            memory.release(vector_bytes(next));
+        }
+        memory.release(vector_bytes(major));
+        release_vector(major);
+        take_array(minor, indices);
+        take_array(coo.values, values);
+        timer.reset(new PhaseTimer(stats, LoadPhase::ASSEMBLE, options));
+        stats.duplicate_entries = finish_segments(offsets, indices, values, sorted, options.duplicates, num_threads);
+        return;
+    }
+
+    indices.resize(nnz);
+    values.resize(nnz);
+    std::vector<OffsetType> next(offsets.begin(), offsets.end() - 1);
+    memory.allocate(vector_bytes(indices) + vector_bytes(values) + vector_bytes(next));
+    for (size_t i = 0; i < nnz; i++) {
+        const size_t dst = static_cast<size_t>(next[static_cast<size_t>(major[i])]++);
+        indices[dst] = minor[i];
+        values[dst] = coo.values[i];
+    }
+    memory.release(vector_bytes(next) + vector_bytes(coo.rows) + vector_bytes(coo.cols) + vector_bytes(coo.values));
+    release_vector(next);
+    release_vector(coo.rows);
+    release_vector(coo.cols);
+    release_vector(coo.values);
+
+    timer.reset(new PhaseTimer(stats, LoadPhase::ASSEMBLE, options));
+    stats.duplicate_entries = finish_segments(offsets, indices, values, false, options.duplicates, num_threads);
+}
+
+// Entries whose index repeats the previous one within the same (sorted)
+// segment
+template<typename OffsetArray, typename IndexArray>
+size_t count_duplicates(const OffsetArray& offsets, const IndexArray& indices) {
+    size_t duplicates = 0;
+    for (size_t m = 0; m + 1 < offsets.size(); m++) {
+        const size_t end = static_cast<size_t>(offsets[m + 1]);
+        for (size_t i = static_cast<size_t>(offsets[m]) + 1; i < end; i++) {
+            duplicates += indices[i] == indices[i - 1];
+        }
+    }
+    return duplicates;
+}
+
+// Mirrors the entries that lie outside the kept triangle into it, with the
+// threads of LoadMode::PARALLEL each taking a range of the buffer
+template<typename CoordType, typename ValueType>
+void fold_triangle(CooBuffer<CoordType,ValueType>& coo, SymmetryType symmetry, bool upper,
+                   unsigned num_threads) {
+    const size_t nnz = coo.size();
+    const size_t min_thread_entries = size_t(1) << 16;
+    num_threads = static_cast<unsigned>(std::max<size_t>(1,
+        std::min<size_t>(num_threads, nnz / min_thread_entries)));
+    parallel_for_threads(num_threads, [&](unsigned t) {
+        const size_t end = nnz / num_threads * (t + 1) + (t + 1 == num_threads ? nnz % num_threads : 0);
+        for (size_t i = nnz / num_threads * t; i < end; i++) {
+            if (upper ? coo.rows[i] > coo.cols[i] : coo.rows[i] < coo.cols[i]) {
+                std::swap(coo.rows[i], coo.cols[i]);
+                coo.values[i] = mirror_value(symmetry, coo.values[i]);
+            }
+        }
+    });
+}
+
+// Symmetry of the matrix the readers return for a file with `header`
+template<typename CoordType>
+SymmetryType stored_symmetry(const Header<CoordType>& header, const LoadOptions& options) {
+    return options.symmetric_storage == SymmetricStorage::EXPAND ? SymmetryType::GENERAL : header.symmetry;
+}
+
+// Adds 1 to every offset and index, for 1-based output
+template<typename OffsetArray, typename IndexArray>
+void make_one_based(OffsetArray& offsets, IndexArray& indices) {
+    for (auto& offset : offsets) {
+        offset++;
+    }
+    for (auto& index : indices) {
+        index++;
+    }
+}
+
+inline void check_index_base(const LoadOptions& options) {
+    if (options.index_base > 1) {
+        throw std::invalid_argument("index_base must be 0 or 1");
+    }
+}
+
+// Moves the entries of a symmetric file into the kept triangle, if only
+// one is kept
+template<typename CoordType, typename ValueType>
+void fold_kept_triangle(CooBuffer<CoordType,ValueType>& coo, const Header<CoordType>& header,
+                        const LoadOptions& options, LoadStats& stats) {
+    if (stored_symmetry(header, options) != SymmetryType::GENERAL) {
+        PhaseTimer timer(stats, LoadPhase::CONVERT, options);
+        fold_triangle(coo, header.symmetry, options.symmetric_storage == SymmetricStorage::UPPER,
+                      options.mode == LoadMode::PARALLEL ? resolve_num_threads(options.num_threads) : 1);
+    }
+}
+
+// Counts the duplicates left for the stats and applies the index base
+template<typename OffsetArray, typename IndexArray>
+void finish_compressed(const LoadOptions& options, OffsetArray& offsets, IndexArray& indices, LoadStats& stats) {
+    if (options.stats != nullptr && options.duplicates == DuplicatePolicy::KEEP) {
+        stats.duplicate_entries = count_duplicates(offsets, indices);
+    }
+    if (options.index_base == 1) {
+        PhaseTimer timer(stats, LoadPhase::ASSEMBLE, options);
+        make_one_based(offsets, indices);
+    }
+}
+
+// Compresses parsed entries on rows (CSR) or columns (CSC) and applies the
+// index base. The entry count (plus the index base) must fit in OffsetType.
+template<typename CoordType, typename ValueType, typename OffsetArray, typename IndexArray, typename ValueArray>
+void compress_entries(CooBuffer<CoordType,ValueType>& coo, CoordType num_major, bool by_col,
+                      const LoadOptions& options,
+                      OffsetArray& offsets, IndexArray& indices, ValueArray& values,
+                      MemoryTracker& memory, LoadStats& stats) {
+    typedef typename OffsetArray::value_type OffsetType;
+    if (coo.size() > static_cast<size_t>(std::numeric_limits<OffsetType>::max() - options.index_base)) {
+        throw std::invalid_argument("Bad Matrix: too many nonzeros for OffsetType");
+    }
+    compress_coo(coo, num_major, by_col, options, offsets, indices, values, memory, stats);
+    finish_compressed(options, offsets, indices, stats);
+}
+
+///////////////////////////////////////////////////////////////////////////////
+// Reordering
+///////////////////////////////////////////////////////////////////////////////
+
+// Adjacency lists of the graph of A + A^T, without self loops or repeated
+// neighbours, each in ascending order
+template<typename CoordType, typename ValueType>
+void structure_graph(const CooBuffer<CoordType,ValueType>& coo, size_t n,
+                     std::vector<size_t>& offsets, std::vector<CoordType>& neighbors) {
+    const size_t nnz = coo.size();
+    offsets.assign(n + 1, 0);
+    for (size_t i = 0; i < nnz; i++) {
+        if (coo.rows[i] != coo.cols[i]) {
+            offsets[static_cast<size_t>(coo.rows[i]) + 1]++;
+            offsets[static_cast<size_t>(coo.cols[i]) + 1]++;
+        }
+    }
+    for (size_t v = 0; v < n; v++) {
+        offsets[v + 1] += offsets[v];
+    }
+    neighbors.resize(offsets[n]);
+    std::vector<size_t> next(offsets.begin(), offsets.end() - 1);
+    for (size_t i = 0; i < nnz; i++) {
+        if (coo.rows[i] != coo.cols[i]) {
+            neighbors[next[static_cast<size_t>(coo.rows[i])]++] = coo.cols[i];
+            neighbors[next[static_cast<size_t>(coo.cols[i])]++] = coo.rows[i];
+        }
+    }
+
+    size_t count = 0;
+    size_t begin = 0;
+    for (size_t v = 0; v < n; v++) {
+        const size_t end = offsets[v + 1];
+        std::sort(neighbors.begin() + begin, neighbors.begin() + end);
+        const size_t unique_end = static_cast<size_t>(
+            std::unique(neighbors.begin() + begin, neighbors.begin() + end) - neighbors.begin());
+        offsets[v] = count;
+        for (size_t k = begin; k < unique_end; k++) {
+            neighbors[count++] = neighbors[k];
+        }
+        begin = end;
+    }
+    offsets[n] = count;
+    neighbors.resize(count);
+}
+
+// Breadth-first search over the component of `root`, appending the nodes
+// to `order` level by level. With `by_degree` the unvisited neighbours of a
+// node are taken in ascending degree (the Cuthill-McKee order). Nodes are
+// marked by setting `mark` to `stamp`. Returns the number of levels; `last`
+// is set to the first node of the last level in `order`.
+template<typename CoordType>
+size_t bfs_levels(size_t root, const std::vector<size_t>& offsets, const std::vector<CoordType>& neighbors,
+                  bool by_degree, std::vector<size_t>& mark, size_t stamp,
+                  std::vector<size_t>& order, size_t& last) {
+    auto degree = [&](size_t v) { return offsets[v + 1] - offsets[v]; };
+    const size_t first = order.size();
+    mark[root] = stamp;
+    order.push_back(root);
+    size_t levels = 0;
+    size_t level_begin = first;
+    while (level_begin != order.size()) {
+        const size_t level_end = order.size();
+        last = level_begin;
+        levels++;
+        for (size_t q = level_begin; q < level_end; q++) {
+            const size_t v = order[q];
+            const size_t added = order.size();
+            for (size_t k = offsets[v]; k < offsets[v + 1]; k++) {
+                const size_t w = static_cast<size_t>(neighbors[k]);
+                if (mark[w] != stamp) {
+                    mark[w] = stamp;
+                    order.push_back(w);
+                }
+            }
+            if (by_degree) {
+                std::stable_sort(order.begin() + added, order.end(),
+                                 [&](size_t a, size_t b) { return degree(a) < degree(b); });
+            }
+        }
+        level_begin = level_end;
+    }
+    return levels;
+}
+
+// The new position of every node: old node order[i] becomes node i
+template<typename CoordType>
+std::vector<size_t> reordering_order(Reordering reordering, const std::vector<size_t>& offsets,
+                                     const std::vector<CoordType>& neighbors) {
+    const size_t n = offsets.size() - 1;
+    auto degree = [&](size_t v) { return offsets[v + 1] - offsets[v]; };
+    std::vector<size_t> by_degree(n);
+    for (size_t v = 0; v < n; v++) {
+        by_degree[v] = v;
+    }
+    std::stable_sort(by_degree.begin(), by_degree.end(), [&](size_t a, size_t b) { return degree(a) < degree(b); });
+    if (reordering == Reordering::DEGREE) {
+        return by_degree;
+    }
+
+    // Every component starts from its node of least degree, which is then
+    // moved to the least-degree node of the last BFS level for as long as
+    // that deepens the level structure (George and Liu)
+    std::vector<size_t> order;
+    order.reserve(n);
+    std::vector<size_t> mark(n, 0);
+    std::vector<size_t> scratch;
+    size_t stamp = 1;
+    for (size_t start : by_degree) {
+        if (mark[start] != 0) {
+            continue;
+        }
+        size_t root = start;
+        size_t last = 0;
+        scratch.clear();
+        size_t levels = bfs_levels(root, offsets, neighbors, false, mark, ++stamp, scratch, last);
+        while (true) {
+            size_t candidate = scratch[last];
+            for (size_t q = last; q < scratch.size(); q++) {
+                if (degree(scratch[q]) < degree(candidate)) {
+                    candidate = scratch[q];
+                }
+            }
+            scratch.clear();
+            const size_t candidate_levels = bfs_levels(candidate, offsets, neighbors, false, mark, ++stamp,
+                                                       scratch, last);
+            if (candidate_levels <= levels) {
+                break;
+            }
+            root = candidate;
+            levels = candidate_levels;
+        }
+        size_t unused;
+        bfs_levels(root, offsets, neighbors, true, mark, 1, order, unused);
+    }
+    std::reverse(order.begin(), order.end());
+    return order;
+}
+
+// Relabels the 0-based entries of an n x n matrix by options.reordering and
+// fills in options.permutation
+template<typename CoordType, typename ValueType>
+void reorder_entries(CooBuffer<CoordType,ValueType>& coo, size_t n, const LoadOptions& options,
+                     MemoryTracker& memory) {
+    std::vector<size_t> order;
+    {
+        std::vector<size_t> offsets;
+        std::vector<CoordType> neighbors;
+        structure_graph(coo, n, offsets, neighbors);
+        memory.allocate(vector_bytes(offsets) + vector_bytes(neighbors));
+        order = reordering_order(options.reordering, offsets, neighbors);
+        memory.release(vector_bytes(offsets) + vector_bytes(neighbors));
+    }
+    std::vector<CoordType> position(n);
+    for (size_t i = 0; i < n; i++) {
+        position[order[i]] = static_cast<CoordType>(i);
+    }
+    for (size_t i = 0; i < coo.size(); i++) {
+        coo.rows[i] = position[static_cast<size_t>(coo.rows[i])];
+        coo.cols[i] = position[static_cast<size_t>(coo.cols[i])];
+    }
+    if (options.permutation != nullptr) {
+        options.permutation->resize(n);
+        for (size_t i = 0; i < n; i++) {
+            (*options.permutation)[i] = static_cast<uint64_t>(order[i]) + options.index_base;
+        }
+    }
+}
+
+///////////////////////////////////////////////////////////////////////////////
+// Sorted input
+///////////////////////////////////////////////////////////////////////////////
+
+// A run of entries with the same major index, starting at `first`
+template<typename CoordType>
+struct MajorRun {
+    CoordType major;
+    size_t first;
+};
+
+// Parses `num_lines` entry lines into indices and values from position
+// `first` on, recording where each major index starts. Entries outside the
+// kept triangle are mirrored into it unless `fold` is GENERAL. Returns false
+// as soon as an entry is out of order, or once another thread found one.
+template<ValueFormat Format, typename CoordType, typename IndexArray, typename ValueArray>
+bool assemble_sorted_lines(const char* pos, const char* end, const Header<CoordType>& header,
+                           size_t num_lines, bool by_col, SymmetryType fold, bool upper, size_t first,
+                           IndexArray& indices, ValueArray& values, std::vector<MajorRun<CoordType>>& runs,
+                           const std::atomic<bool>& unsorted) {
+    for (size_t i = 0; i < num_lines; i++) {
+        if (pos == end) {
+            throw std::invalid_argument("Bad Matrix: fewer nonzeros than declared");
+        }
+        if (i % 4096 == 0 && unsorted.load(std::memory_order_relaxed)) {
+            return false;
+        }
+        CoordType row, col;
+        typename ValueArray::value_type value{};
+        parse_entry_line_as<Format>(pos, end, row, col, value);
+        check_and_rebase(header, row, col);
+        if (fold != SymmetryType::GENERAL && (upper ? row > col : row < col)) {
+            std::swap(row, col);
+            value = mirror_value(fold, value);
+        }
+        const CoordType major = by_col ? col : row;
+        const CoordType minor = by_col ? row : col;
+        const size_t k = first + i;
+        if (runs.empty() || runs.back().major != major) {
+            if (!runs.empty() && major < runs.back().major) {
+                return false;
+            }
+            runs.push_back(MajorRun<CoordType>{ major, k });
+        } else if (minor < indices[k - 1]) {
+            return false;
+        }
+        indices[k] = minor;
+        values[k] = value;
+    }
+    return true;
+}
+
+// Builds the compressed arrays straight from the entry section [pos, end)
+// when it is sorted by (major, minor), without a COO buffer. The chunks of
+// `num_threads` threads fill their own stretches of indices and values, as
+// in parse_entries_parallel, and the offsets are then put together from the
+// runs of each chunk. Returns false, with the arrays unspecified, if the
+// input is not sorted.
+template<typename CoordType, typename OffsetArray, typename IndexArray, typename ValueArray>
+bool assemble_sorted(const char* pos, const char* end, const Header<CoordType>& header, bool by_col,
+                     SymmetryType fold, bool upper, unsigned num_threads,
+                     OffsetArray& offsets, IndexArray& indices, ValueArray& values) {
+    typedef typename OffsetArray::value_type OffsetType;
+    end = trim_trailing_space(pos, end);
+    const size_t min_chunk_bytes = size_t(1) << 16;
+    const size_t max_chunks = std::max<size_t>(1, static_cast<size_t>(end - pos) / min_chunk_bytes);
+    num_threads = static_cast<unsigned>(std::min<size_t>(num_threads, max_chunks));
+
+    auto bounds = split_lines(pos, end, num_threads);
+    std::vector<size_t> chunk_lines(num_threads);
+    parallel_for_threads(num_threads, [&](unsigned t) {
+        chunk_lines[t] = count_lines(bounds[t], bounds[t + 1]);
+    });
+
+    // Every line gives one entry, so the chunk limits are also the regions
+    const size_t nnz = static_cast<size_t>(header.num_nonzeros);
+    std::vector<size_t> region(num_threads + 1, 0);
+    size_t total_lines = 0;
+    for (unsigned t = 0; t < num_threads; t++) {
+        region[t + 1] = std::min(nnz, region[t] + chunk_lines[t]);
+        total_lines += chunk_lines[t];
+    }
+    if (region[num_threads] < nnz) {
+        throw std::invalid_argument("Bad Matrix: fewer nonzeros than declared");
+    }
+    if (total_lines > nnz) {
+        throw std::invalid_argument("Bad Matrix: more nonzeros than declared");
+    }
+
+    indices.resize(nnz);
+    values.resize(nnz);
+    std::vector<std::vector<MajorRun<CoordType>>> runs(num_threads);
+    std::atomic<bool> unsorted(false);
+    parallel_for_threads(num_threads, [&](unsigned t) {
+        const size_t lines = region[t + 1] - region[t];
+        bool in_order;
+        switch (header.value_type) {
+        case ValueFormat::PATTERN:
+            in_order = assemble_sorted_lines<ValueFormat::PATTERN>(bounds[t], bounds[t + 1], header, lines, by_col,
+                fold, upper, region[t], indices, values, runs[t], unsorted);
+            break;
+        case ValueFormat::COMPLEX:
+            in_order = assemble_sorted_lines<ValueFormat::COMPLEX>(bounds[t], bounds[t + 1], header, lines, by_col,
+                fold, upper, region[t], indices, values, runs[t], unsorted);
+            break;
+        default:
+            in_order = assemble_sorted_lines<ValueFormat::REAL>(bounds[t], bounds[t + 1], header, lines, by_col,
+                fold, upper, region[t], indices, values, runs[t], unsorted);
+            break;
+        }
+        if (!in_order) {
+            unsorted = true;
+        }
+    });
+    if (unsorted) {
+        return false;
+    }
+
+    // A run may carry on from the previous chunk, as long as the order holds
+    // across the boundary
+    const size_t num_major = static_cast<size_t>(by_col ? header.num_cols : header.num_rows);
+    offsets.resize(num_major + 1);
+    size_t next = 0;
+    for (const auto& chunk_runs : runs) {
+        for (const auto& run : chunk_runs) {
+            const size_t major = static_cast<size_t>(run.major);
+            if (major < next) {
+                if (major + 1 != next || indices[run.first] < indices[run.first - 1]) {
+                    return false;
+                }
+                continue;
+            }
+            for (; next <= major; next++) {
+                offsets[next] = static_cast<OffsetType>(run.first);
+            }
+        }
+    }
+    for (; next <= num_major; next++) {
+        offsets[next] = static_cast<OffsetType>(nnz);
+    }
+    return true;
+}
+
+// The sorted-input path of read_compressed, see LoadOptions::detect_sorted.
+// Returns false when it doesn't apply or the input is not sorted, having
+// released the output arrays.
+template<typename CoordType, typename OffsetArray, typename IndexArray, typename ValueArray>
+bool read_sorted(const LoadInput& input, const LoadOptions& options, bool by_col, Header<CoordType>& header,
+                 OffsetArray& offsets, IndexArray& indices, ValueArray& values,
+                 MemoryTracker& memory, LoadStats& stats) {
+    typedef typename OffsetArray::value_type OffsetType;
+    if (!options.detect_sorted || options.first_touch || input.source != nullptr ||
+        options.validation == ValidationMode::COLLECT) {
+        return false;
+    }
+    if (input.filename != nullptr ? options.mode == LoadMode::STREAM ||
+                                    detect_compression(input.filename) != Compression::NONE
+                                  : detect_compression(input.data, input.size) != Compression::NONE) {
+        return false;
+    }
+
+    std::unique_ptr<MappedFile> file;
+    const char* pos;
+    const char* end;
+    {
+        PhaseTimer timer(stats, LoadPhase::HEADER, options);
+        if (input.filename != nullptr) {
+            file.reset(new MappedFile(input.filename));
+        }
+        pos = file ? file->begin() : input.data;
+        end = file ? file->end() : input.data + input.size;
+        header = read_header<CoordType>(pos, end);
+    }
+    if (header.symmetry != SymmetryType::GENERAL && options.symmetric_storage == SymmetricStorage::EXPAND) {
+        return false;
+    }
+    if (header.num_nonzeros > static_cast<size_t>(std::numeric_limits<OffsetType>::max() - options.index_base)) {
+        throw std::invalid_argument("Bad Matrix: too many nonzeros for OffsetType");
+    }
+
+    bool sorted;
+    {
+        PhaseTimer timer(stats, LoadPhase::PARSE, options);
+        const unsigned num_threads =
+            options.mode == LoadMode::PARALLEL ? resolve_num_threads(options.num_threads) : 1;
+        sorted = assemble_sorted(pos, end, header, by_col, header.symmetry,
+                                 options.symmetric_storage == SymmetricStorage::UPPER, num_threads,
+                                 offsets, indices, values);
+    }
+    if (!sorted) {
+        release_vector(offsets);
+        release_vector(indices);
+        release_vector(values);
+        return false;
+    }
+    stats.bytes_read = static_cast<size_t>(end - (file ? file->begin() : input.data));
+    memory.allocate(vector_bytes(offsets) + vector_bytes(indices) + vector_bytes(values));
+    return true;
+}
+
+// The rows [first_row, last_row) and columns [first_col, last_col) of a
+// block
+struct BlockRange {
+    size_t first_row;
+    size_t last_row;
+    size_t first_col;
+    size_t last_col;
+};
+
+inline void grid_bounds(const BlockGrid& grid, size_t num_rows, size_t num_cols,
+                        std::vector<size_t>& row_bounds, std::vector<size_t>& col_bounds) {
+    row_bounds = partition_bounds(grid.row_bounds, grid.row_parts, num_rows,
+                                  "BlockGrid rows must be cut into row_parts ranges from 0 to the row count");
+    col_bounds = partition_bounds(grid.col_bounds, grid.col_parts, num_cols,
+                                  "BlockGrid columns must be cut into col_parts ranges from 0 to the column count");
+}
+
+inline BlockRange grid_block(const BlockGrid& grid, size_t num_rows, size_t num_cols, unsigned block) {
+    std::vector<size_t> row_bounds, col_bounds;
+    grid_bounds(grid, num_rows, num_cols, row_bounds, col_bounds);
+    if (block >= static_cast<size_t>(grid.row_parts) * grid.col_parts) {
+        throw std::invalid_argument("block must be less than the number of blocks");
+    }
+    const size_t r = block / grid.col_parts;
+    const size_t c = block % grid.col_parts;
+    return BlockRange{ row_bounds[r], row_bounds[r + 1], col_bounds[c], col_bounds[c + 1] };
+}
+
+// Index of the range of `bounds` holding `index`
+inline size_t find_part(const std::vector<size_t>& bounds, size_t index) {
+    const auto first = bounds.begin() + 1;
+    return static_cast<size_t>(std::upper_bound(first, bounds.end() - 1, index) - first);
+}
+
+// Keeps the entries inside `block`, moved to its local coordinates
+template<typename CoordType, typename ValueType>
+void keep_block(CooBuffer<CoordType,ValueType>& coo, const BlockRange& block) {
+    size_t count = 0;
+    for (size_t i = 0; i < coo.size(); i++) {
+        const size_t row = static_cast<size_t>(coo.rows[i]);
+        const size_t col = static_cast<size_t>(coo.cols[i]);
+        if (row >= block.first_row && row < block.last_row && col >= block.first_col && col < block.last_col) {
+            coo.rows[count] = static_cast<CoordType>(row - block.first_row);
+            coo.cols[count] = static_cast<CoordType>(col - block.first_col);
+            coo.values[count] = coo.values[i];
+            count++;
+        }
+    }
+    coo.resize(count);
+}
+
+// Parses the input and compresses it on rows (CSR) or columns (CSC). With
+// a `grid` only the entries of block `block` are kept, in its local
+// coordinates, and compressed on rows.
+template<typename CoordType, typename ValueType, typename OffsetArray, typename IndexArray, typename ValueArray>
+Header<CoordType> read_compressed(const LoadInput& input, const LoadOptions& options, bool by_col,
+                                  OffsetArray& offsets,
+                                  IndexArray& indices,
+                                  ValueArray& values,
+                                  const BlockGrid* grid = nullptr, unsigned block = 0) {
+    check_index_base(options);
+    check_first_touch<OffsetArray,IndexArray,ValueArray>(options);
+
+    MemoryTracker memory;
+    LoadStats stats;
+    Header<CoordType> header;
+    {
+        PhaseTimer total(stats, LoadPhase::TOTAL, options);
+
+        if (grid == nullptr && options.reordering == Reordering::NONE &&
+            read_sorted(input, options, by_col, header, offsets, indices, values, memory, stats)) {
+            stats.lines_parsed = static_cast<size_t>(header.num_nonzeros);
+            stats.comment_lines = header.num_comment_lines;
+            stats.sorted_input = true;
+            {
+                PhaseTimer timer(stats, LoadPhase::ASSEMBLE, options);
+                stats.duplicate_entries = finish_segments(offsets, indices, values, true, options.duplicates,
+                    options.mode == LoadMode::PARALLEL ? resolve_num_threads(options.num_threads) : 1);
+            }
+            finish_compressed(options, offsets, indices, stats);
+        } else {
+            CooBuffer<CoordType,ValueType> coo;
+            header = read_nonzeros(input, options, coo, stats);
+            memory.allocate(vector_bytes(coo.rows) + vector_bytes(coo.cols) + vector_bytes(coo.values));
+            stats.lines_parsed = static_cast<size_t>(header.num_nonzeros);
+            stats.comment_lines = header.num_comment_lines;
+            stats.symmetric_expansions = coo.size() - stats.lines_parsed;
+
+            if (options.reordering != Reordering::NONE) {
+                PhaseTimer timer(stats, LoadPhase::CONVERT, options);
+                reorder_entries(coo, static_cast<size_t>(header.num_rows), options, memory);
+            }
+            fold_kept_triangle(coo, header, options, stats);
+            CoordType num_major = by_col ? header.num_cols : header.num_rows;
+            if (grid != nullptr) {
+                PhaseTimer timer(stats, LoadPhase::CONVERT, options);
+                const BlockRange range = grid_block(*grid, header.num_rows, header.num_cols, block);
+                keep_block(coo, range);
+                num_major = static_cast<CoordType>(range.last_row - range.first_row);
+            }
+            compress_entries(coo, num_major, by_col, options, offsets, indices, values, memory, stats);
+        }
+    }
+
+    if (options.stats != nullptr) {
+        stats.peak_bytes = memory.peak_bytes();
+        stats.matrix_bytes = vector_bytes(offsets) + vector_bytes(indices) + vector_bytes(values);
+        *options.stats = stats;
+    }
+    return header;
+}
+
+// Transposes a compressed matrix: the major/minor roles swap, so the CSR
+// arrays of a matrix become its CSC arrays and vice versa. Walking the input
+// segments in order makes every output segment come out sorted, with equal
+// indices in their input order. The output keeps the index base `base`.
+template<typename CoordType, typename OffsetArray, typename IndexArray, typename ValueArray>
+void transpose_compressed(CoordType num_minor, unsigned base,
+                          const OffsetArray& offsets,
+                          const IndexArray& indices,
+                          const ValueArray& values,
+                          OffsetArray& out_offsets,
+                          IndexArray& out_indices,
+                          ValueArray& out_values) {
+    typedef typename OffsetArray::value_type OffsetType;
+    const size_t nnz = indices.size();
+
+    out_offsets.assign(static_cast<size_t>(num_minor) + 1, 0);
+    for (size_t i = 0; i < nnz; i++) {
+        out_offsets[static_cast<size_t>(indices[i]) - base + 1]++;
+    }
+    for (size_t m = 0; m < static_cast<size_t>(num_minor); m++) {
+        out_offsets[m + 1] += out_offsets[m];
+    }
+
+    out_indices.resize(nnz);
+    out_values.resize(nnz);
+    std::vector<OffsetType> next(out_offsets.begin(), out_offsets.end() - 1);
+    for (size_t m = 0; m + 1 < offsets.size(); m++) {
+        const size_t end = static_cast<size_t>(offsets[m + 1]) - base;
+        for (size_t i = static_cast<size_t>(offsets[m]) - base; i < end; i++) {
+            const size_t dst = static_cast<size_t>(next[static_cast<size_t>(indices[i]) - base]++);
+            out_indices[dst] = static_cast<CoordType>(m + base);
+            out_values[dst] = values[i];
+        }
+    }
+    if (base != 0) {
+        for (auto& offset : out_offsets) {
+            offset = static_cast<OffsetType>(offset + base);
+        }
+    }
+}
+
+///////////////////////////////////////////////////////////////////////////////
+// Binary format
+///////////////////////////////////////////////////////////////////////////////
+
+enum class BinaryLayout : uint32_t { CSR = 0, CSC = 1 };
+
+struct BinaryHeader {
+    char magic[8];
+    uint32_t version;
+    uint32_t byte_order;
+    uint32_t layout;
+    uint32_t coord_bytes;
+    uint32_t coord_kind;
+    uint32_t value_bytes;
+    uint32_t value_kind;
+    uint32_t symmetry;
+    uint64_t num_rows;
+    uint64_t num_cols;
+    uint64_t num_nonzeros;
+    // Byte positions and element counts of the offsets, indices and values
+    uint64_t array_pos[3];
+    uint64_t array_len[3];
+    uint32_t offset_bytes;
+    uint32_t offset_kind;
+    uint32_t index_base;
+    uint32_t reserved;
+};
+
+static const char binary_magic[8] = {'M', 'T', 'X', 'B', 'I', 'N', '\0', '\0'};
+static const uint32_t binary_version = 2;
+static const uint32_t binary_byte_order = 0x01020304;
+static const size_t binary_alignment = 64;
+
+// 0: floating point, 1: signed integer, 2: unsigned integer, 3: no values,
+// 4: complex floating point
+template<typename T>
+uint32_t binary_type_kind() {
+    return is_complex<T>::value ? 4 : std::is_floating_point<T>::value ? 0 : (std::is_signed<T>::value ? 1 : 2);
+}
+
+template<>
+inline uint32_t binary_type_kind<void>() {
+    return 3;
+}
+
+inline size_t align_up(size_t pos, size_t alignment) {
+    return (pos + alignment - 1) / alignment * alignment;
+}
+
+template<typename CoordType, typename ValueType, typename OffsetType>
+BinaryHeader make_binary_header(BinaryLayout layout, CoordType num_rows, CoordType num_cols,
+                                OffsetType num_nonzeros, SymmetryType symmetry, unsigned index_base,
+                                size_t num_offsets) {
+    BinaryHeader header;
+    std::memset(&header, 0, sizeof(header));
+    std::memcpy(header.magic, binary_magic, sizeof(binary_magic));
+    header.version = binary_version;
+    header.byte_order = binary_byte_order;
+    header.layout = static_cast<uint32_t>(layout);
+    header.coord_bytes = sizeof(CoordType);
+    header.coord_kind = binary_type_kind<CoordType>();
+    header.value_bytes = ValueTraits<ValueType>::bytes;
+    header.value_kind = binary_type_kind<ValueType>();
+    header.symmetry = static_cast<uint32_t>(symmetry);
+    header.num_rows = static_cast<uint64_t>(num_rows);
+    header.num_cols = static_cast<uint64_t>(num_cols);
+    header.num_nonzeros = static_cast<uint64_t>(num_nonzeros);
+    header.offset_bytes = sizeof(OffsetType);
+    header.offset_kind = binary_type_kind<OffsetType>();
+    header.index_base = index_base;
+
+    const size_t element_bytes[3] = { sizeof(OffsetType), sizeof(CoordType), ValueTraits<ValueType>::bytes };
+    header.array_len[0] = num_offsets;
+    header.array_len[1] = static_cast<uint64_t>(num_nonzeros);
+    header.array_len[2] = element_bytes[2] == 0 ? 0 : static_cast<uint64_t>(num_nonzeros);
+    size_t pos = align_up(sizeof(BinaryHeader), binary_alignment);
+    for (int a = 0; a < 3; a++) {
+        header.array_pos[a] = pos;
+        pos = align_up(pos + header.array_len[a] * element_bytes[a], binary_alignment);
+    }
+    return header;
+}
+
+// Writes to a temporary file next to `filename` and renames it into place,
+// so readers never see a partially written file.
+template<typename OffsetArray, typename IndexArray, typename ValueArray>
+void write_binary_arrays(const char* filename, const BinaryHeader& header,
+                         const OffsetArray& offsets,
+                         const IndexArray& indices,
+                         const ValueArray& values) {
+    if (offsets.size() != header.array_len[0] || indices.size() != header.array_len[1] ||
+        values.size() != header.array_len[2]) {
+        throw std::invalid_argument("Bad Matrix: array sizes don't match the dimensions");
+    }
+
+    const std::string tmp_name = std::string(filename) + ".tmp." + std::to_string(::getpid());
+    FILE* f = std::fopen(tmp_name.c_str(), "wb");
+    if (f == nullptr) {
+        throw std::invalid_argument("Could not open file for writing");
+    }
+
+    const void* arrays[3] = { offsets.data(), indices.data(), values.data() };
+    const size_t element_bytes[3] = { sizeof(typename OffsetArray::value_type),
+                                      sizeof(typename IndexArray::value_type), header.value_bytes };
+    static const char padding[binary_alignment] = {};
+
+    bool ok = std::fwrite(&header, sizeof(header), 1, f) == 1;
+    size_t pos = sizeof(header);
+    for (int a = 0; a < 3 && ok; a++) {
+        ok = std::fwrite(padding, 1, header.array_pos[a] - pos, f) == header.array_pos[a] - pos;
+        const size_t bytes = header.array_len[a] * element_bytes[a];
+        ok = ok && (bytes == 0 || std::fwrite(arrays[a], 1, bytes, f) == bytes);
+        pos = header.array_pos[a] + bytes;
+    }
+    ok = std::fclose(f) == 0 && ok;
+    if (!ok || std::rename(tmp_name.c_str(), filename) != 0) {
+        std::remove(tmp_name.c_str());
+        throw std::invalid_argument("Could not write binary file");
+    }
+}
+
+// Maps a binary file and checks that it holds `layout` with the given types.
+// Returns pointers to the three arrays inside the mapping.
+template<typename CoordType, typename ValueType, typename OffsetType>
+std::shared_ptr<const MappedFile> map_binary_arrays(const char* filename, BinaryLayout layout,
+                                                    BinaryHeader& header, const void* arrays[3]) {
+    std::shared_ptr<const MappedFile> file = std::make_shared<MappedFile>(filename);
+    if (file->size() < sizeof(BinaryHeader)) {
+        throw std::invalid_argument("Bad Binary: file too short");
+    }
+    std::memcpy(&header, file->data(), sizeof(header));
+    if (std::memcmp(header.magic, binary_magic, sizeof(binary_magic)) != 0) {
+        throw std::invalid_argument("Bad Binary: missing magic");
+    }
+    if (header.version != binary_version || header.byte_order != binary_byte_order) {
+        throw std::invalid_argument("Bad Binary: unsupported version or byte order");
+    }
+    if (header.layout != static_cast<uint32_t>(layout)) {
+        throw std::invalid_argument("Bad Binary: wrong layout");
+    }
+    if (header.coord_bytes != sizeof(CoordType) || header.coord_kind != binary_type_kind<CoordType>() ||
+        header.value_bytes != ValueTraits<ValueType>::bytes || header.value_kind != binary_type_kind<ValueType>() ||
+        header.offset_bytes != sizeof(OffsetType) || header.offset_kind != binary_type_kind<OffsetType>()) {
+        throw std::invalid_argument("Bad Binary: CoordType, ValueType or OffsetType mismatch");
+    }
+    if (header.symmetry > static_cast<uint32_t>(SymmetryType::HERMITIAN)) {
+        throw std::invalid_argument("Bad Binary: unknown symmetry");
+    }
+    if (header.index_base > 1) {
+        throw std::invalid_argument("Bad Binary: unknown index base");
+    }
+    if (header.num_rows > static_cast<uint64_t>(std::numeric_limits<CoordType>::max()) ||
+        header.num_cols > static_cast<uint64_t>(std::numeric_limits<CoordType>::max()) ||
+        header.num_nonzeros > static_cast<uint64_t>(std::numeric_limits<OffsetType>::max()) - header.index_base) {
+        throw std::invalid_argument("Bad Binary: dimensions overflow CoordType or OffsetType");
+    }
+    const uint64_t num_major = layout == BinaryLayout::CSR ? header.num_rows : header.num_cols;
+    if (header.array_len[0] == 0 || header.array_len[0] - 1 != num_major ||
+        header.array_len[1] != header.num_nonzeros ||
+        header.array_len[2] != (header.value_bytes == 0 ? 0 : header.num_nonzeros)) {
+        throw std::invalid_argument("Bad Binary: array lengths don't match the header");
+    }
+    const size_t element_bytes[3] = { sizeof(OffsetType), sizeof(CoordType), header.value_bytes };
+    for (int a = 0; a < 3; a++) {
+        // Divided rather than multiplied, so that a huge length can't wrap
+        const uint64_t room = header.array_pos[a] <= file->size() ? file->size() - header.array_pos[a] : 0;
+        if (header.array_pos[a] % binary_alignment != 0 || header.array_pos[a] > file->size() ||
+            (element_bytes[a] != 0 && header.array_len[a] > room / element_bytes[a])) {
+            throw std::invalid_argument("Bad Binary: array out of bounds");
+        }
+        arrays[a] = file->data() + header.array_pos[a];
+    }
+    OffsetType first, last;
+    std::memcpy(&first, arrays[0], sizeof(OffsetType));
+    std::memcpy(&last, static_cast<const OffsetType*>(arrays[0]) + num_major, sizeof(OffsetType));
+    if (static_cast<uint64_t>(first) != header.index_base ||
+        static_cast<uint64_t>(last) != header.num_nonzeros + header.index_base) {
+        throw std::invalid_argument("Bad Binary: offsets don't match the number of nonzeros");
+    }
+    return file;
+}
+
+template<typename T, typename Allocator>
+void copy_binary_array(const void* data, uint64_t len, std::vector<T,Allocator>& out) {
+    const T* begin = static_cast<const T*>(data);
+    out.assign(begin, begin + len);
+}
+
+inline void copy_binary_array(const void*, uint64_t, NoValues&) {}
+
+template<typename CoordType, typename ValueType, typename OffsetType, typename Allocator>
+void write_binary(const char* filename, const CSRMatrix<CoordType,ValueType,OffsetType,Allocator>& csr) {
+    auto header = make_binary_header<CoordType,ValueType>(BinaryLayout::CSR, csr.num_rows, csr.num_cols,
+                                                          csr.num_nonzeros, csr.symmetry, csr.index_base,
+                                                          csr.row_offsets.size());
+    write_binary_arrays(filename, header, csr.row_offsets, csr.col_indices, csr.values);
+}
+
+template<typename CoordType, typename ValueType, typename OffsetType, typename Allocator>
+void write_binary(const char* filename, const CSCMatrix<CoordType,ValueType,OffsetType,Allocator>& csc) {
+    auto header = make_binary_header<CoordType,ValueType>(BinaryLayout::CSC, csc.num_rows, csc.num_cols,
+                                                          csc.num_nonzeros, csc.symmetry, csc.index_base,
+                                                          csc.col_offsets.size());
+    write_binary_arrays(filename, header, csc.col_offsets, csc.row_indices, csc.values);
+}
+
+template<typename CoordType, typename ValueType, typename OffsetType>
+CSRMatrixView<CoordType,ValueType,OffsetType> map_binary_csr(const char* filename) {
+    BinaryHeader header;
+    const void* arrays[3];
+    auto file = map_binary_arrays<CoordType,ValueType,OffsetType>(filename, BinaryLayout::CSR, header, arrays);
+    return CSRMatrixView<CoordType,ValueType,OffsetType>{
+        static_cast<CoordType>(header.num_rows),
+        static_cast<CoordType>(header.num_cols),
+        static_cast<OffsetType>(header.num_nonzeros),
+        static_cast<SymmetryType>(header.symmetry),
+        header.index_base,
+        static_cast<const OffsetType*>(arrays[0]),
+        static_cast<const CoordType*>(arrays[1]),
+        static_cast<const ValueType*>(arrays[2]),
+        std::move(file)
+    };
+}
+
+template<typename CoordType, typename ValueType, typename OffsetType>
+CSCMatrixView<CoordType,ValueType,OffsetType> map_binary_csc(const char* filename) {
+    BinaryHeader header;
+    const void* arrays[3];
+    auto file = map_binary_arrays<CoordType,ValueType,OffsetType>(filename, BinaryLayout::CSC, header, arrays);
+    return CSCMatrixView<CoordType,ValueType,OffsetType>{
+        static_cast<CoordType>(header.num_rows),
+        static_cast<CoordType>(header.num_cols),
+        static_cast<OffsetType>(header.num_nonzeros),
+        static_cast<SymmetryType>(header.symmetry),
+        header.index_base,
+        static_cast<const OffsetType*>(arrays[0]),
+        static_cast<const CoordType*>(arrays[1]),
+        static_cast<const ValueType*>(arrays[2]),
+        std::move(file)
+    };
+}
+
+template<typename CoordType, typename ValueType, typename OffsetType, typename Allocator>
+CSRMatrix<CoordType,ValueType,OffsetType,Allocator> read_binary_csr(const char* filename,
+                                                                    const Allocator& allocator) {
+    typedef CSRMatrix<CoordType,ValueType,OffsetType,Allocator> Matrix;
+    BinaryHeader header;
+    const void* arrays[3];
+    auto file = map_binary_arrays<CoordType,ValueType,OffsetType>(filename, BinaryLayout::CSR, header, arrays);
+    Matrix csr{
+        static_cast<CoordType>(header.num_rows),
+        static_cast<CoordType>(header.num_cols),
+        static_cast<OffsetType>(header.num_nonzeros),
+        static_cast<SymmetryType>(header.symmetry),
+        header.index_base,
+        decltype(Matrix::row_offsets)(allocator),
+        decltype(Matrix::col_indices)(allocator),
+        decltype(Matrix::values)(allocator)
+    };
+    copy_binary_array(arrays[0], header.array_len[0], csr.row_offsets);
+    copy_binary_array(arrays[1], header.array_len[1], csr.col_indices);
+    copy_binary_array(arrays[2], header.array_len[2], csr.values);
+    return csr;
+}
+
+template<typename CoordType, typename ValueType, typename OffsetType, typename Allocator>
+CSCMatrix<CoordType,ValueType,OffsetType,Allocator> read_binary_csc(const char* filename,
+                                                                    const Allocator& allocator) {
+    typedef CSCMatrix<CoordType,ValueType,OffsetType,Allocator> Matrix;
+    BinaryHeader header;
+    const void* arrays[3];
+    auto file = map_binary_arrays<CoordType,ValueType,OffsetType>(filename, BinaryLayout::CSC, header, arrays);
+    Matrix csc{
+        static_cast<CoordType>(header.num_rows),
+        static_cast<CoordType>(header.num_cols),
+        static_cast<OffsetType>(header.num_nonzeros),
+        static_cast<SymmetryType>(header.symmetry),
+        header.index_base,
+        decltype(Matrix::col_offsets)(allocator),
+        decltype(Matrix::row_indices)(allocator),
+        decltype(Matrix::values)(allocator)
+    };
+    copy_binary_array(arrays[0], header.array_len[0], csc.col_offsets);
+    copy_binary_array(arrays[1], header.array_len[1], csc.row_indices);
+    copy_binary_array(arrays[2], header.array_len[2], csc.values);
+    return csc;
+}
+
+///////////////////////////////////////////////////////////////////////////////
+// Binary cache
+///////////////////////////////////////////////////////////////////////////////
+
+template<typename CoordType, typename ValueType, typename OffsetType, typename Allocator>
+size_t matrix_bytes(const CSRMatrix<CoordType,ValueType,OffsetType,Allocator>& csr) {
+    return vector_bytes(csr.row_offsets) + vector_bytes(csr.col_indices) + vector_bytes(csr.values);
+}
+
+template<typename CoordType, typename ValueType, typename OffsetType, typename Allocator>
+size_t matrix_bytes(const CSCMatrix<CoordType,ValueType,OffsetType,Allocator>& csc) {
+    return vector_bytes(csc.col_offsets) + vector_bytes(csc.row_indices) + vector_bytes(csc.values);
+}
+
+// Whether `cache_name` exists and was modified after `filename`
+inline bool cache_is_fresh(const char* filename, const std::string& cache_name) {
+    struct stat source, cache;
+    if (::stat(filename, &source) != 0 || ::stat(cache_name.c_str(), &cache) != 0) {
+        return false;
+    }
+    return std::make_pair(cache.st_mtim.tv_sec, cache.st_mtim.tv_nsec) >
+           std::make_pair(source.st_mtim.tv_sec, source.st_mtim.tv_nsec);
+}
+
+// A short name of T for cache file names: "u32", "i64", "f64", "c128"
+// (complex) or "void"
+template<typename T>
+std::string binary_type_tag() {
+    static const char kind_name[] = "fiu?c";
+    const uint32_t kind = binary_type_kind<T>();
+    return kind == 3 ? std::string("void") : kind_name[kind] + std::to_string(8 * ValueTraits<T>::bytes);
+}
+
+// The sidecar that LoadOptions::cache uses for `filename`: filename, then
+// ".sum", ".last" or ".unique" for the other duplicate policies, ".lower" or
+// ".upper" for a kept triangle, ".base1" for 1-based output, the CoordType,
+// ValueType and OffsetType tags and ".csr.bin" or ".csc.bin", e.g.
+// "m.mtx.u32.f64.u32.csr.bin". Loads with other types use other files rather
+// than replacing each other's.
+template<typename CoordType, typename ValueType, typename OffsetType = CoordType>
+std::string cache_file_name(const char* filename, const LoadOptions& options, BinaryLayout layout) {
+    static const char* const policy_name[] = { "", ".sum", ".last", ".unique" };
+    static const char* const storage_name[] = { "", ".lower", ".upper" };
+    return std::string(filename) + policy_name[static_cast<int>(options.duplicates)] +
+           storage_name[static_cast<int>(options.symmetric_storage)] + (options.index_base == 1 ? ".base1" : "") +
+           "." + binary_type_tag<CoordType>() + "." + binary_type_tag<ValueType>() + "." +
+           binary_type_tag<OffsetType>() + (layout == BinaryLayout::CSC ? ".csc.bin" : ".csr.bin");
+}
+
+// Loads the sidecar `cache_name` when it is fresh and was written with the
+// same types; otherwise calls `load` and tries to store the result for next
+// time. The cache is best effort: an unwritable directory just means no
+// cache.
+template<typename MatrixType, typename ReadCache, typename Load>
+MatrixType with_binary_cache(const char* filename, const std::string& cache_name, const LoadOptions& options,
+                             ReadCache read_cache, Load load) {
+    if (cache_is_fresh(filename, cache_name)) {
+        try {
+            LoadStats stats;
+            std::unique_ptr<PhaseTimer> total(new PhaseTimer(stats, LoadPhase::TOTAL, options));
+            std::unique_ptr<PhaseTimer> timer(new PhaseTimer(stats, LoadPhase::PARSE, options));
+            MatrixType matrix = read_cache(cache_name.c_str());
+            timer.reset();
+            total.reset();
+            if (options.stats != nullptr) {
+                struct stat cache;
+                if (::stat(cache_name.c_str(), &cache) == 0) {
+                    stats.bytes_read = static_cast<size_t>(cache.st_size);
+                }
+                stats.matrix_bytes = matrix_bytes(matrix);
+                stats.peak_bytes = stats.matrix_bytes;
+                *options.stats = stats;
+            }
+            return matrix;
+        } catch (const std::invalid_argument&) {
+            // Stale format or different types: rebuild it below
+        }
+    }
+    MatrixType matrix = load();
+    try {
+        write_binary(cache_name.c_str(), matrix);
+    } catch (const std::invalid_argument&) {
+    }
+    return matrix;
+}
+
+///////////////////////////////////////////////////////////////////////////////
+// Read CSR
+///////////////////////////////////////////////////////////////////////////////
+
+template<typename CoordType, typename ValueType, typename OffsetType, typename Allocator>
+CSRMatrix<CoordType,ValueType,OffsetType,Allocator>
+read_csr_input(const LoadInput& input, const LoadOptions& options, const Allocator& allocator) {
+    typedef CSRMatrix<CoordType,ValueType,OffsetType,Allocator> Matrix;
+    decltype(Matrix::row_offsets) row_offsets(allocator);
+    decltype(Matrix::col_indices) col_indices(allocator);
+    decltype(Matrix::values) values(allocator);
+    auto header = read_compressed<CoordType,ValueType>(input, options, false, row_offsets, col_indices, values);
+
+    return Matrix{
+        header.num_rows,
+        header.num_cols,
+        static_cast<OffsetType>(col_indices.size()),
+        stored_symmetry(header, options),
+        options.index_base,
+        std::move(row_offsets),
+        std::move(col_indices),
+        std::move(values)
+    };
+}
+
+template<typename CoordType, typename ValueType, typename OffsetType, typename Allocator>
+CSRMatrix<CoordType,ValueType,OffsetType,Allocator> read_csr(const char* filename, const LoadOptions& options,
+                                                             const Allocator& allocator) {
+    typedef CSRMatrix<CoordType,ValueType,OffsetType,Allocator> Matrix;
+
+    if (options.cache && options.validation != ValidationMode::COLLECT && options.reordering == Reordering::NONE &&
+        !options.first_touch) {
+        LoadOptions uncached = options;
+        uncached.cache = false;
+        const auto cache_name = cache_file_name<CoordType,ValueType,OffsetType>(filename, options,
+                                                                                 BinaryLayout::CSR);
+        return with_binary_cache<Matrix>(filename, cache_name, options,
+            [&](const char* cache_name) {
+                return read_binary_csr<CoordType,ValueType,OffsetType>(cache_name, allocator);
+            },
+            [&]() { return read_csr<CoordType,ValueType,OffsetType>(filename, uncached, allocator); });
+    }
+
+    return read_csr_input<CoordType,ValueType,OffsetType>(LoadInput(filename), options, allocator);
+}
+
+template<typename CoordType, typename ValueType, typename OffsetType, typename Allocator>
+CSRMatrix<CoordType,ValueType,OffsetType,Allocator>
+read_csr(const char* data, size_t size, const LoadOptions& options, const Allocator& allocator) {
+    return read_csr_input<CoordType,ValueType,OffsetType>(LoadInput(data, size), options, allocator);
+}
+
+template<typename CoordType, typename ValueType, typename OffsetType, typename Allocator>
+CSRMatrix<CoordType,ValueType,OffsetType,Allocator>
+read_csr(InputSource& source, const LoadOptions& options, const Allocator& allocator) {
+    return read_csr_input<CoordType,ValueType,OffsetType>(LoadInput(source), options, allocator);
+}
+
+///////////////////////////////////////////////////////////////////////////////
+// Read CSC
+///////////////////////////////////////////////////////////////////////////////
+
+template<typename CoordType, typename ValueType, typename OffsetType, typename Allocator>
+CSCMatrix<CoordType,ValueType,OffsetType,Allocator>
+read_csc_input(const LoadInput& input, const LoadOptions& options, const Allocator& allocator) {
+    typedef CSCMatrix<CoordType,ValueType,OffsetType,Allocator> Matrix;
+    decltype(Matrix::col_offsets) col_offsets(allocator);
+    decltype(Matrix::row_indices) row_indices(allocator);
+    decltype(Matrix::values) values(allocator);
+    auto header = read_compressed<CoordType,ValueType>(input, options, true, col_offsets, row_indices, values);
+
+    return Matrix{
+        header.num_rows,
+        header.num_cols,
+        static_cast<OffsetType>(row_indices.size()),
+        stored_symmetry(header, options),
+        options.index_base,
+        std::move(col_offsets),
+        std::move(row_indices),
+        std::move(values)
+    };
+}
+
+template<typename CoordType, typename ValueType, typename OffsetType, typename Allocator>
+CSCMatrix<CoordType,ValueType,OffsetType,Allocator> read_csc(const char* filename, const LoadOptions& options,
+                                                             const Allocator& allocator) {
+    typedef CSCMatrix<CoordType,ValueType,OffsetType,Allocator> Matrix;
+
+    if (options.cache && options.validation != ValidationMode::COLLECT && options.reordering == Reordering::NONE &&
+        !options.first_touch) {
+        LoadOptions uncached = options;
+        uncached.cache = false;
+        const auto cache_name = cache_file_name<CoordType,ValueType,OffsetType>(filename, options,
+                                                                                 BinaryLayout::CSC);
+        return with_binary_cache<Matrix>(filename, cache_name, options,
+            [&](const char* cache_name) {
+                return read_binary_csc<CoordType,ValueType,OffsetType>(cache_name, allocator);
+            },
+            [&]() { return read_csc<CoordType,ValueType,OffsetType>(filename, uncached, allocator); });
+    }
+
+    return read_csc_input<CoordType,ValueType,OffsetType>(LoadInput(filename), options, allocator);
+}
+
+template<typename CoordType, typename ValueType, typename OffsetType, typename Allocator>
+CSCMatrix<CoordType,ValueType,OffsetType,Allocator>
+read_csc(const char* data, size_t size, const LoadOptions& options, const Allocator& allocator) {
+    return read_csc_input<CoordType,ValueType,OffsetType>(LoadInput(data, size), options, allocator);
+}
+
+template<typename CoordType, typename ValueType, typename OffsetType, typename Allocator>
+CSCMatrix<CoordType,ValueType,OffsetType,Allocator>
+read_csc(InputSource& source, const LoadOptions& options, const Allocator& allocator) {
+    return read_csc_input<CoordType,ValueType,OffsetType>(LoadInput(source), options, allocator);
+}
+
+///////////////////////////////////////////////////////////////////////////////
+// Read CSR and CSC
+///////////////////////////////////////////////////////////////////////////////
+
+template<typename CoordType, typename ValueType, typename OffsetType, typename Allocator>
+CSCMatrix<CoordType,ValueType,OffsetType,Allocator>
+csr_to_csc(const CSRMatrix<CoordType,ValueType,OffsetType,Allocator>& csr) {
+    typedef CSCMatrix<CoordType,ValueType,OffsetType,Allocator> Matrix;
+    const Allocator allocator(csr.col_indices.get_allocator());
+    Matrix csc{
+        csr.num_rows,
+        csr.num_cols,
+        csr.num_nonzeros,
+        csr.symmetry,
+        csr.index_base,
+        decltype(Matrix::col_offsets)(allocator),
+        decltype(Matrix::row_indices)(allocator),
+        decltype(Matrix::values)(allocator)
+    };
+    transpose_compressed(csr.num_cols, csr.index_base, csr.row_offsets, csr.col_indices, csr.values,
+                         csc.col_offsets, csc.row_indices, csc.values);
+    return csc;
+}
+
+template<typename CoordType, typename ValueType, typename OffsetType, typename Allocator>
+CSRMatrix<CoordType,ValueType,OffsetType,Allocator>
+csc_to_csr(const CSCMatrix<CoordType,ValueType,OffsetType,Allocator>& csc) {
+    typedef CSRMatrix<CoordType,ValueType,OffsetType,Allocator> Matrix;
+    const Allocator allocator(csc.row_indices.get_allocator());
+    Matrix csr{
+        csc.num_rows,
+        csc.num_cols,
+        csc.num_nonzeros,
+        csc.symmetry,
+        csc.index_base,
+        decltype(Matrix::row_offsets)(allocator),
+        decltype(Matrix::col_indices)(allocator),
+        decltype(Matrix::values)(allocator)
+    };
+    transpose_compressed(csc.num_rows, csc.index_base, csc.col_offsets, csc.row_indices, csc.values,
+                         csr.row_offsets, csr.col_indices, csr.values);
+    return csr;
+}
+
+// read_csr_csc around `read`, which loads the CSR with the options it is
+// given
+template<typename CoordType, typename ValueType, typename OffsetType, typename Allocator, typename Read>
+std::pair<CSRMatrix<CoordType,ValueType,OffsetType,Allocator>, CSCMatrix<CoordType,ValueType,OffsetType,Allocator>>
+read_csr_csc_with(const LoadOptions& options, Read read) {
+
+    // The transpose is reported as part of the assembly, so the TOTAL of
+    // read_csr is held back until it is done
+    LoadOptions csr_options = options;
+    if (options.on_phase) {
+        csr_options.on_phase = [&options](LoadPhase phase, double seconds) {
+            if (phase != LoadPhase::TOTAL) {
+                options.on_phase(phase, seconds);
+            }
+        };
+    }
+
+    // The matrices are built in place, as allocators need not be default
+    // constructible
+    double total_seconds = 0;
+    double transpose_seconds = 0;
+    std::unique_ptr<PhaseTimer> total(new PhaseTimer(total_seconds));
+    CSRMatrix<CoordType,ValueType,OffsetType,Allocator> csr = read(csr_options);
+    std::unique_ptr<PhaseTimer> timer(new PhaseTimer(transpose_seconds));
+    auto csc = csr_to_csc(csr);
+    timer.reset();
+    total.reset();
+
+    if (options.stats != nullptr) {
+        options.stats->matrix_bytes += matrix_bytes(csc);
+        options.stats->peak_bytes = std::max(options.stats->peak_bytes, options.stats->matrix_bytes);
+        options.stats->assemble_seconds += transpose_seconds;
+        options.stats->total_seconds += transpose_seconds;
+    }
+    if (options.on_phase) {
+        options.on_phase(LoadPhase::ASSEMBLE, transpose_seconds);
+        options.on_phase(LoadPhase::TOTAL, total_seconds);
+    }
+
+    return std::make_pair(std::move(csr), std::move(csc));
+}
+
+template<typename CoordType, typename ValueType, typename OffsetType, typename Allocator>
+std::pair<CSRMatrix<CoordType,ValueType,OffsetType,Allocator>, CSCMatrix<CoordType,ValueType,OffsetType,Allocator>>
+read_csr_csc(const char* filename, const LoadOptions& options, const Allocator& allocator) {
+    return read_csr_csc_with<CoordType,ValueType,OffsetType,Allocator>(options,
+        [&](const LoadOptions& csr_options) {
+            return read_csr<CoordType,ValueType,OffsetType>(filename, csr_options, allocator);
+        });
+}
+
+template<typename CoordType, typename ValueType, typename OffsetType, typename Allocator>
+std::pair<CSRMatrix<CoordType,ValueType,OffsetType,Allocator>, CSCMatrix<CoordType,ValueType,OffsetType,Allocator>>
+read_csr_csc(const char* data, size_t size, const LoadOptions& options, const Allocator& allocator) {
+    return read_csr_csc_with<CoordType,ValueType,OffsetType,Allocator>(options,
+        [&](const LoadOptions& csr_options) {
+            return read_csr<CoordType,ValueType,OffsetType>(data, size, csr_options, allocator);
+        });
+}
+
+template<typename CoordType, typename ValueType, typename OffsetType, typename Allocator>
+std::pair<CSRMatrix<CoordType,ValueType,OffsetType,Allocator>, CSCMatrix<CoordType,ValueType,OffsetType,Allocator>>
+read_csr_csc(InputSource& source, const LoadOptions& options, const Allocator& allocator) {
+    return read_csr_csc_with<CoordType,ValueType,OffsetType,Allocator>(options,
+        [&](const LoadOptions& csr_options) {
+            return read_csr<CoordType,ValueType,OffsetType>(source, csr_options, allocator);
+        });
+}
+
+///////////////////////////////////////////////////////////////////////////////
+// Read BSR and SELL-C-sigma
+///////////////////////////////////////////////////////////////////////////////
+
+template<typename CoordType, typename ValueType, typename OffsetType, typename Allocator>
+size_t matrix_bytes(const BSRMatrix<CoordType,ValueType,OffsetType,Allocator>& bsr) {
+    return vector_bytes(bsr.row_offsets) + vector_bytes(bsr.col_indices) + vector_bytes(bsr.values);
+}
+
+template<typename CoordType, typename ValueType, typename OffsetType, typename Allocator>
+size_t matrix_bytes(const SELLMatrix<CoordType,ValueType,OffsetType,Allocator>& sell) {
+    return vector_bytes(sell.chunk_offsets) + vector_bytes(sell.permutation) + vector_bytes(sell.col_indices) +
+           vector_bytes(sell.values);
+}
+
+// Loads the input as 0-based CSR arrays and hands them to `build`, which
+// returns the output matrix and the padding it added. The build is reported
+// as part of ASSEMBLE; the peak counts the CSR arrays next to the output.
+template<typename Matrix, typename CoordType, typename ValueType, typename OffsetType, typename Build>
+Matrix read_and_build(const LoadInput& input, const LoadOptions& options, Build build) {
+    check_index_base(options);
+    LoadStats stats;
+    LoadOptions csr_options = options;
+    csr_options.index_base = 0;
+    // The matrix is built from the CSR on this thread anyway
+    csr_options.first_touch = false;
+    csr_options.stats = &stats;
+    if (options.on_phase) {
+        csr_options.on_phase = [&options](LoadPhase phase, double seconds) {
+            if (phase != LoadPhase::TOTAL) {
+                options.on_phase(phase, seconds);
+            }
+        };
+    }
+
+    double total_seconds = 0;
+    double build_seconds = 0;
+    std::unique_ptr<PhaseTimer> total(new PhaseTimer(total_seconds));
+    std::vector<OffsetType> offsets;
+    std::vector<CoordType> indices;
+    typename ValueTraits<ValueType>::array_type values;
+    const auto header = read_compressed<CoordType,ValueType>(input, csr_options, false, offsets, indices, values);
+    if (options.permutation != nullptr && options.reordering != Reordering::NONE) {
+        for (auto& p : *options.permutation) {
+            p += options.index_base;
+        }
+    }
+    const size_t csr_bytes = vector_bytes(offsets) + vector_bytes(indices) + vector_bytes(values);
+
+    std::unique_ptr<PhaseTimer> timer(new PhaseTimer(build_seconds));
+    size_t padding = 0;
+    Matrix matrix = build(header, offsets, indices, values, padding);
+    timer.reset();
+    release_vector(offsets);
+    release_vector(indices);
+    release_vector(values);
+    total.reset();
+
+    if (options.stats != nullptr) {
+        stats.matrix_bytes = matrix_bytes(matrix);
+        stats.peak_bytes = std::max(stats.peak_bytes, csr_bytes + stats.matrix_bytes);
+        stats.padding_entries = padding;
+        stats.assemble_seconds += build_seconds;
+        stats.total_seconds += build_seconds;
+        *options.stats = stats;
+    }
+    if (options.on_phase) {
+        options.on_phase(LoadPhase::ASSEMBLE, build_seconds);
+        options.on_phase(LoadPhase::TOTAL, total_seconds);
+    }
+    return matrix;
+}
+
+template<typename CoordType, typename ValueType, typename OffsetType, typename Allocator>
+BSRMatrix<CoordType,ValueType,OffsetType,Allocator>
+read_bsr(const char* filename, CoordType block_rows, CoordType block_cols,
+         const LoadOptions& options, const Allocator& allocator) {
+    typedef BSRMatrix<CoordType,ValueType,OffsetType,Allocator> Matrix;
+    if (block_rows < 1 || block_cols < 1) {
+        throw std::invalid_argument("block_rows and block_cols must be positive");
+    }
+    const size_t R = static_cast<size_t>(block_rows);
+    const size_t C = static_cast<size_t>(block_cols);
+
+    return read_and_build<Matrix,CoordType,ValueType,OffsetType>(LoadInput(filename), options,
+        [&](const Header<CoordType>& header, const std::vector<OffsetType>& offsets,
+            const std::vector<CoordType>& indices, const typename ValueTraits<ValueType>::array_type& values,
+            size_t& padding) {
+        const size_t num_rows = static_cast<size_t>(header.num_rows);
+        const size_t num_cols = static_cast<size_t>(header.num_cols);
+        const size_t num_block_rows = num_rows / R + (num_rows % R != 0 ? 1 : 0);
+        const size_t num_block_cols = num_cols / C + (num_cols % C != 0 ? 1 : 0);
+
+        // The block columns of each block row, first counted and then
+        // numbered in order; `slot` maps a block column to its block within
+        // the current block row
+        const size_t none = std::numeric_limits<size_t>::max();
+        std::vector<size_t> slot(num_block_cols, none);
+        std::vector<size_t> found;
+        decltype(Matrix::row_offsets) row_offsets(num_block_rows + 1, 0, allocator);
+        for (size_t i = 0; i < num_block_rows; i++) {
+            found.clear();
+            for (size_t k = static_cast<size_t>(offsets[i * R]);
+                 k < static_cast<size_t>(offsets[std::min(num_rows, (i + 1) * R)]); k++) {
+                const size_t block_col = static_cast<size_t>(indices[k]) / C;
+                if (slot[block_col] == none) {
+                    slot[block_col] = 0;
+                    found.push_back(block_col);
+                }
+            }
+            for (size_t block_col : found) {
+                slot[block_col] = none;
+            }
+            row_offsets[i + 1] = row_offsets[i] + static_cast<OffsetType>(found.size());
+        }
+        const size_t num_blocks = static_cast<size_t>(row_offsets[num_block_rows]);
+        if (num_blocks > static_cast<size_t>(std::numeric_limits<OffsetType>::max() - options.index_base)) {
+            throw std::invalid_argument("Bad Matrix: too many blocks for OffsetType");
+        }
+
+        decltype(Matrix::col_indices) col_indices(allocator);
+        decltype(Matrix::values) block_values(allocator);
+        // Each block stores R * C values, which must not wrap around
+        if (R > std::numeric_limits<size_t>::max() / C ||
+            (num_blocks != 0 && R * C > block_values.max_size() / num_blocks)) {
+            throw std::invalid_argument("Bad Matrix: too many block values");
+        }
+        col_indices.resize(num_blocks);
+        block_values.resize(num_blocks * R * C);
+        const typename ValueTraits<ValueType>::value_type zero{};
+        for (size_t i = 0; i < block_values.size(); i++) {
+            block_values[i] = zero;
+        }
+        for (size_t i = 0; i < num_block_rows; i++) {
+            const size_t first_row = i * R;
+            const size_t last_row = std::min(num_rows, first_row + R);
+            const size_t first_block = static_cast<size_t>(row_offsets[i]);
+            found.clear();
+            const size_t end = static_cast<size_t>(offsets[last_row]);
+            for (size_t k = static_cast<size_t>(offsets[first_row]); k < end; k++) {
+                const size_t block_col = static_cast<size_t>(indices[k]) / C;
+                if (slot[block_col] == none) {
+                    slot[block_col] = 0;
+                    found.push_back(block_col);
+                }
+            }
+            std::sort(found.begin(), found.end());
+            for (size_t b = 0; b < found.size(); b++) {
+                slot[found[b]] = first_block + b;
+                col_indices[first_block + b] = static_cast<CoordType>(found[b]);
+            }
+            for (size_t row = first_row; row < last_row; row++) {
+                for (size_t k = static_cast<size_t>(offsets[row]); k < static_cast<size_t>(offsets[row + 1]); k++) {
+                    const size_t col = static_cast<size_t>(indices[k]);
+                    const size_t block = slot[col / C];
+                    accumulate_value(block_values[(block * R + row - first_row) * C + col % C], values[k]);
+                }
+            }
+            for (size_t block_col : found) {
+                slot[block_col] = none;
+            }
+        }
+        padding = num_blocks * R * C - indices.size();
+        if (options.index_base == 1) {
+            make_one_based(row_offsets, col_indices);
+        }
+
+        return Matrix{
+            header.num_rows,
+            header.num_cols,
+            block_rows,
+            block_cols,
+            static_cast<OffsetType>(num_blocks),
+            stored_symmetry(header, options),
+            options.index_base,
+            std::move(row_offsets),
+            std::move(col_indices),
+            std::move(block_values)
+        };
+    });
+}
+
+template<typename CoordType, typename ValueType, typename OffsetType, typename Allocator>
+SELLMatrix<CoordType,ValueType,OffsetType,Allocator>
+read_sell(const char* filename, CoordType chunk_size, CoordType sort_window,
+          const LoadOptions& options, const Allocator& allocator) {
+    typedef SELLMatrix<CoordType,ValueType,OffsetType,Allocator> Matrix;
+    if (chunk_size < 1) {
+        throw std::invalid_argument("chunk_size must be positive");
+    }
+    if (sort_window != 1 && (sort_window < 1 || sort_window % chunk_size != 0)) {
+        throw std::invalid_argument("sort_window must be 1 or a multiple of chunk_size");
+    }
+    const size_t C = static_cast<size_t>(chunk_size);
+    const size_t window = static_cast<size_t>(sort_window);
+
+    return read_and_build<Matrix,CoordType,ValueType,OffsetType>(LoadInput(filename), options,
+        [&](const Header<CoordType>& header, const std::vector<OffsetType>& offsets,
+            const std::vector<CoordType>& indices, const typename ValueTraits<ValueType>::array_type& values,
+            size_t& padding) {
+        const size_t num_rows = static_cast<size_t>(header.num_rows);
+        const size_t num_chunks = (num_rows + C - 1) / C;
+        auto length = [&](size_t row) {
+            return static_cast<size_t>(offsets[row + 1] - offsets[row]);
+        };
+
+        // Longest rows first within each window, otherwise in row order
+        decltype(Matrix::permutation) permutation(allocator);
+        permutation.resize(num_rows);
+        for (size_t row = 0; row < num_rows; row++) {
+            permutation[row] = static_cast<CoordType>(row);
+        }
+        if (window > 1) {
+            for (size_t first = 0; first < num_rows; first += window) {
+                const size_t last = std::min(num_rows, first + window);
+                std::stable_sort(permutation.begin() + first, permutation.begin() + last,
+                                 [&](CoordType a, CoordType b) { return length(a) > length(b); });
+            }
+        }
+
+        decltype(Matrix::chunk_offsets) chunk_offsets(num_chunks + 1, 0, allocator);
+        size_t slots = 0;
+        for (size_t c = 0; c < num_chunks; c++) {
+            size_t width = 0;
+            for (size_t s = c * C; s < std::min(num_rows, (c + 1) * C); s++) {
+                width = std::max(width, length(static_cast<size_t>(permutation[s])));
+            }
+            slots += width * C;
+            if (slots > static_cast<size_t>(std::numeric_limits<OffsetType>::max() - options.index_base)) {
+                throw std::invalid_argument("Bad Matrix: too many entries for OffsetType after padding");
+            }
+            chunk_offsets[c + 1] = static_cast<OffsetType>(slots);
+        }
+
+        decltype(Matrix::col_indices) col_indices(allocator);
+        decltype(Matrix::values) sell_values(allocator);
+        col_indices.resize(slots);
+        sell_values.resize(slots);
+        const typename ValueTraits<ValueType>::value_type zero{};
+        for (size_t c = 0; c < num_chunks; c++) {
+            const size_t begin = static_cast<size_t>(chunk_offsets[c]);
+            const size_t width = (static_cast<size_t>(chunk_offsets[c + 1]) - begin) / C;
+            for (size_t r = 0; r < C; r++) {
+                const size_t s = c * C + r;
+                const size_t row = s < num_rows ? static_cast<size_t>(permutation[s]) : 0;
+                const size_t filled = s < num_rows ? length(row) : 0;
+                const size_t first = s < num_rows ? static_cast<size_t>(offsets[row]) : 0;
+                for (size_t j = 0; j < width; j++) {
+                    const size_t pos = begin + j * C + r;
+                    col_indices[pos] = j < filled ? indices[first + j] : 0;
+                    sell_values[pos] = j < filled ? values[first + j] : zero;
+                }
+            }
+        }
+        padding = slots - indices.size();
+        if (options.index_base == 1) {
+            make_one_based(chunk_offsets, col_indices);
+            for (auto& row : permutation) {
+                row++;
+            }
+        }
+
+        return Matrix{
+            header.num_rows,
+            header.num_cols,
+            static_cast<OffsetType>(indices.size()),
+            chunk_size,
+            sort_window,
+            stored_symmetry(header, options),
+            options.index_base,
+            std::move(chunk_offsets),
+            std::move(permutation),
+            std::move(col_indices),
+            std::move(sell_values)
+        };
+    });
+}
+
+///////////////////////////////////////////////////////////////////////////////
+// Packed CSR
+///////////////////////////////////////////////////////////////////////////////
+
+template<typename CoordType, typename ValueType, typename OffsetType, typename Allocator>
+size_t matrix_bytes(const PackedCSRMatrix<CoordType,ValueType,OffsetType,Allocator>& packed) {
+    return vector_bytes(packed.row_offsets) + vector_bytes(packed.row_bytes) + vector_bytes(packed.encoded) +
+           vector_bytes(packed.values);
+}
+
+// Length code of a gap: 0 to 3 for 1, 2, 4 or 8 bytes
+inline unsigned packed_gap_code(uint64_t gap) {
+    return gap < (uint64_t(1) << 8) ? 0 : gap < (uint64_t(1) << 16) ? 1 : gap < (uint64_t(1) << 32) ? 2 : 3;
+}
+
+// Encodes the sorted indices [begin, end) at `out` when it is set, and
+// returns the number of bytes they take
+template<typename CoordType>
+size_t encode_packed_row(const CoordType* begin, const CoordType* end, unsigned char* out) {
+    size_t bytes = 0;
+    uint64_t previous = 0;
+    for (const CoordType* group = begin; group < end; group += 4) {
+        const size_t lanes = std::min<size_t>(4, static_cast<size_t>(end - group));
+        unsigned control = 0;
+        const size_t control_byte = bytes++;
+        for (size_t k = 0; k < lanes; k++) {
+            const uint64_t index = static_cast<uint64_t>(group[k]);
+            const uint64_t gap = index - previous;
+            previous = index;
+            const unsigned code = packed_gap_code(gap);
+            control |= code << (2 * k);
+            if (out != nullptr) {
+                for (unsigned b = 0; b < (1u << code); b++) {
+                    out[bytes + b] = static_cast<unsigned char>(gap >> (8 * b));
+                }
+            }
+            bytes += 1u << code;
+        }
+        if (out != nullptr) {
+            out[control_byte] = static_cast<unsigned char>(control);
+        }
+    }
+    return bytes;
+}
+
+template<typename CoordType, typename ValueType, typename OffsetType, typename Allocator>
+PackedCSRMatrix<CoordType,ValueType,OffsetType,Allocator>
+read_packed_csr(const char* filename, const LoadOptions& options, const Allocator& allocator) {
+    typedef PackedCSRMatrix<CoordType,ValueType,OffsetType,Allocator> Matrix;
+    return read_and_build<Matrix,CoordType,ValueType,OffsetType>(LoadInput(filename), options,
+        [&](const Header<CoordType>& header, const std::vector<OffsetType>& offsets,
+            const std::vector<CoordType>& indices, const typename ValueTraits<ValueType>::array_type& values,
+            size_t&) {
+        const size_t num_rows = static_cast<size_t>(header.num_rows);
+        const size_t nnz = indices.size();
+        const unsigned num_threads = options.mode == LoadMode::PARALLEL ?
+            static_cast<unsigned>(std::max<size_t>(1, std::min<size_t>(resolve_num_threads(options.num_threads),
+                                                                       num_rows))) : 1;
+
+        // Rows split into parts of about equal nonzero counts
+        std::vector<size_t> parts(num_threads + 1, num_rows);
+        for (unsigned t = 0; t < num_threads; t++) {
+            const OffsetType target = static_cast<OffsetType>(nnz / num_threads * t);
+            parts[t] = static_cast<size_t>(std::lower_bound(offsets.begin(), offsets.end() - 1, target) -
+                                           offsets.begin());
+        }
+
+        decltype(Matrix::row_bytes) row_bytes(num_rows + 1, 0, allocator);
+        parallel_for_threads(num_threads, [&](unsigned t) {
+            for (size_t row = parts[t]; row < parts[t + 1]; row++) {
+                row_bytes[row + 1] = encode_packed_row(indices.data() + offsets[row],
+                                                       indices.data() + offsets[row + 1],
+                                                       static_cast<unsigned char*>(nullptr));
+            }
+        });
+        for (size_t row = 0; row < num_rows; row++) {
+            row_bytes[row + 1] += row_bytes[row];
+        }
+
+        decltype(Matrix::encoded) encoded(row_bytes[num_rows] + packed_padding, 0, allocator);
+        parallel_for_threads(num_threads, [&](unsigned t) {
+            for (size_t row = parts[t]; row < parts[t + 1]; row++) {
+                encode_packed_row(indices.data() + offsets[row], indices.data() + offsets[row + 1],
+                                  encoded.data() + row_bytes[row]);
+            }
+        });
+
+        decltype(Matrix::row_offsets) row_offsets(offsets.begin(), offsets.end(), allocator);
+        decltype(Matrix::values) packed_values(allocator);
+        packed_values.resize(values.size());
+        for (size_t i = 0; i < values.size(); i++) {
+            packed_values[i] = values[i];
+        }
+        if (options.index_base == 1) {
+            for (auto& offset : row_offsets) {
+                offset++;
+            }
+        }
+
+        return Matrix{
+            header.num_rows,
+            header.num_cols,
+            static_cast<OffsetType>(nnz),
+            stored_symmetry(header, options),
+            options.index_base,
+            std::move(row_offsets),
+            std::move(row_bytes),
+            std::move(encoded),
+            std::move(packed_values)
+        };
+    });
+}
+
+///////////////////////////////////////////////////////////////////////////////
+// Header peek and estimates
+///////////////////////////////////////////////////////////////////////////////
+
+// An uncompressed file read through stdio, for when only its start is needed
+class FileSource : public InputSource {
+public:
+    explicit FileSource(const char* filename) : file(std::fopen(filename, "rb")) {
+        if (file == nullptr) {
+            throw std::invalid_argument("Could not open file for reading");
+        }
+    }
+    ~FileSource() {
+        std::fclose(file);
+    }
+    FileSource(const FileSource&) = delete;
+    FileSource& operator=(const FileSource&) = delete;
+
+    size_t read(char* out, size_t capacity) {
+        return std::fread(out, 1, capacity, file);
+    }
+private:
+    FILE* file;
+};
+
+// The decoded start of a file: the bytes read so far and where its header
+// ends. `source` can carry on reading the entries of compressed files.
+struct FilePrefix {
+    std::unique_ptr<MappedFile> mapped;
+    std::unique_ptr<InputSource> source;
+    std::vector<char> buffer;
+    MatrixInfo info;
+    size_t header_bytes;
+};
+
+inline void read_file_prefix(const char* filename, FilePrefix& prefix) {
+    struct stat st;
+    if (::stat(filename, &st) != 0) {
+        throw std::invalid_argument("Could not open file for reading");
+    }
+    const Compression compression = detect_compression(filename);
+    if (compression == Compression::NONE) {
+        prefix.source.reset(new FileSource(filename));
+    } else {
+        prefix.mapped.reset(new MappedFile(filename));
+        prefix.source = make_decompressor(compression, prefix.mapped->data(), prefix.mapped->size());
+    }
+    const char* header_end;
+    prefix.buffer = read_header_prefix(*prefix.source, header_end);
+    const char* begin = prefix.buffer.data();
+    const char* end = header_end != nullptr ? header_end : begin + prefix.buffer.size();
+
+    const char* pos = begin;
+    std::string banner = next_line(pos, end);
+    Tokens tokens(banner);
+    bool dense = false;
+    if (tokens.size() >= 3) {
+        tokens.pop();
+        tokens.pop();
+        dense = tokens.pop() == "array";
+    }
+    pos = begin;
+    const auto header = read_header<uint64_t>(pos, end, dense);
+
+    prefix.header_bytes = static_cast<size_t>(pos - begin);
+    prefix.info.symmetry = header.symmetry;
+    prefix.info.value_format = header.value_type;
+    prefix.info.dense = dense;
+    prefix.info.num_rows = header.num_rows;
+    prefix.info.num_cols = header.num_cols;
+    prefix.info.num_nonzeros = header.num_nonzeros;
+    prefix.info.num_comment_lines = header.num_comment_lines;
+    prefix.info.file_bytes = static_cast<uint64_t>(st.st_size);
+    prefix.info.compressed = compression != Compression::NONE;
+}
+
+inline MatrixInfo peek_header(const char* filename) {
+    FilePrefix prefix;
+    read_file_prefix(filename, prefix);
+    return prefix.info;
+}
+
+// The row and column of the entry line at `pos`, false if it doesn't
+// start with two indices within the matrix
+inline bool sample_entry(const char* pos, const char* end, const MatrixInfo& info,
+                         uint64_t& row, uint64_t& col) {
+    skip_blanks(pos, end);
+    if (!parse_int_inplace(pos, end, row)) {
+        return false;
+    }
+    skip_blanks(pos, end);
+    return parse_int_inplace(pos, end, col) && row >= 1 && row <= info.num_rows && col >= 1 &&
+           col <= info.num_cols;
+}
+
+// Appends the rows the entries of up to `max_lines` lines of [pos, end)
+// land in after symmetric expansion, and counts the lines and diagonal ones
+inline void sample_lines_at(const char* pos, const char* end, const MatrixInfo& info, size_t max_lines,
+                            std::vector<uint64_t>& rows, size_t& lines, size_t& diagonal) {
+    for (size_t i = 0; i < max_lines && pos != end; i++) {
+        const char* newline = static_cast<const char*>(std::memchr(pos, '\n', end - pos));
+        const char* line_end = newline != nullptr ? newline : end;
+        uint64_t row, col;
+        if (sample_entry(pos, line_end, info, row, col)) {
+            lines++;
+            rows.push_back(row - 1);
+            if (row == col) {
+                diagonal++;
+            } else if (info.symmetry != SymmetryType::GENERAL) {
+                rows.push_back(col - 1);
+            }
+        }
+        pos = newline != nullptr ? newline + 1 : end;
+    }
+}
+
+inline MatrixEstimate estimate_stats(const char* filename, size_t sample_lines) {
+    FilePrefix prefix;
+    read_file_prefix(filename, prefix);
+    const MatrixInfo& info = prefix.info;
+    if (info.dense) {
+        throw std::invalid_argument("estimate_stats needs a coordinate file");
+    }
+
+    std::vector<uint64_t> rows;
+    size_t lines = 0;
+    size_t diagonal = 0;
+    const bool whole = sample_lines == 0 || info.num_nonzeros <= sample_lines;
+    if (info.compressed || whole) {
+        // Lines in file order, decoding more of the stream as needed
+        std::vector<char>& buffer = prefix.buffer;
+        size_t consumed = prefix.header_bytes;
+        const size_t wanted = static_cast<size_t>(whole ? info.num_nonzeros : sample_lines);
+        size_t seen = 0;
+        bool eof = false;
+        while (seen < wanted) {
+            const char* begin = buffer.data() + consumed;
+            const char* stop = eof ? buffer.data() + buffer.size()
+                                   : after_last_newline(begin, buffer.data() + buffer.size());
+            const size_t count = std::min(count_lines(begin, stop), wanted - seen);
+            sample_lines_at(begin, stop, info, count, rows, lines, diagonal);
+            seen += count;
+            consumed = static_cast<size_t>(stop - buffer.data());
+            if (eof || seen == wanted) {
+                break;
+            }
+            buffer.erase(buffer.begin(), buffer.begin() + consumed);
+            consumed = 0;
+            const size_t size = buffer.size();
+            const size_t step = size_t(1) << 20;
+            buffer.resize(size + step);
+            const size_t n = prefix.source->read(buffer.data() + size, step);
+            buffer.resize(size + n);
+            eof = n == 0;
+        }
+    } else {
+        // Lines that follow random positions of the entry section, visited
+        // in file order
+        prefix.source.reset();
+        MappedFile file(filename);
+        ::madvise(const_cast<char*>(file.data()), file.size(), MADV_RANDOM);
+        const char* entries = file.begin() + prefix.header_bytes;
+        const size_t span = static_cast<size_t>(file.end() - entries);
+        std::vector<size_t> positions(span != 0 ? sample_lines : 0);
+        uint64_t state = 0x9e3779b97f4a7c15ull;
+        for (auto& position : positions) {
+            // splitmix64
+            uint64_t z = (state += 0x9e3779b97f4a7c15ull);
+            z = (z ^ (z >> 30)) * 0xbf58476d1ce4e5b9ull;
+            z = (z ^ (z >> 27)) * 0x94d049bb133111ebull;
+            position = static_cast<size_t>((z ^ (z >> 31)) % span);
+        }
+        std::sort(positions.begin(), positions.end());
+        for (size_t position : positions) {
+            const char* pos = entries + position;
+            const char* newline = static_cast<const char*>(std::memchr(pos, '\n', file.end() - pos));
+            if (newline != nullptr) {
+                sample_lines_at(newline + 1, file.end(), info, 1, rows, lines, diagonal);
+            }
+        }
+    }
+
+    MatrixEstimate estimate;
+    estimate.info = info;
+    estimate.sampled_lines = lines;
+    estimate.max_row_length = 0;
+    estimate.row_lengths.assign(1, info.num_rows);
+    if (lines == 0) {
+        estimate.expanded_nonzeros = info.num_nonzeros;
+        return estimate;
+    }
+    const double share = static_cast<double>(lines) / static_cast<double>(info.num_nonzeros);
+    estimate.expanded_nonzeros = info.num_nonzeros;
+    if (info.symmetry != SymmetryType::GENERAL) {
+        estimate.expanded_nonzeros += static_cast<uint64_t>(
+            std::llround(static_cast<double>(info.num_nonzeros) * static_cast<double>(lines - diagonal) /
+                         static_cast<double>(lines)));
+    }
+
+    // A row sampled k times has about k / share entries, and is weighted by
+    // the inverse of the chance that it was sampled at all
+    std::sort(rows.begin(), rows.end());
+    std::vector<double> weights(1, 0);
+    double listed = 0;
+    for (size_t i = 0; i < rows.size();) {
+        size_t j = i;
+        while (j < rows.size() && rows[j] == rows[i]) {
+            j++;
+        }
+        const double length = std::max(1.0, std::round(static_cast<double>(j - i) / share));
+        const double weight = share >= 1 ? 1.0 : 1.0 / (1.0 - std::pow(1.0 - share, length));
+        const uint64_t whole_length = static_cast<uint64_t>(length);
+        size_t bucket = 1;
+        while ((uint64_t(1) << bucket) <= whole_length) {
+            bucket++;
+        }
+        if (weights.size() <= bucket) {
+            weights.resize(bucket + 1, 0);
+        }
+        weights[bucket] += weight;
+        listed += weight;
+        estimate.max_row_length = std::max(estimate.max_row_length, whole_length);
+        i = j;
+    }
+    estimate.row_lengths.resize(weights.size());
+    for (size_t k = 1; k < weights.size(); k++) {
+        estimate.row_lengths[k] = static_cast<uint64_t>(std::llround(weights[k]));
+    }
+    estimate.row_lengths[0] = static_cast<uint64_t>(std::max(0.0, static_cast<double>(info.num_rows) - listed));
+    return estimate;
+}
+
+///////////////////////////////////////////////////////////////////////////////
+// Asynchronous loading
 ///////////////////////////////////////////////////////////////////////////////
 
-template<typename CoordType, typename ValueType>
-struct CSRMatrix {
-    CoordType num_rows;
-    CoordType num_cols;
-    CoordType num_nonzeros;
-    std::vector<CoordType> row_offsets;
-    std::vector<CoordType> col_indices;
-    std::vector<ValueType> values;
-};
+inline LoadPool::LoadPool(unsigned num_workers) : stopping(false) {
+    num_workers = resolve_num_threads(num_workers);
+    workers.reserve(num_workers);
+    for (unsigned t = 0; t < num_workers; t++) {
+        workers.emplace_back([this]() { work(); });
+    }
+}
 
-template<typename CoordType, typename ValueType>
-CSRMatrix<CoordType,ValueType> read_csr(const char* filename);
+inline LoadPool::~LoadPool() {
+    {
+        std::lock_guard<std::mutex> lock(mutex);
+        stopping = true;
+    }
+    changed.notify_all();
+    for (auto& worker : workers) {
+        worker.join();
+    }
+}
 
-template<typename CoordType, typename ValueType>
-struct CSCMatrix {
-    CoordType num_rows;
-    CoordType num_cols;
-    CoordType num_nonzeros;
-    std::vector<CoordType> col_offsets;
-    std::vector<CoordType> row_indices;
-    std::vector<ValueType> values;
-};
+// std::function needs a copyable callable, hence the shared packaged_task
+template<typename Function>
+auto LoadPool::submit(Function f) -> std::future<decltype(f())> {
+    auto task = std::make_shared<std::packaged_task<decltype(f())()>>(std::move(f));
+    auto future = task->get_future();
+    {
+        std::lock_guard<std::mutex> lock(mutex);
+        tasks.push_back([task]() { (*task)(); });
+    }
+    changed.notify_one();
+    return future;
+}
 
-template<typename CoordType, typename ValueType>
-CSCMatrix<CoordType,ValueType> read_csc(const char* filename);
+// Workers finish the queue before they stop
+inline void LoadPool::work() {
+    while (true) {
+        std::unique_lock<std::mutex> lock(mutex);
+        changed.wait(lock, [this]() { return !tasks.empty() || stopping; });
+        if (tasks.empty()) {
+            return;
+        }
+        std::function<void()> task = std::move(tasks.front());
+        tasks.pop_front();
+        lock.unlock();
+        task();
+    }
+}
 
-///////////////////////////////////////////////////////////////////////////////
-// Utility struct for the header
-///////////////////////////////////////////////////////////////////////////////
+// The options of a load on `pool`, see read_csr_async
+inline LoadOptions pool_options(const LoadPool& pool, const LoadOptions& options) {
+    LoadOptions shared = options;
+    if (shared.mode == LoadMode::PARALLEL && shared.num_threads == 0) {
+        shared.num_threads = std::max(1u, resolve_num_threads(0) / pool.num_workers());
+    }
+    return shared;
+}
 
-enum class SymmetryType { GENERAL, SYMMETRIC };
-enum class ValueFormat { REAL, INTEGER, PATTERN };
+template<typename CoordType, typename ValueType, typename OffsetType, typename Allocator>
+std::future<CSRMatrix<CoordType,ValueType,OffsetType,Allocator>>
+read_csr_async(const char* filename, const LoadOptions& options, const Allocator& allocator) {
+    const std::string name = filename;
+    return std::async(std::launch::async, [name, options, allocator]() {
+        return read_csr<CoordType,ValueType,OffsetType>(name.c_str(), options, allocator);
+    });
+}
 
-template<typename CoordType>
-struct Header {
-    SymmetryType symmetry;
-    ValueFormat value_type;
-    CoordType num_rows;
-    CoordType num_cols;
-    CoordType num_nonzeros;
-};
+template<typename CoordType, typename ValueType, typename OffsetType, typename Allocator>
+std::future<CSCMatrix<CoordType,ValueType,OffsetType,Allocator>>
+read_csc_async(const char* filename, const LoadOptions& options, const Allocator& allocator) {
+    const std::string name = filename;
+    return std::async(std::launch::async, [name, options, allocator]() {
+        return read_csc<CoordType,ValueType,OffsetType>(name.c_str(), options, allocator);
+    });
+}
 
-///////////////////////////////////////////////////////////////////////////////
-// Utility Token class
-///////////////////////////////////////////////////////////////////////////////
+template<typename CoordType, typename ValueType, typename OffsetType, typename Allocator>
+std::future<CSRMatrix<CoordType,ValueType,OffsetType,Allocator>>
+read_csr_async(LoadPool& pool, const char* filename, const LoadOptions& options, const Allocator& allocator) {
+    const std::string name = filename;
+    const LoadOptions shared = pool_options(pool, options);
+    return pool.submit([name, shared, allocator]() {
+        return read_csr<CoordType,ValueType,OffsetType>(name.c_str(), shared, allocator);
+    });
+}
 
-class Tokens {
-public:
-    Tokens(std::string& str, char sep) {
-        std::istringstream iss(str);
-        std::string token;
-        while (std::getline(iss, token, sep)) {
-            tokens.push_back(token);
-        }
+template<typename CoordType, typename ValueType, typename OffsetType, typename Allocator>
+std::future<CSCMatrix<CoordType,ValueType,OffsetType,Allocator>>
+read_csc_async(LoadPool& pool, const char* filename, const LoadOptions& options, const Allocator& allocator) {
+    const std::string name = filename;
+    const LoadOptions shared = pool_options(pool, options);
+    return pool.submit([name, shared, allocator]() {
+        return read_csc<CoordType,ValueType,OffsetType>(name.c_str(), shared, allocator);
+    });
+}
+
+template<typename CoordType, typename ValueType, typename OffsetType, typename Allocator>
+std::vector<std::future<CSRMatrix<CoordType,ValueType,OffsetType,Allocator>>>
+read_csr_batch(LoadPool& pool, const std::vector<std::string>& filenames,
+               const LoadOptions& options, const Allocator& allocator) {
+    if (options.stats != nullptr) {
+        throw std::invalid_argument("Batch loads can't share LoadOptions::stats");
     }
-    std::string pop() {
-        assert(!tokens.empty());
-        auto token = tokens.front();
-        tokens.pop_front();
-        return token;
+    std::vector<std::future<CSRMatrix<CoordType,ValueType,OffsetType,Allocator>>> futures;
+    for (const auto& filename : filenames) {
+        futures.push_back(read_csr_async<CoordType,ValueType,OffsetType>(pool, filename.c_str(), options,
+                                                                           allocator));
     }
-    std::string& peek() {
-        assert(!tokens.empty());
-        return tokens.front();
+    return futures;
+}
+
+template<typename CoordType, typename ValueType, typename OffsetType, typename Allocator>
+std::vector<std::future<CSCMatrix<CoordType,ValueType,OffsetType,Allocator>>>
+read_csc_batch(LoadPool& pool, const std::vector<std::string>& filenames,
+               const LoadOptions& options, const Allocator& allocator) {
+    if (options.stats != nullptr) {
+        throw std::invalid_argument("Batch loads can't share LoadOptions::stats");
     }
-    size_t size() { 
-        return tokens.size(); 
+    std::vector<std::future<CSCMatrix<CoordType,ValueType,OffsetType,Allocator>>> futures;
+    for (const auto& filename : filenames) {
+        futures.push_back(read_csc_async<CoordType,ValueType,OffsetType>(pool, filename.c_str(), options,
+                                                                           allocator));
     }
-private:
-    std::deque<std::string> tokens;
-};
+    return futures;
+}
 
 ///////////////////////////////////////////////////////////////////////////////
-// Utility functions
+// Read CSR blocks
 ///////////////////////////////////////////////////////////////////////////////
 
-inline ValueFormat parse_value_fmt(std::string value_fmt_string) {
-    if (value_fmt_string == "real") {
-        return ValueFormat::REAL;
-    } else if (value_fmt_string == "integer") {
-        return ValueFormat::INTEGER;
-    } else if (value_fmt_string == "pattern") {
-        return ValueFormat::PATTERN;
-    } else {
-        throw std::invalid_argument("Bad Header: unknown value format");
-    }
-}
+// Hands every entry to the bucket of its block, in buffer order
+template<typename CoordType, typename ValueType>
+void bucket_entries(CooBuffer<CoordType,ValueType>& coo, const std::vector<size_t>& row_bounds,
+                    const std::vector<size_t>& col_bounds,
+                    std::vector<BlockEntries<CoordType,ValueType>>& blocks) {
+    const size_t col_parts = col_bounds.size() - 1;
+    const size_t nnz = coo.size();
+    blocks.assign((row_bounds.size() - 1) * col_parts, BlockEntries<CoordType,ValueType>());
 
-inline SymmetryType parse_symmetry(std::string symmetry_string) {
-    if (symmetry_string == "general") {
-        return SymmetryType::GENERAL;
-    } else if (symmetry_string == "symmetric") {
-        return SymmetryType::SYMMETRIC;
-    } else {
-        throw std::invalid_argument("Bad Header: unknown symmetry");
+    std::vector<uint32_t> owner(nnz);
+    std::vector<size_t> counts(blocks.size(), 0);
+    for (size_t i = 0; i < nnz; i++) {
+        owner[i] = static_cast<uint32_t>(find_part(row_bounds, static_cast<size_t>(coo.rows[i])) * col_parts +
+                                         find_part(col_bounds, static_cast<size_t>(coo.cols[i])));
+        counts[owner[i]]++;
+    }
+    for (size_t b = 0; b < blocks.size(); b++) {
+        blocks[b].rows.resize(counts[b]);
+        blocks[b].cols.resize(counts[b]);
+        blocks[b].values.resize(counts[b]);
+        counts[b] = 0;
+    }
+    for (size_t i = 0; i < nnz; i++) {
+        auto& bucket = blocks[owner[i]];
+        const size_t k = counts[owner[i]]++;
+        bucket.rows[k] = coo.rows[i];
+        bucket.cols[k] = coo.cols[i];
+        bucket.values[k] = coo.values[i];
     }
 }
 
-template<typename IntType>
-IntType parse_int(std::string int_string) {
-    std::istringstream iss(int_string);
-    IntType int_val;
-    iss >> int_val;
-    return int_val;
+// The header of a compressed file, decoded from the start of the stream
+template<typename CoordType>
+Header<CoordType> read_stream_header(InputSource& source) {
+    const char* header_end;
+    const std::vector<char> buffer = read_header_prefix(source, header_end);
+    const char* pos = buffer.data();
+    return read_header<CoordType>(pos, header_end != nullptr ? header_end : buffer.data() + buffer.size());
 }
 
-template<typename NumType>
-NumType parse_num(std::string num_string) {
-    std::istringstream iss(num_string);
-    NumType num_val;
-    iss >> num_val;
-    return num_val;
-}
+template<typename CoordType, typename ValueType>
+BlockScan<CoordType,ValueType> scan_block_entries(const char* filename, const BlockGrid& grid,
+                                                  unsigned part, unsigned num_parts,
+                                                  const LoadOptions& options) {
+    if (part >= num_parts) {
+        throw std::invalid_argument("part must be less than num_parts");
+    }
+    if (options.reordering != Reordering::NONE) {
+        throw std::invalid_argument("reordering needs a load of the whole matrix");
+    }
 
-template<typename CoordType>
-Header<CoordType> read_header(std::ifstream& f) {
-    assert(f.is_open());
+    MemoryTracker memory;
+    LoadStats stats;
+    BlockScan<CoordType,ValueType> scan;
+    {
+        PhaseTimer total(stats, LoadPhase::TOTAL, options);
 
-    std::string line;
-    std::getline(f, line);
+        CooBuffer<CoordType,ValueType> coo;
+        Header<CoordType> header;
+        const Compression compression = detect_compression(filename);
+        if (compression != Compression::NONE && part == 0) {
+            header = read_nonzeros(filename, options, coo, stats);
+            stats.lines_parsed = header.num_nonzeros;
+        } else if (compression != Compression::NONE) {
+            PhaseTimer timer(stats, LoadPhase::HEADER, options);
+            MappedFile file(filename);
+            header = read_stream_header<CoordType>(*make_decompressor(compression, file.data(), file.size()));
+        } else {
+            std::unique_ptr<MappedFile> file;
+            const char* pos;
+            {
+                PhaseTimer timer(stats, LoadPhase::HEADER, options);
+                file.reset(new MappedFile(filename));
+                pos = file->begin();
+                header = read_header<CoordType>(pos, file->end());
+            }
+            PhaseTimer timer(stats, LoadPhase::PARSE, options);
 
-    auto format_tokens = Tokens(line, ' ');
-    if (format_tokens.size() != 5) {
-        throw std::invalid_argument("Bad Header: ill-shaped format line");
-    }
+            // Trailing blank space is cut off so that every part sees the
+            // same entry section
+            const char* end = trim_trailing_space(pos, file->end());
+            const auto bounds = split_lines(pos, end, num_parts);
+            auto part_header = entry_header(header, options);
+            part_header.num_nonzeros = count_lines(bounds[part], bounds[part + 1]);
+            // The lines before the part aren't counted, so errors carry no
+            // line number
+            ErrorSink sink;
+            sink.origin = file->begin();
+            if (options.mode == LoadMode::PARALLEL) {
+                parse_entries_parallel(bounds[part], bounds[part + 1], part_header,
+                                       resolve_num_threads(options.num_threads), coo, options.validation, &sink);
+            } else {
+                coo.resize(max_entries(part_header, part_header.num_nonzeros));
+                coo.resize(parse_entries(bounds[part], bounds[part + 1], part_header,
+                                         part_header.num_nonzeros, coo, 0, options.validation, &sink));
+            }
+            finish_validation(coo, part_header, options, sink);
+            stats.bytes_read = static_cast<size_t>(bounds[part + 1] - bounds[part]);
+            stats.lines_parsed = part_header.num_nonzeros;
+        }
+        memory.allocate(vector_bytes(coo.rows) + vector_bytes(coo.cols) + vector_bytes(coo.values));
+        stats.comment_lines = header.num_comment_lines;
+        stats.symmetric_expansions = coo.size() - stats.lines_parsed;
 
-    if (format_tokens.pop() != "%%MatrixMarket") {
-        throw std::invalid_argument("Bad Header: missing %%%%MatrixMarket");
-    }
+        fold_kept_triangle(coo, header, options, stats);
+        PhaseTimer timer(stats, LoadPhase::CONVERT, options);
+        std::vector<size_t> row_bounds, col_bounds;
+        grid_bounds(grid, header.num_rows, header.num_cols, row_bounds, col_bounds);
+        bucket_entries(coo, row_bounds, col_bounds, scan.blocks);
+        for (const auto& entries : scan.blocks) {
+            memory.allocate(vector_bytes(entries.rows) + vector_bytes(entries.cols) + vector_bytes(entries.values));
+        }
 
-    if (format_tokens.pop() != "matrix") {
-        throw std::invalid_argument("Bad Header: only matrix supported");
+        scan.num_rows = header.num_rows;
+        scan.num_cols = header.num_cols;
+        scan.num_nonzeros = header.num_nonzeros;
+        scan.lines_parsed = stats.lines_parsed;
     }
 
-    if (format_tokens.pop() != "coordinate") {
-        throw std::invalid_argument("Bad Header: only coordinate supported");
+    if (options.stats != nullptr) {
+        stats.peak_bytes = memory.peak_bytes();
+        *options.stats = stats;
     }
+    return scan;
+}
 
-    auto value_fmt = parse_value_fmt(format_tokens.pop());
-    auto symmetry = parse_symmetry(format_tokens.pop());
+template<typename CoordType, typename ValueType, typename OffsetType, typename Allocator>
+CSRBlock<CoordType,ValueType,OffsetType,Allocator>
+assemble_csr_block(CoordType num_rows, CoordType num_cols, const BlockGrid& grid, unsigned block,
+                   const std::vector<BlockEntries<CoordType,ValueType>>& received,
+                   const LoadOptions& options, const Allocator& allocator) {
+    typedef CSRMatrix<CoordType,ValueType,OffsetType,Allocator> Matrix;
+    check_index_base(options);
+    const BlockRange range = grid_block(grid, num_rows, num_cols, block);
 
-    do {
-        std::getline(f, line);
-    } while (line[0] == '%');
+    MemoryTracker memory;
+    LoadStats stats;
+    decltype(Matrix::row_offsets) row_offsets(allocator);
+    decltype(Matrix::col_indices) col_indices(allocator);
+    decltype(Matrix::values) values(allocator);
+    check_first_touch<decltype(row_offsets),decltype(col_indices),decltype(values)>(options);
+    {
+        PhaseTimer total(stats, LoadPhase::TOTAL, options);
+        std::unique_ptr<PhaseTimer> timer(new PhaseTimer(stats, LoadPhase::CONVERT, options));
 
-    auto mtx_size_tokens = Tokens(line, ' ');
-    if (mtx_size_tokens.size() != 3) {
-        throw std::invalid_argument("Bad Header: missing matrix size");
-    }
+        size_t nnz = 0;
+        for (const auto& entries : received) {
+            nnz += entries.rows.size();
+        }
+        CooBuffer<CoordType,ValueType> coo;
+        coo.resize(nnz);
+        memory.allocate(vector_bytes(coo.rows) + vector_bytes(coo.cols) + vector_bytes(coo.values));
+        size_t count = 0;
+        for (const auto& entries : received) {
+            for (size_t i = 0; i < entries.rows.size(); i++) {
+                coo.rows[count] = entries.rows[i];
+                coo.cols[count] = entries.cols[i];
+                coo.values[count] = entries.values[i];
+                count++;
+            }
+        }
+        coo.resize(count);
+        keep_block(coo, range);
+        if (coo.size() != count) {
+            throw std::invalid_argument("Bad Matrix: entry outside the block");
+        }
+        timer.reset();
 
-    auto num_rows = parse_int<CoordType>(mtx_size_tokens.pop());
-    auto num_cols = parse_int<CoordType>(mtx_size_tokens.pop());
-    auto num_nonzeros = parse_int<CoordType>(mtx_size_tokens.pop());
+        compress_entries(coo, static_cast<CoordType>(range.last_row - range.first_row), false, options,
+                         row_offsets, col_indices, values, memory, stats);
+    }
 
-    return Header<CoordType>{
-        symmetry,
-        value_fmt,
+    if (options.stats != nullptr) {
+        stats.peak_bytes = memory.peak_bytes();
+        stats.matrix_bytes = vector_bytes(row_offsets) + vector_bytes(col_indices) + vector_bytes(values);
+        *options.stats = stats;
+    }
+    return CSRBlock<CoordType,ValueType,OffsetType,Allocator>{
         num_rows,
         num_cols,
-        num_nonzeros
+        static_cast<CoordType>(range.first_row),
+        static_cast<CoordType>(range.first_col),
+        Matrix{
+            static_cast<CoordType>(range.last_row - range.first_row),
+            static_cast<CoordType>(range.last_col - range.first_col),
+            static_cast<OffsetType>(col_indices.size()),
+            SymmetryType::GENERAL,
+            options.index_base,
+            std::move(row_offsets),
+            std::move(col_indices),
+            std::move(values)
+        }
+    };
+}
+
+template<typename CoordType, typename ValueType, typename OffsetType, typename Allocator>
+CSRBlock<CoordType,ValueType,OffsetType,Allocator>
+read_csr_block(const char* filename, const BlockGrid& grid, unsigned block,
+               const LoadOptions& options, const Allocator& allocator) {
+    typedef CSRMatrix<CoordType,ValueType,OffsetType,Allocator> Matrix;
+
+    decltype(Matrix::row_offsets) row_offsets(allocator);
+    decltype(Matrix::col_indices) col_indices(allocator);
+    decltype(Matrix::values) values(allocator);
+    auto header = read_compressed<CoordType,ValueType>(LoadInput(filename), options, false,
+                                                       row_offsets, col_indices, values, &grid, block);
+    const BlockRange range = grid_block(grid, header.num_rows, header.num_cols, block);
+
+    return CSRBlock<CoordType,ValueType,OffsetType,Allocator>{
+        header.num_rows,
+        header.num_cols,
+        static_cast<CoordType>(range.first_row),
+        static_cast<CoordType>(range.first_col),
+        Matrix{
+            static_cast<CoordType>(range.last_row - range.first_row),
+            static_cast<CoordType>(range.last_col - range.first_col),
+            static_cast<OffsetType>(col_indices.size()),
+            SymmetryType::GENERAL,
+            options.index_base,
+            std::move(row_offsets),
+            std::move(col_indices),
+            std::move(values)
+        }
     };
 }
 
 ///////////////////////////////////////////////////////////////////////////////
-// Read CSR
+// Read dense
 ///////////////////////////////////////////////////////////////////////////////
 
-template <typename CoordType, typename ValueType>
-struct Nonzero {
-    CoordType row;
-    CoordType col;
-    ValueType value;
-};
+// First row listed for column `col` of an array file
+inline size_t dense_first_row(SymmetryType symmetry, size_t col) {
+    switch (symmetry) {
+    case SymmetryType::GENERAL:
+        return 0;
+    case SymmetryType::SKEW_SYMMETRIC:
+        return col + 1;
+    default:
+        return col;
+    }
+}
 
-template<typename CoordType, typename ValueType>
-CSRMatrix<CoordType,ValueType> read_csr(const char* filename) {
+// Parses `count` value lines starting at `pos`, holding the values from
+// number `first` on in file order, into their places in `out` (and their
+// mirrors into the upper triangle)
+template<ValueFormat Format, SymmetryType Symmetry, typename ValueType>
+void parse_dense_values_as(const char* pos, const char* end, const Header<size_t>& header,
+                           size_t first, size_t count, DenseLayout layout, ValueType* out) {
+    if (count == 0) {
+        return;
+    }
+    const size_t num_rows = header.num_rows;
+    const size_t row_stride = layout == DenseLayout::ROW_MAJOR ? header.num_cols : 1;
+    const size_t col_stride = layout == DenseLayout::ROW_MAJOR ? 1 : num_rows;
 
-    static_assert(std::is_integral<CoordType>::value, "CoordType must be integral");
-    static_assert(std::is_arithmetic<ValueType>::value, "ValueType must be arithmetic");
+    // Position of value number `first`
+    size_t col = 0;
+    size_t row = 0;
+    if (Symmetry == SymmetryType::GENERAL) {
+        col = first / num_rows;
+        row = first % num_rows;
+    } else {
+        row = dense_first_row(Symmetry, 0);
+        while (first >= num_rows - row) {
+            first -= num_rows - row;
+            row = dense_first_row(Symmetry, ++col);
+        }
+        row += first;
+    }
+
+    const char* ill_shaped = "Bad Matrix: ill-shaped value line";
+    for (size_t i = 0; i < count; i++) {
+        if (pos == end) {
+            throw std::invalid_argument("Bad Matrix: fewer values than declared");
+        }
+        ValueType value{};
+        parse_value_field<Format>(pos, end, value, ill_shaped);
+        finish_line(pos, end, ill_shaped);
+
+        out[row * row_stride + col * col_stride] = value;
+        if (Symmetry != SymmetryType::GENERAL && row != col) {
+            out[col * row_stride + row * col_stride] = mirror_value<Symmetry>(value);
+        }
+        if (++row == num_rows) {
+            row = dense_first_row(Symmetry, ++col);
+        }
+    }
+}
+
+template<ValueFormat Format, typename ValueType>
+void parse_dense_values_format(const char* pos, const char* end, const Header<size_t>& header,
+                               size_t first, size_t count, DenseLayout layout, ValueType* out) {
+    switch (header.symmetry) {
+    case SymmetryType::SYMMETRIC:
+        return parse_dense_values_as<Format, SymmetryType::SYMMETRIC>(pos, end, header, first, count, layout, out);
+    case SymmetryType::SKEW_SYMMETRIC:
+        return parse_dense_values_as<Format, SymmetryType::SKEW_SYMMETRIC>(pos, end, header, first, count, layout, out);
+    case SymmetryType::HERMITIAN:
+        return parse_dense_values_as<Format, SymmetryType::HERMITIAN>(pos, end, header, first, count, layout, out);
+    default:
+        return parse_dense_values_as<Format, SymmetryType::GENERAL>(pos, end, header, first, count, layout, out);
+    }
+}
 
-    std::ifstream infile(filename);
-    if (!infile.is_open()) {
-        throw new std::invalid_argument("Could not open file for reading");
+template<typename ValueType>
+void parse_dense_values(const char* pos, const char* end, const Header<size_t>& header,
+                        size_t first, size_t count, DenseLayout layout, ValueType* out) {
+    if (header.value_type == ValueFormat::COMPLEX) {
+        parse_dense_values_format<ValueFormat::COMPLEX>(pos, end, header, first, count, layout, out);
+    } else {
+        parse_dense_values_format<ValueFormat::REAL>(pos, end, header, first, count, layout, out);
     }
-    
-    auto header = read_header<CoordType>(infile);
+}
 
-    // Read in and populate the non-zeros in "COO format"
+// Parallel version of parse_dense_values for the whole value section, split
+// as in parse_entries_parallel. Every value has a fixed place in the output,
+// so the chunks need nothing but their first value number.
+template<typename ValueType>
+void parse_dense_parallel(const char* pos, const char* end, const Header<size_t>& header,
+                          unsigned num_threads, DenseLayout layout, ValueType* out) {
+    const size_t min_chunk_bytes = size_t(1) << 16;
+    const size_t max_chunks = std::max<size_t>(1, static_cast<size_t>(end - pos) / min_chunk_bytes);
+    num_threads = static_cast<unsigned>(std::min<size_t>(num_threads, max_chunks));
 
-    using NonzeroType = Nonzero<CoordType,ValueType>;
+    auto bounds = split_lines(pos, end, num_threads);
 
-    std::vector<NonzeroType> nonzeros;
-    for (CoordType i = 0; i < header.num_nonzeros; i++) {
-        std::string line;
-        std::getline(infile, line);
-        auto tokens = Tokens(line, ' ');
+    std::vector<size_t> chunk_lines(num_threads);
+    parallel_for_threads(num_threads, [&](unsigned t) {
+        chunk_lines[t] = count_lines(bounds[t], bounds[t + 1]);
+    });
 
-        if (header.value_type == ValueFormat::PATTERN && tokens.size() != 2) {
-            throw std::invalid_argument("Bad Matrix: ill-shaped pattern line");
-        } else if (header.value_type != ValueFormat::PATTERN && tokens.size() != 3) {
-            throw std::invalid_argument("Bad Matrix: ill-shaped value line");
-        }
+    size_t lines_before = 0;
+    std::vector<size_t> chunk_first(num_threads);
+    std::vector<size_t> chunk_limit(num_threads);
+    for (unsigned t = 0; t < num_threads; t++) {
+        const size_t remaining = header.num_nonzeros > lines_before ? header.num_nonzeros - lines_before : 0;
+        chunk_first[t] = lines_before;
+        chunk_limit[t] = std::min(remaining, chunk_lines[t]);
+        lines_before += chunk_lines[t];
+    }
+    if (lines_before < header.num_nonzeros) {
+        throw std::invalid_argument("Bad Matrix: fewer values than declared");
+    }
 
-        auto row = parse_int<CoordType>(tokens.pop());
-        auto col = parse_int<CoordType>(tokens.pop());
-        auto value = header.value_type == ValueFormat::PATTERN ? 1 : parse_num<ValueType>(tokens.pop());
+    parallel_for_threads(num_threads, [&](unsigned t) {
+        parse_dense_values(bounds[t], bounds[t + 1], header, chunk_first[t], chunk_limit[t], layout, out);
+    });
+}
 
-        if (row < 1 || row > header.num_rows) {
-            throw std::invalid_argument("Bad Matrix: row out of bounds");
+template<typename ValueType>
+DenseMatrix<ValueType> read_dense(const char* filename, const LoadOptions& options, DenseLayout layout) {
+
+    static_assert(std::is_arithmetic<ValueType>::value || is_complex<ValueType>::value,
+                  "ValueType must be arithmetic or std::complex");
+
+    LoadStats stats;
+    DenseMatrix<ValueType> dense;
+    {
+        PhaseTimer total(stats, LoadPhase::TOTAL, options);
+
+        std::unique_ptr<MappedFile> file;
+        {
+            PhaseTimer timer(stats, LoadPhase::HEADER, options);
+            file.reset(new MappedFile(filename));
         }
+        stats.bytes_read = file->size();
 
-        if (col < 1 || col > header.num_cols) {
-            throw std::invalid_argument("Bad Matrix: col out of bounds");
+        // Compressed files are decompressed into memory up front
+        const char* pos = file->begin();
+        const char* end = file->end();
+        std::vector<char> decompressed;
+        const Compression compression = detect_compression(file->data(), file->size());
+        if (compression != Compression::NONE) {
+            PhaseTimer timer(stats, LoadPhase::PARSE, options);
+            bool decoded = false;
+#ifdef MATRIXMARKET_WITH_ZSTD
+            if (compression == Compression::ZSTD && options.mode == LoadMode::PARALLEL) {
+                decoded = zstd_decompress_parallel(file->data(), file->size(),
+                                                   resolve_num_threads(options.num_threads), decompressed);
+            }
+#endif
+            if (!decoded) {
+                decompressed = decompress_all(compression, file->data(), file->size());
+            }
+            pos = decompressed.data();
+            end = pos + decompressed.size();
+        }
+
+        Header<size_t> header;
+        {
+            PhaseTimer timer(stats, LoadPhase::HEADER, options);
+            header = read_header<size_t>(pos, end, true);
         }
 
-        // Fix the 1-indexing
-        row--;
-        col--;
+        PhaseTimer timer(stats, LoadPhase::PARSE, options);
+        dense.num_rows = header.num_rows;
+        dense.num_cols = header.num_cols;
+        dense.layout = layout;
+        dense.values.resize(dense_stored_values(SymmetryType::GENERAL, header.num_rows, header.num_cols));
+        if (options.mode == LoadMode::PARALLEL) {
+            parse_dense_parallel(pos, end, header, resolve_num_threads(options.num_threads), layout,
+                                 dense.values.data());
+        } else {
+            parse_dense_values(pos, end, header, 0, header.num_nonzeros, layout, dense.values.data());
+        }
 
-        nonzeros.push_back(Nonzero<CoordType,ValueType>{row, col, value});
-        if (header.symmetry == SymmetryType::SYMMETRIC && row != col) {
-            nonzeros.push_back(Nonzero<CoordType,ValueType>{col, row, value});
+        stats.lines_parsed = header.num_nonzeros;
+        stats.comment_lines = header.num_comment_lines;
+        if (header.symmetry == SymmetryType::SKEW_SYMMETRIC) {
+            stats.symmetric_expansions = header.num_nonzeros;
+        } else if (header.symmetry != SymmetryType::GENERAL) {
+            stats.symmetric_expansions = header.num_nonzeros - header.num_rows;
         }
     }
 
-    // nonzeros is now a COO representation of the matrix
-    // the remaining code converts it to CSR
+    if (options.stats != nullptr) {
+        stats.matrix_bytes = vector_bytes(dense.values);
+        stats.peak_bytes = stats.matrix_bytes;
+        *options.stats = stats;
+    }
+    return dense;
+}
 
-    std::sort(nonzeros.begin(), nonzeros.end(), 
-            [](const NonzeroType& a, const NonzeroType& b) {
-        return std::tie(a.row, a.col) < std::tie(b.row, b.col);
-    });
+///////////////////////////////////////////////////////////////////////////////
+// Number formatting
+///////////////////////////////////////////////////////////////////////////////
 
-    std::vector<CoordType> row_offsets;
-    std::vector<CoordType> col_indices;
-    std::vector<ValueType> values;
-    row_offsets.push_back(0);
+// These write one number at `out` and return the position after it. `out`
+// needs room for 64 characters.
 
-    CoordType current_row = 0;
+inline char* format_uint(uint64_t value, char* out) {
+    char digits[20];
+    int n = 0;
+    do {
+        digits[n++] = static_cast<char>('0' + value % 10);
+        value /= 10;
+    } while (value != 0);
+    while (n > 0) {
+        *out++ = digits[--n];
+    }
+    return out;
+}
 
-    for (const auto& nz : nonzeros) {
-        while (current_row < nz.row) {
-            row_offsets.push_back(static_cast<CoordType>(col_indices.size()));
-            ++current_row;
-        }
-        col_indices.push_back(nz.col);
-        values.push_back(nz.value);
+template<typename IntType>
+char* format_int(IntType value, char* out) {
+    static_assert(std::is_integral<IntType>::value, "IntType must be integral");
+    if (value < 0) {
+        *out++ = '-';
+        return format_uint(static_cast<uint64_t>(0) - static_cast<uint64_t>(value), out);
     }
+    return format_uint(static_cast<uint64_t>(value), out);
+}
+
+inline int format_precision(char* out, int precision, float value) {
+    return std::snprintf(out, 64, "%.*g", precision, static_cast<double>(value));
+}
+inline int format_precision(char* out, int precision, double value) {
+    return std::snprintf(out, 64, "%.*g", precision, value);
+}
+inline int format_precision(char* out, int precision, long double value) {
+    return std::snprintf(out, 64, "%.*Lg", precision, value);
+}
 
-    while (current_row < header.num_rows) {
-        row_offsets.push_back(static_cast<CoordType>(col_indices.size()));
-        current_row++;
+// Round-trip formatting. The shortest digits need std::to_chars, i.e. a C++17
+// library with floating-point support. Otherwise a single %.Ng with N =
+// max_digits10 (17 for double) reads back exactly but is not always the
+// shortest. Whole numbers are written directly as integers either way.
+template<typename FloatType>
+char* format_float(FloatType value, char* out) {
+    if (value == std::floor(value) && std::fabs(value) < FloatType(1e15) &&
+        !(value == 0 && std::signbit(value))) {
+        return format_int(static_cast<int64_t>(value), out);
     }
+#if defined(__cpp_lib_to_chars) && __cpp_lib_to_chars >= 201611L
+    return std::to_chars(out, out + 64, value).ptr;
+#else
+    return out + format_precision(out, std::numeric_limits<FloatType>::max_digits10, value);
+#endif
+}
 
-    return CSRMatrix<CoordType, ValueType>{
-        header.num_rows,
-        header.num_cols,
-        static_cast<CoordType>(values.size()),
-        std::move(row_offsets),
-        std::move(col_indices),
-        std::move(values)
-    };
+template<typename NumType>
+char* format_num(NumType value, char* out, std::true_type /* integral */) {
+    return format_int(value, out);
 }
 
-///////////////////////////////////////////////////////////////////////////////
+template<typename NumType>
+char* format_num(NumType value, char* out, std::false_type /* integral */) {
+    return format_float(value, out);
+}
 
-template<typename CoordType, typename ValueType>
-CSCMatrix<CoordType,ValueType> read_csc(const char* filename) {
+template<typename NumType>
+char* format_num(NumType value, char* out) {
+    return format_num(value, out, std::is_integral<NumType>());
+}
 
-    static_assert(std::is_integral<CoordType>::value, "CoordType must be integral");
-    static_assert(std::is_arithmetic<ValueType>::value, "ValueType must be arithmetic");
+///////////////////////////////////////////////////////////////////////////////
+// Write MatrixMarket
+///////////////////////////////////////////////////////////////////////////////
 
-    std::ifstream infile(filename);
-    if (!infile.is_open()) {
-        throw new std::invalid_argument("Could not open file for reading");
+inline const char* value_fmt_name(ValueFormat value_fmt) {
+    switch (value_fmt) {
+    case ValueFormat::INTEGER: return "integer";
+    case ValueFormat::PATTERN: return "pattern";
+    case ValueFormat::COMPLEX: return "complex";
+    default: return "real";
     }
-    
-    auto header = read_header<CoordType>(infile);
-
-    // Read in and populate the non-zeros in "COO format"
+}
 
-    using NonzeroType = Nonzero<CoordType,ValueType>;
+inline const char* symmetry_name(SymmetryType symmetry) {
+    switch (symmetry) {
+    case SymmetryType::SYMMETRIC: return "symmetric";
+    case SymmetryType::SKEW_SYMMETRIC: return "skew-symmetric";
+    case SymmetryType::HERMITIAN: return "hermitian";
+    default: return "general";
+    }
+}
 
-    std::vector<NonzeroType> nonzeros;
-    for (CoordType i = 0; i < header.num_nonzeros; i++) {
-        std::string line;
-        std::getline(infile, line);
-        auto tokens = Tokens(line, ' ');
+// Whether entry (row, col) is stored in a file of the given symmetry
+inline bool stored_entry(SymmetryType symmetry, uint64_t row, uint64_t col) {
+    switch (symmetry) {
+    case SymmetryType::GENERAL: return true;
+    case SymmetryType::SKEW_SYMMETRIC: return row > col;
+    default: return row >= col;
+    }
+}
 
-        if (header.value_type == ValueFormat::PATTERN && tokens.size() != 2) {
-            throw std::invalid_argument("Bad Matrix: ill-shaped pattern line");
-        } else if (header.value_type != ValueFormat::PATTERN && tokens.size() != 3) {
-            throw std::invalid_argument("Bad Matrix: ill-shaped value line");
-        }
+// Appends " value" in the output format, nothing for PATTERN
+template<typename NumType>
+char* format_value(ValueFormat value_fmt, NumType value, char* out) {
+    if (value_fmt == ValueFormat::INTEGER) {
+        *out++ = ' ';
+        out = format_int(static_cast<int64_t>(value), out);
+    } else if (value_fmt == ValueFormat::REAL) {
+        *out++ = ' ';
+        out = format_num(value, out);
+    } else if (value_fmt == ValueFormat::COMPLEX) {
+        *out++ = ' ';
+        out = format_num(value, out);
+        *out++ = ' ';
+        *out++ = '0';
+    }
+    return out;
+}
 
-        auto row = parse_int<CoordType>(tokens.pop());
-        auto col = parse_int<CoordType>(tokens.pop());
-        auto value = header.value_type == ValueFormat::PATTERN ? 1 : parse_num<ValueType>(tokens.pop());
+template<typename NumType>
+char* format_value(ValueFormat value_fmt, const std::complex<NumType>& value, char* out) {
+    out = format_value(value_fmt == ValueFormat::COMPLEX ? ValueFormat::REAL : value_fmt, value.real(), out);
+    if (value_fmt == ValueFormat::COMPLEX) {
+        *out++ = ' ';
+        out = format_num(value.imag(), out);
+    }
+    return out;
+}
 
-        if (row < 1 || row > header.num_rows) {
-            throw std::invalid_argument("Bad Matrix: row out of bounds");
-        }
+inline char* format_value(ValueFormat, NoValue, char* out) {
+    return out;
+}
 
-        if (col < 1 || col > header.num_cols) {
-            throw std::invalid_argument("Bad Matrix: col out of bounds");
+// Appends the entries of segments [first, last) to `out`. With `triangle`
+// the matrix holds one triangle: every entry is written, those of the upper
+// triangle as their mirror in the lower one. Offsets and indices start at
+// `base`.
+template<typename OffsetArray, typename IndexArray, typename ValueArray>
+void format_segments(size_t first, size_t last, bool by_col, bool triangle, unsigned base,
+                     const WriteOptions& options,
+                     const OffsetArray& offsets,
+                     const IndexArray& indices,
+                     const ValueArray& values,
+                     std::string& out) {
+    char line[4 * 64 + 4];
+    for (size_t m = first; m < last; m++) {
+        const size_t end = static_cast<size_t>(offsets[m + 1]) - base;
+        for (size_t i = static_cast<size_t>(offsets[m]) - base; i < end; i++) {
+            const uint64_t major = m + 1;
+            const uint64_t minor = static_cast<uint64_t>(indices[i]) - base + 1;
+            uint64_t row = by_col ? minor : major;
+            uint64_t col = by_col ? major : minor;
+            const bool mirror = triangle && row < col;
+            if (mirror) {
+                std::swap(row, col);
+            } else if (!triangle && !stored_entry(options.symmetry, row, col)) {
+                continue;
+            }
+            char* pos = format_uint(row, line);
+            *pos++ = ' ';
+            pos = format_uint(col, pos);
+            pos = format_value(options.value_type, mirror ? mirror_value(options.symmetry, values[i]) : values[i], pos);
+            *pos++ = '\n';
+            out.append(line, pos);
         }
+    }
+}
 
-        // Fix the 1-indexing
-        row--;
-        col--;
+// Shared by both write_mtx overloads. Segments are cut into pieces of about
+// the same number of entries; each round formats one piece per thread into
+// its own buffer and the buffers are then written in order, which keeps the
+// memory used for formatting bounded. Matrices without values are always
+// written as pattern matrices.
+template<typename CoordType, typename OffsetArray, typename IndexArray, typename ValueArray>
+void write_compressed(const char* filename, CoordType num_rows, CoordType num_cols, bool by_col,
+                      SymmetryType symmetry, unsigned base, const WriteOptions& write_options,
+                      const OffsetArray& offsets,
+                      const IndexArray& indices,
+                      const ValueArray& values) {
+    WriteOptions options = write_options;
+    const bool triangle = symmetry != SymmetryType::GENERAL;
+    if (triangle) {
+        options.symmetry = symmetry;
+    }
+    if (std::is_same<typename ValueArray::value_type, NoValue>::value) {
+        options.value_type = ValueFormat::PATTERN;
+    } else if (is_complex<typename ValueArray::value_type>::value && options.value_type == ValueFormat::REAL) {
+        options.value_type = ValueFormat::COMPLEX;
+    }
+    const size_t num_segments = offsets.empty() ? 0 : offsets.size() - 1;
+    const size_t nnz = indices.size();
 
-        nonzeros.push_back(Nonzero<CoordType,ValueType>{row, col, value});
-        if (header.symmetry == SymmetryType::SYMMETRIC && row != col) {
-            nonzeros.push_back(Nonzero<CoordType,ValueType>{col, row, value});
+    size_t nnz_written = nnz;
+    if (options.symmetry != SymmetryType::GENERAL && num_rows != num_cols) {
+        throw std::invalid_argument("Bad Matrix: symmetric matrix must be square");
+    }
+    if (options.symmetry != SymmetryType::GENERAL && !triangle) {
+        nnz_written = 0;
+        for (size_t m = 0; m < num_segments; m++) {
+            const size_t end = static_cast<size_t>(offsets[m + 1]) - base;
+            for (size_t i = static_cast<size_t>(offsets[m]) - base; i < end; i++) {
+                const uint64_t minor = static_cast<uint64_t>(indices[i]) - base;
+                nnz_written += by_col ? stored_entry(options.symmetry, minor, m)
+                                      : stored_entry(options.symmetry, m, minor);
+            }
         }
     }
 
-    // nonzeros is now a COO representation of the matrix
-    // the remaining code converts it to CSR
-
-    std::sort(nonzeros.begin(), nonzeros.end(), 
-            [](const NonzeroType& a, const
-                NonzeroType& b) {
-        return std::tie(a.col, a.row) < std::tie(b.col, b.row);
-    });
-
-    std::vector<CoordType> col_offsets;
-    std::vector<CoordType> row_indices;
-    std::vector<ValueType> values;
-    col_offsets.push_back(0);
-    
-    CoordType current_col = 0;
+    FILE* f = std::fopen(filename, "wb");
+    if (f == nullptr) {
+        throw std::invalid_argument("Could not open file for writing");
+    }
+    std::fprintf(f, "%%%%MatrixMarket matrix coordinate %s %s\n%llu %llu %llu\n",
+                 value_fmt_name(options.value_type), symmetry_name(options.symmetry),
+                 static_cast<unsigned long long>(num_rows), static_cast<unsigned long long>(num_cols),
+                 static_cast<unsigned long long>(nnz_written));
 
-    for (const auto& nz : nonzeros) {
-        while (current_col < nz.col) {
-            col_offsets.push_back(static_cast<CoordType>(row_indices.size()));
-            ++current_col;
+    // Piece boundaries, each about piece_nnz entries
+    const size_t piece_nnz = size_t(1) << 20;
+    std::vector<size_t> pieces(1, 0);
+    for (size_t m = 0; m < num_segments; m++) {
+        if (static_cast<size_t>(offsets[m + 1]) - static_cast<size_t>(offsets[pieces.back()]) >= piece_nnz) {
+            pieces.push_back(m + 1);
         }
-        row_indices.push_back(nz.row);
-        values.push_back(nz.value);
     }
+    if (pieces.back() != num_segments) {
+        pieces.push_back(num_segments);
+    }
+    const size_t num_pieces = pieces.size() - 1;
 
-    while (current_col < header.num_cols) {
-        col_offsets.push_back(static_cast<CoordType>(row_indices.size()));
-        current_col++;
+    const unsigned num_threads = static_cast<unsigned>(std::max<size_t>(1,
+        std::min<size_t>(resolve_num_threads(options.num_threads), num_pieces)));
+    std::vector<std::string> buffers(num_threads);
+    bool ok = true;
+    for (size_t round = 0; round < num_pieces && ok; round += num_threads) {
+        parallel_for_threads(num_threads, [&](unsigned t) {
+            buffers[t].clear();
+            if (round + t < num_pieces) {
+                format_segments(pieces[round + t], pieces[round + t + 1], by_col, triangle, base, options,
+                                offsets, indices, values, buffers[t]);
+            }
+        });
+        for (unsigned t = 0; t < num_threads && ok; t++) {
+            ok = std::fwrite(buffers[t].data(), 1, buffers[t].size(), f) == buffers[t].size();
+        }
     }
+    ok = std::fclose(f) == 0 && ok;
+    if (!ok) {
+        throw std::invalid_argument("Could not write file");
+    }
+}
 
-    return CSCMatrix<CoordType, ValueType>{
-        header.num_rows,
-        header.num_cols,
-        static_cast<CoordType>(values.size()),
-        std::move(col_offsets),
-        std::move(row_indices),
-        std::move(values)
-    };
+template<typename CoordType, typename ValueType, typename OffsetType, typename Allocator>
+void write_mtx(const char* filename, const CSRMatrix<CoordType,ValueType,OffsetType,Allocator>& csr,
+               const WriteOptions& options) {
+    write_compressed(filename, csr.num_rows, csr.num_cols, false, csr.symmetry, csr.index_base, options,
+                     csr.row_offsets, csr.col_indices, csr.values);
+}
+
+template<typename CoordType, typename ValueType, typename OffsetType, typename Allocator>
+void write_mtx(const char* filename, const CSCMatrix<CoordType,ValueType,OffsetType,Allocator>& csc,
+               const WriteOptions& options) {
+    write_compressed(filename, csc.num_rows, csc.num_cols, true, csc.symmetry, csc.index_base, options,
+                     csc.col_offsets, csc.row_indices, csc.values);
 }
 
 } // namespace MatrixMarket